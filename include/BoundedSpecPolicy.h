@@ -69,6 +69,10 @@ public:
                                  const std::vector<InterfaceType> &args,
                                  const ComponentInterface &interface,
                                  llvm::SmallBitVector &marks) override;
+
+  virtual bool interCopyOn(const llvm::Function &F,
+                           const std::vector<InterfaceType> &args,
+                           const ComponentInterface &interface) override;
 };
 
 } // end namespace
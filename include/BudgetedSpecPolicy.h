@@ -0,0 +1,136 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include "SpecializationPolicy.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallBitVector.h"
+
+#include <unordered_map>
+
+namespace llvm {
+class Module;
+class Instruction;
+}
+
+namespace previrt {
+/*
+ * This policy is actually a "functor" policy (i.e., it takes as
+ * argument another policy p).
+ *
+ * Unlike BoundedSpecPolicy, which bounds the number of copies per
+ * function, this policy bounds the total number of instructions
+ * added to the module by specialization (a percentage of the size of
+ * the module without specialized copies).
+ *
+ * All candidates accepted by p are ranked by their estimated benefit
+ * per added instruction (see CostBenefitSpecPolicy::estimate) and
+ * accepted greedily, best first, while they fit in the budget.
+ *
+ * For intra-module specialization, candidates are all the callsites
+ * of M and they are ranked when the policy is created. For
+ * inter-module specialization, candidates are all the calls in the
+ * interface and they are ranked at the first query. Queries with
+ * other arguments (e.g., one value of a set of integers) are decided
+ * when they are asked with the budget left.
+ *
+ * Copies built by previous runs are already part of the growth so
+ * they are not paid again. p is asked exactly once per candidate.
+ */
+class BudgetedSpecPolicy : public SpecializationPolicy {
+public:
+  // An inter-module call: the callee and its arguments
+  struct InterKey {
+    const llvm::Function *function;
+    std::vector<InterfaceType> args;
+
+    bool operator==(const InterKey &o) const {
+      return function == o.function && args == o.args;
+    }
+  };
+  struct InterKeyHash {
+    size_t operator()(const InterKey &k) const {
+      return llvm::hash_combine(
+          k.function, llvm::hash_combine_range(k.args.begin(), k.args.end()));
+    }
+  };
+  // Identifier of each inter-module copy (see copyKey)
+  typedef std::unordered_map<InterKey, unsigned, InterKeyHash> InterCopies;
+
+private:
+  std::unique_ptr<SpecializationPolicy> m_subpolicy;
+  llvm::Module &m_module;
+  // Maximum number of instructions that can be added to the module
+  uint64_t m_budget;
+  // Number of instructions added so far
+  uint64_t m_growth;
+  // Selected callsites with their marks
+  llvm::DenseMap<const llvm::Instruction *, std::vector<llvm::Value *>>
+      m_intra_selected;
+  // Decided interface calls with their marks (empty if rejected)
+  std::unordered_map<InterKey, llvm::SmallBitVector, InterKeyHash>
+      m_inter_decisions;
+  InterCopies m_inter_copies;
+  // Inter-module copies already paid
+  llvm::DenseSet<unsigned> m_inter_paid;
+  bool m_inter_ranked;
+
+  void rankIntraCandidates();
+  void rankInterCandidates(const ComponentInterface &interface);
+
+public:
+  // max_growth is a percentage of the size of M.
+  BudgetedSpecPolicy(llvm::Module &M,
+                     std::unique_ptr<SpecializationPolicy> subpolicy,
+                     unsigned max_growth);
+
+  virtual ~BudgetedSpecPolicy() = default;
+
+  virtual bool intraSpecializeOn(llvm::CallSite CS,
+                                 std::vector<llvm::Value *> &marks) override;
+
+  virtual bool interSpecializeOn(const llvm::Function &F,
+                                 const std::vector<InterfaceType> &args,
+                                 const ComponentInterface &interface,
+                                 llvm::SmallBitVector &marks) override;
+
+  virtual bool interCopyOn(const llvm::Function &F,
+                           const std::vector<InterfaceType> &args,
+                           const ComponentInterface &interface) override;
+};
+
+} // end namespace
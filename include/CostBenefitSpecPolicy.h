@@ -0,0 +1,149 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include "SpecializationPolicy.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+
+#include <set>
+#include <unordered_set>
+
+namespace llvm {
+class Module;
+}
+
+namespace previrt {
+/*
+ * This policy is actually a "functor" policy (i.e., it takes as
+ * argument another policy p).
+ *
+ * Allow a new (specialized) copy of a function if p agrees and the
+ * estimated benefit of the copy pays off its size:
+ *
+ * - the benefit is the number of instructions and branches of the
+ *   callee that become foldable if the marked arguments are known
+ *   (a cheap constant-propagation preview on the callee).
+ *
+ * - the cost is the size of the callee (i.e., the size of the copy).
+ *
+ * Moreover, the total number of instructions added by all copies
+ * cannot exceed a given percentage of the original module size (the
+ * module without specialized copies). Copies built by previous runs
+ * are part of the growth and a copy is only paid once, even if it is
+ * used by several callsites.
+ */
+class CostBenefitSpecPolicy : public SpecializationPolicy {
+public:
+  struct Estimate {
+    // number of instructions of the function
+    unsigned size;
+    // number of instructions that can be folded
+    unsigned folded_insts;
+    // number of conditional branches/switches that can be folded
+    unsigned folded_branches;
+
+    Estimate() : size(0), folded_insts(0), folded_branches(0) {}
+
+    unsigned benefit() const;
+  };
+
+  // Preview which instructions of F can be folded if the arguments
+  // marked in known are constants.
+  static Estimate estimate(const llvm::Function &F,
+                           const llvm::SmallBitVector &known);
+
+  // Number of instructions of F
+  static unsigned size(const llvm::Function &F);
+
+private:
+  std::unique_ptr<SpecializationPolicy> m_subpolicy;
+  // Minimum benefit (in percentage of the callee size)
+  const unsigned m_min_benefit;
+  // Maximum number of instructions that can be added to the module
+  uint64_t m_budget;
+  // Number of instructions added so far
+  uint64_t m_growth;
+
+  // Intra-module copies accepted so far: callee and marks
+  std::set<std::pair<const llvm::Function *, std::vector<llvm::Value *>>>
+      m_intra_paid;
+
+  // Inter-module copies accepted so far: callee and arguments (the
+  // unmarked arguments are unknown)
+  struct InterKey {
+    const llvm::Function *function;
+    std::vector<InterfaceType> args;
+
+    bool operator==(const InterKey &o) const {
+      return function == o.function && args == o.args;
+    }
+  };
+  struct InterKeyHash {
+    size_t operator()(const InterKey &k) const {
+      return llvm::hash_combine(
+          k.function, llvm::hash_combine_range(k.args.begin(), k.args.end()));
+    }
+  };
+  std::unordered_set<InterKey, InterKeyHash> m_inter_paid;
+
+  // Return true if a copy of F is worth given the known arguments.
+  // The copy is charged to the budget unless isPaid.
+  bool payOff(const llvm::Function &F, const llvm::SmallBitVector &known,
+              bool isPaid);
+
+public:
+  // min_benefit is a percentage of the callee size.
+  // max_growth is a percentage of the size of M.
+  CostBenefitSpecPolicy(llvm::Module &M,
+                        std::unique_ptr<SpecializationPolicy> subpolicy,
+                        unsigned min_benefit, unsigned max_growth);
+
+  virtual ~CostBenefitSpecPolicy() = default;
+
+  virtual bool intraSpecializeOn(llvm::CallSite CS,
+                                 std::vector<llvm::Value *> &marks) override;
+
+  virtual bool interSpecializeOn(const llvm::Function &F,
+                                 const std::vector<InterfaceType> &args,
+                                 const ComponentInterface &interface,
+                                 llvm::SmallBitVector &marks) override;
+
+  virtual bool interCopyOn(const llvm::Function &F,
+                           const std::vector<InterfaceType> &args,
+                           const ComponentInterface &interface) override;
+};
+
+} // end namespace
@@ -43,10 +43,16 @@
 
 #include "Serializer.h"
 #include "proto/Previrt.pb.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
 
 #include <map>
+#include <vector>
 
 namespace llvm {
+class APInt;
+class ConstantRange;
 class Value;
 class Function;
 class Module;
@@ -97,27 +103,63 @@ enum class TypeRefinementKind: int {
  * So the "interface type" abstraction is pretty similar to constant
  * propagation, but constant are split into groups (integer, fp, etc).
  *
+ * Integer arguments that are not constants but can only take a few
+ * values are abstracted by two more (non-concrete) elements:
+ *
+ * IntSet(S):   the argument is one of the integer constants in S
+ *              (e.g., a phi node or select of constants)
+ * IntRange(R): the argument is in the range of integers R
+ *              (e.g., the result of an "and" with a constant mask)
+ *
+ * IntCst(V)    <= IntSet(S)   iff V \in S
+ * IntSet(S1)   <= IntSet(S2)  iff S1 \subseteq S2
+ * IntCst(V)    <= IntRange(R) iff V \in R
+ * IntSet(S)    <= IntRange(R) iff S \subseteq R
+ * IntRange(R1) <= IntRange(R2) iff R1 \subseteq R2
+ *
+ * where all the integers must have the same bit width.
  */
 class InterfaceType {
+public:
+  // U, null, integer, float, string, global, set of integers and
+  // range of integers
+  enum class Kind : uint8_t { U, N, I, F, S, G, IS, IR };
+
 private:
-  proto::PrevirtType buffer;
+  // The actual representation of a type. Types are interned in a
+  // per-process table so an InterfaceType is just a pointer to its
+  // unique entry (see InterfaceTypes.cpp).
+  struct Data;
+  const Data *m_data;
+
+  InterfaceType(const Data *data) : m_data(data) {}
+  static const Data *intern(const Data &);
+
   typedef std::map<llvm::Type *, llvm::Function *> EqCache;
   static EqCache cacheEq;
 
 public:
   InterfaceType();
   InterfaceType(const proto::PrevirtType &);
-  InterfaceType &operator=(const InterfaceType &);
-  bool operator!=(const InterfaceType &) const;
-  bool operator==(const InterfaceType &) const;
+  bool operator!=(const InterfaceType &other) const {
+    return m_data != other.m_data;
+  }
+  bool operator==(const InterfaceType &other) const {
+    return m_data == other.m_data;
+  }
 
   // Return 0 or 1 if abstract(V) <= "this". Otherwise, it returns -1.
   // 
   // 0 : indicates EXACT_MATCH (i.e., "this" is not U)
-  // 1 : indicates LOOSE_MATCH (i.e., "this" is U)
+  // 1 : indicates LOOSE_MATCH (i.e., "this" is U, IntSet or IntRange)
   // -1: indicates NO_MATCH
   //
   TypeRefinementKind refines(const llvm::Value *const V) const;
+  // Same as refines(V) where abs is abstract(V). Only int sets and
+  // ranges need abs so callers that match V against several types
+  // compute it once.
+  TypeRefinementKind refines(const llvm::Value *const V,
+                             const InterfaceType &abs) const;
   // Abstract a LLVM value to an interface type
   static InterfaceType abstract(const llvm::Value *const);
   // Return U
@@ -127,8 +169,36 @@ public:
   bool isUnknown() const;
   std::string to_string() const;
 
+  // IntSet and IntRange
+  bool isIntSet() const;
+  bool isIntRange() const;
+  // The constants of an IntSet in increasing (unsigned) order
+  std::vector<llvm::APInt> getIntSet() const;
+  llvm::ConstantRange getIntRange() const;
+  // Same as abstract(ConstantInt) but without creating the constant
+  // so it can be called from several threads.
+  static InterfaceType intConstant(const llvm::APInt &value);
+  static InterfaceType intSet(llvm::ArrayRef<llvm::APInt> values);
+  static InterfaceType intRange(const llvm::ConstantRange &range);
+
+  // Raw access to the representation (used by MappedInterface).
+  //
+  // bits is the bit width (I, IS and IR) or proto::FloatSemantics
+  // (F), flag is cstr (S) or is_const (G), and value is the hex value
+  // (I and F), the comma-separated hex values (IS), the hex lower and
+  // upper bounds (IR), the string (S) or the name (G).
+  static InterfaceType get(Kind kind, unsigned bits, bool flag,
+                           llvm::StringRef value);
+  Kind getKind() const;
+  unsigned getBits() const;
+  bool getFlag() const;
+  const std::string &getValue() const;
+
   llvm::Function *getEqualityFunction(llvm::Module *) const;
 
+  // Consistent with operator==
+  friend llvm::hash_code hash_value(const InterfaceType &);
+
   FRIEND_SERIALIZERS(InterfaceType, proto::PrevirtType)
 };
 }
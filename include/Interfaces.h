@@ -44,6 +44,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "InterfaceTypes.h"
@@ -83,7 +84,9 @@ public:
 
   unsigned get_count() const { return count;}  
   
-  int refines(llvm::User::op_iterator begin, llvm::User::op_iterator end);
+  // abs[i] is the abstraction of the i-th actual argument
+  int refines(llvm::User::op_iterator begin, llvm::User::op_iterator end,
+              const std::vector<InterfaceType> &abs) const;
 
   FRIEND_SERIALIZERS(CallInfo, proto::CallInfo)
 
@@ -113,9 +116,18 @@ private:
 
   // to record direct calls to functions defined in other modules
   llvm::StringMap<std::vector<CallInfo *>> m_calls;
+  // index of m_calls by the hash of the call arguments. m_calls owns
+  // the calls and keeps the (deterministic) insertion order.
+  llvm::StringMap<std::unordered_multimap<size_t, CallInfo *>> m_calls_index;
   // to record any external symbol used in the current module.
   std::set<std::string> m_references;
 
+  // Return the call to f with exactly the same arguments if any.
+  CallInfo *findCall(llvm::StringRef f, const std::vector<InterfaceType> &args,
+                     size_t hash) const;
+  // Add a new call to f. The interface takes ownership of CI.
+  void addCall(llvm::StringRef f, CallInfo *CI, size_t hash);
+
 public:
 
   ComponentInterface() = default;
@@ -135,6 +147,11 @@ public:
   CallInfo *getOrCreateCall(FunctionHandle f,
                             const std::vector<InterfaceType> &args);
 
+  // Add the calls and references of other. The counts of calls
+  // already in the interface are added up. Return true if a new call
+  // or reference was added.
+  bool join(const ComponentInterface &other);
+
   // iteration over the functions
   FunctionIterator begin() const;
   FunctionIterator end() const;
@@ -143,6 +160,12 @@ public:
   CallIterator call_begin(llvm::StringRef) const;
   CallIterator call_end(llvm::StringRef) const;
 
+  // iteration over the external symbols
+  llvm::iterator_range<std::set<std::string>::const_iterator>
+  references() const {
+    return llvm::make_range(m_references.begin(), m_references.end());
+  }
+
   bool hasReference(llvm::StringRef ref) const {
     return m_references.count(ref) > 0;}
   
@@ -220,8 +243,17 @@ class ComponentInterfaceTransform {
     FunctionHandle Key;
   };
 
+  // Rewritten calls of a function compiled for lookupRewrite.
+  struct RuleIndex {
+    // all calls by the hash of their arguments
+    std::unordered_multimap<size_t, const CallInfo *> exact;
+    // calls with some non-concrete argument, in insertion order
+    std::vector<const CallInfo *> loose;
+  };
+
   std::unique_ptr<ComponentInterface> interface;
   FMap rewrites;
+  llvm::StringMap<RuleIndex> index;
 
 public:
   using FunctionIterator = FMapKeyIterator;
@@ -248,6 +280,8 @@ public:
 
   unsigned rewriteCount() const;
 
+  // Return the rewrite of the most specific call that is refined by
+  // the actual arguments.
   const CallRewrite *lookupRewrite(FunctionHandle, llvm::User::op_iterator,
                                    llvm::User::op_iterator) const;
 
@@ -0,0 +1,191 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "InterfaceTypes.h"
+
+namespace llvm {
+class raw_ostream;
+}
+
+namespace previrt {
+
+class ComponentInterface;
+class ComponentInterfaceTransform;
+
+/*
+ * Binary format for interfaces and rewrite files that is laid out to
+ * be queried in place after mmap.
+ *
+ * All integers are 32-bit in host byte order and all strings are
+ * (offset, length) pairs into a single string pool:
+ *
+ *   Header
+ *   FunctionEntry[num_functions]  (sorted by name)
+ *   CallEntry[num_calls]          (grouped by function)
+ *   ArgEntry[num_args]            (grouped by call)
+ *   uint32_t[num_perms]           (rewritten argument positions)
+ *   StrEntry[num_references]      (sorted)
+ *   char[strings_size]            (string pool)
+ *
+ * A call has a rewrite if it comes from a rewrite file (see
+ * -Pspecialize-output).
+ *
+ * Protobuf remains the import/export format: all readers accept both
+ * formats so that the python scripts can keep using protobuf.
+ */
+class MappedInterface {
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_functions;
+    uint32_t num_calls;
+    uint32_t num_args;
+    uint32_t num_perms;
+    uint32_t num_references;
+    uint32_t strings_size;
+    uint32_t reserved;
+  };
+
+  struct StrEntry {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  struct FunctionEntry {
+    StrEntry name;
+    uint32_t first_call;
+    uint32_t num_calls;
+  };
+
+  struct CallEntry {
+    uint32_t count;
+    uint32_t first_arg;
+    uint32_t num_args;
+    // rewrite.offset == NoRewrite if the call is not rewritten
+    StrEntry rewrite;
+    uint32_t first_perm;
+    uint32_t num_perms;
+  };
+
+  struct ArgEntry {
+    uint8_t kind;
+    uint8_t flag;
+    uint16_t reserved;
+    uint32_t bits;
+    StrEntry value;
+  };
+
+  // Version 2 added the int-set (IS) and int-range (IR) argument kinds
+  static const uint32_t Version = 2;
+  static const uint32_t NoRewrite = UINT32_MAX;
+
+  // A call in the mapped file.
+  class Call {
+    const MappedInterface *m_file;
+    const CallEntry *m_entry;
+
+  public:
+    Call(const MappedInterface *file, const CallEntry *entry)
+        : m_file(file), m_entry(entry) {}
+
+    unsigned getCount() const { return m_entry->count; }
+    unsigned getNumArgs() const { return m_entry->num_args; }
+    // The type is interned on demand.
+    InterfaceType getArg(unsigned i) const;
+    std::vector<InterfaceType> getArgs() const;
+
+    bool hasRewrite() const { return m_entry->rewrite.offset != NoRewrite; }
+    llvm::StringRef getRewriteFunction() const;
+    std::vector<unsigned> getRewriteArgs() const;
+  };
+
+private:
+  std::unique_ptr<llvm::MemoryBuffer> m_buffer;
+  const Header *m_header;
+  llvm::ArrayRef<FunctionEntry> m_functions;
+  llvm::ArrayRef<CallEntry> m_calls;
+  llvm::ArrayRef<ArgEntry> m_args;
+  llvm::ArrayRef<uint32_t> m_perms;
+  llvm::ArrayRef<StrEntry> m_references;
+  llvm::StringRef m_strings;
+
+  MappedInterface(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+  bool validate() const;
+  llvm::StringRef getString(const StrEntry &e) const {
+    return m_strings.substr(e.offset, e.length);
+  }
+  // Return nullptr if there is no entry for the function.
+  const FunctionEntry *findFunction(llvm::StringRef name) const;
+
+public:
+  // Map filename. Return nullptr if it is not a file in this format.
+  static std::unique_ptr<MappedInterface> open(const std::string &filename);
+
+  // Write I (and the rewrites of T if not null) in this format.
+  static void write(const ComponentInterface &I,
+                    const ComponentInterfaceTransform *T,
+                    llvm::raw_ostream &o);
+
+  // Functions with calls
+  unsigned getNumFunctions() const { return m_functions.size(); }
+  llvm::StringRef getFunction(unsigned i) const {
+    return getString(m_functions[i].name);
+  }
+
+  bool hasCall(llvm::StringRef name) const {
+    return findFunction(name) != nullptr;
+  }
+  std::vector<Call> calls(llvm::StringRef name) const;
+
+  bool hasReference(llvm::StringRef name) const;
+  unsigned getNumReferences() const { return m_references.size(); }
+  llvm::StringRef getReference(unsigned i) const {
+    return getString(m_references[i]);
+  }
+};
+
+} // end namespace previrt
@@ -0,0 +1,117 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include "SpecializationPolicy.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <map>
+#include <string>
+
+namespace llvm {
+class Module;
+}
+
+namespace previrt {
+/*
+ * This policy is actually a "functor" policy (i.e., it takes as
+ * argument another policy p).
+ *
+ * Allow a new (specialized) copy of a function only if the callsite
+ * is hot according to a runtime profile and p also agrees. Cold
+ * callsites are never specialized. The copies created by this policy
+ * are hot so they are marked to be inlined (see InlinerPass).
+ *
+ * The profile is taken from:
+ *
+ * 1) a callsite-count file where each line is either
+ *
+ *       <caller> <callee> <count>
+ *    or
+ *       <callee> <count>
+ *
+ *    Lines starting with # are ignored.
+ *
+ * 2) otherwise, the entry count of the callee. The entry counts are
+ *    attached to the bitcode by clang when compiling with
+ *    -fprofile-instr-use=<file>.profdata.
+ *
+ * Specialized copies (__occam_spec.*) use the counts of the function
+ * they were copied from.
+ */
+class ProfileGuidedSpecPolicy : public SpecializationPolicy {
+  std::unique_ptr<SpecializationPolicy> m_subpolicy;
+  // A callsite is hot if its count is at least m_threshold
+  uint64_t m_threshold;
+  // callee -> count
+  llvm::StringMap<uint64_t> m_callee_counts;
+  // (caller, callee) -> count
+  std::map<std::pair<std::string, std::string>, uint64_t> m_callsite_counts;
+
+  bool readProfile(const std::string &filename);
+
+  // Name of the function a specialized copy was copied from
+  static llvm::StringRef originalName(llvm::StringRef name);
+
+  uint64_t getCount(const llvm::Function *caller,
+                    const llvm::Function &callee) const;
+
+public:
+  // If threshold is 0 then it is a percentage of the hottest count.
+  ProfileGuidedSpecPolicy(llvm::Module &M,
+                          std::unique_ptr<SpecializationPolicy> subpolicy,
+                          const std::string &profile, uint64_t threshold);
+
+  virtual ~ProfileGuidedSpecPolicy() = default;
+
+  virtual bool intraSpecializeOn(llvm::CallSite CS,
+                                 std::vector<llvm::Value *> &marks) override;
+
+  virtual bool interSpecializeOn(const llvm::Function &F,
+                                 const std::vector<InterfaceType> &args,
+                                 const ComponentInterface &interface,
+                                 llvm::SmallBitVector &marks) override;
+
+  virtual bool interCopyOn(const llvm::Function &F,
+                           const std::vector<InterfaceType> &args,
+                           const ComponentInterface &interface) override;
+
+  virtual bool isHotCallSite(llvm::CallSite CS) const override;
+
+  virtual bool isHotCall(const llvm::Function &F,
+                         const std::vector<InterfaceType> &args) const override;
+};
+
+} // end namespace
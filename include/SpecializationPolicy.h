@@ -59,7 +59,10 @@ enum class SpecializationPolicyType {
   AGGRESSIVE,   // always specialize
   BOUNDED,      // always specialize up to certain threshold
   ONLY_ONCE,    // specialize if function called only once
-  NONREC        // always specialize if function is non-recursive
+  NONREC,       // always specialize if function is non-recursive
+  COST_BENEFIT, // specialize if the estimated benefit pays off the copy
+  PROFILE,      // specialize only hot callsites according to a profile
+  BUDGETED      // specialize the best callsites within a code growth budget
 };
 
 class SpecializationPolicy {
@@ -92,5 +95,25 @@ public:
                                  const std::vector<InterfaceType> &args,
                                  const ComponentInterface &interface,
                                  llvm::SmallBitVector &marks) = 0;
+
+  // Decide whether we should create a copy of CalleeF that keeps all
+  // its parameters but assumes the facts in args (e.g., the range of
+  // an integer argument). The arguments without facts are unknown.
+  virtual bool interCopyOn(const llvm::Function &CalleeF,
+                           const std::vector<InterfaceType> &args,
+                           const ComponentInterface &interface) {
+    return false;
+  }
+
+  // Return true if CS is hot so the specialized copy of its callee
+  // should be inlined. Only asked if intraSpecializeOn(CS) returned
+  // true.
+  virtual bool isHotCallSite(llvm::CallSite CS) const { return false; }
+
+  // Same as isHotCallSite but for inter-module specialization.
+  virtual bool isHotCall(const llvm::Function &CalleeF,
+                         const std::vector<InterfaceType> &args) const {
+    return false;
+  }
 };
 } // end namespace
@@ -42,9 +42,12 @@
 #pragma once
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/SmallBitVector.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 
+#include <unordered_map>
 #include <vector>
 
 namespace llvm {
@@ -65,14 +68,46 @@ public:
     std::vector<Specialization *> children;
 
     // Return true if l is more specific than r
-    static bool refines(SpecScheme l, SpecScheme r);
+    static bool refines(const SpecScheme &l, const SpecScheme &r);
   };
 
 private:
   typedef llvm::DenseMap<llvm::Function *, Specialization *> SpecTable;
+
+  /*
+   * Key of the specialization index: the original function together
+   * with its interned specialization scheme. Each argument of the
+   * scheme is interned to a pointer so that two schemes are equal iff
+   * they are pointer-wise equal (see internArg).
+   */
+  struct SpecKey {
+    llvm::Function *function;
+    std::vector<const void *> args;
+
+    bool operator==(const SpecKey &o) const {
+      return function == o.function && args == o.args;
+    }
+  };
+
+  struct SpecKeyHash {
+    size_t operator()(const SpecKey &k) const {
+      return llvm::hash_combine(
+          k.function, llvm::hash_combine_range(k.args.begin(), k.args.end()));
+    }
+  };
+
+  typedef std::unordered_map<SpecKey, llvm::Function *, SpecKeyHash> SpecIndex;
+
   mutable SpecTable specialized;
+  // (function, interned scheme) -> specialized function
+  SpecIndex index;
+  // pool of string constants used to intern string arguments
+  llvm::StringSet<> strings;
   llvm::Module *module;
 
+  const void *internArg(llvm::Value *);
+  SpecKey makeKey(llvm::Function *, const SpecScheme &);
+
 public:
   SpecializationTable();
 
@@ -82,10 +117,14 @@ public:
 
   void initialize(llvm::Module *);
 
-  void getSpecializations(llvm::Function *, SpecScheme,
+  void getSpecializations(llvm::Function *, const SpecScheme &,
                           std::vector<const Specialization *> &) const;
 
-  bool addSpecialization(llvm::Function *, SpecScheme, llvm::Function *,
+  // Return the specialized version of the function wrt to the scheme
+  // if it has been already recorded. Otherwise, return null.
+  llvm::Function *lookupSpecialization(llvm::Function *, const SpecScheme &);
+
+  bool addSpecialization(llvm::Function *, const SpecScheme &, llvm::Function *,
                          bool record = true);
 
   const Specialization *getPrincipalSpecialization(llvm::Function *) const;
@@ -36,12 +36,16 @@
 
 namespace llvm {
 class Function;
+class SmallBitVector;
 class Value;
 class BasicBlock;
 class GlobalVariable;
 }
 
 namespace previrt {
+class InterfaceType;
+class SpecializationTable;
+
 /*
  * Make a copy of f and specialize f wrt to args. args[i] is null if
  * the argument is not known, otherwise args[i] is a Constant.
@@ -49,6 +53,33 @@ namespace previrt {
 llvm::Function *specializeFunction(llvm::Function *f,
                                    const std::vector<llvm::Value *> &args);
 
+/*
+ * Return the specialized copy of f wrt args if it is already in the
+ * module (e.g., built by a previous run of the specializer).
+ */
+llvm::Function *findSpecialization(llvm::Function *f,
+                                   const std::vector<llvm::Value *> &args);
+
+/*
+ * Same as above but the known arguments are the interface types of
+ * args selected by marks (as in inter-module specialization).
+ */
+llvm::Function *findSpecialization(llvm::Function *f,
+                                   const std::vector<InterfaceType> &args,
+                                   const llvm::SmallBitVector &marks);
+
+/*
+ * Same as specializeFunction but the specialized copy is first
+ * searched in table (a hash lookup on f and args) so that the same
+ * specialization is never built twice. New specializations are
+ * recorded in table. isNew is set to true iff a new copy of f was
+ * created by this call.
+ */
+llvm::Function *getOrCreateSpecialization(SpecializationTable &table,
+                                          llvm::Function *f,
+                                          const std::vector<llvm::Value *> &args,
+                                          bool &isNew);
+
 /*
  * Specialize a call site and return the new instruction.
  * Return null if I is not CallInst or InvokeInst.
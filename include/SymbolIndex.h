@@ -0,0 +1,158 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm {
+class Module;
+class raw_ostream;
+}
+
+namespace previrt {
+
+class ComponentInterface;
+
+/*
+ * Whole-program index of the external symbols of a set of modules.
+ *
+ * For each symbol with non-local linkage it records the modules that
+ * define it, the modules that reference it (i.e., declare it), whether
+ * it is reachable from main and whether its address is taken.
+ *
+ * Reachability is computed on the reference graph of the whole
+ * program: there is an edge from a global to every global used in
+ * its body or initializer, and symbols are resolved by name across
+ * modules. The roots are main, the appending globals (e.g.,
+ * llvm.used and llvm.global_ctors) and the symbols called or
+ * referenced in the interface of the rest of the program (e.g.,
+ * atexit called by the libc). If no module defines main then all
+ * external definitions are roots.
+ *
+ * The index is computed once by -Ppropagate-interfaces and queried
+ * in place by -Pinternalize. As the interface files, it is only
+ * valid for the modules it was computed from.
+ *
+ * Layout (integers in host byte order):
+ *
+ *   Header
+ *   StrEntry[num_modules]       (module identifiers)
+ *   SymbolEntry[num_symbols]    (sorted by name)
+ *   uint64_t[num_symbols*words] (defining modules, one bitset each)
+ *   uint64_t[num_symbols*words] (referencing modules, one bitset each)
+ *   char[strings_size]          (string pool)
+ */
+class SymbolIndex {
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_modules;
+    uint32_t num_symbols;
+    // number of 64-bit words of a bitset of modules
+    uint32_t words;
+    uint32_t strings_size;
+    uint32_t reserved;
+  };
+
+  struct StrEntry {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  enum Flags : uint32_t { Reachable = 1, AddressTaken = 2 };
+
+  struct SymbolEntry {
+    StrEntry name;
+    uint32_t flags;
+    uint32_t reserved;
+  };
+
+  static const uint32_t Version = 1;
+
+private:
+  std::unique_ptr<llvm::MemoryBuffer> m_buffer;
+  const Header *m_header;
+  llvm::ArrayRef<StrEntry> m_modules;
+  llvm::ArrayRef<SymbolEntry> m_symbols;
+  llvm::ArrayRef<uint64_t> m_defs;
+  llvm::ArrayRef<uint64_t> m_refs;
+  llvm::StringRef m_strings;
+
+  SymbolIndex(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+  bool validate() const;
+  llvm::StringRef getString(const StrEntry &e) const {
+    return m_strings.substr(e.offset, e.length);
+  }
+  // Return -1 if the symbol is not in the index
+  int findSymbol(llvm::StringRef name) const;
+  unsigned countModules(llvm::ArrayRef<uint64_t> bits, int sym) const;
+
+public:
+  // Map filename. Return nullptr if it is not a file in this format.
+  static std::unique_ptr<SymbolIndex> open(const std::string &filename);
+
+  // Compute the index of the program made of modules and write it.
+  // The calls and references of entries (if any) are also roots.
+  static void write(llvm::ArrayRef<llvm::Module *> modules,
+                    const ComponentInterface *entries, llvm::raw_ostream &o);
+
+  unsigned getNumModules() const { return m_modules.size(); }
+  llvm::StringRef getModule(unsigned i) const {
+    return getString(m_modules[i]);
+  }
+
+  bool hasSymbol(llvm::StringRef name) const { return findSymbol(name) >= 0; }
+
+  // The following queries are conservative: they return true if
+  // the symbol is not in the index.
+
+  bool isReachable(llvm::StringRef name) const;
+  bool isAddressTaken(llvm::StringRef name) const;
+  // Whether a module other than the one that defines the symbol
+  // references it. Symbols with several definitions (e.g., weak) are
+  // always considered used outside.
+  bool mayBeUsedOutside(llvm::StringRef name) const;
+};
+
+} // end namespace previrt
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Pass.h"
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+class Module;
+} // namespace llvm
+
+/* Content hashes of functions recorded in the bitcode.
+
+   Some whole-program passes are expensive (e.g., they need sea-dsa)
+   and are run several times on the same module by the slash
+   fixpoint. A pass can record in the bitcode the hash of the code it
+   produced and compare it with the hash of its input in the next run
+   to know what changed since then.
+
+   The hash of a function only depends on its body, signature and
+   linkage (not on its metadata or on the names of its local values)
+   so recording a hash does not change the hash. The hash of a module
+   is computed from the names and hashes of its defined functions and
+   of its global variables (linkage, initializer and the
+   ipdse.useless_initializer metadata).
+
+   The hashes are only used as change detectors: passes must remain
+   sound (although possibly less precise) under a collision.
+*/
+
+namespace previrt {
+namespace analysis {
+
+// Return the hash of the body of F.
+uint64_t hashFunction(const llvm::Function &F);
+
+// Return the hash of all the defined functions and global variables
+// of M.
+uint64_t hashModule(const llvm::Module &M);
+
+// Return the hash recorded in F under the metadata Kind, if any.
+llvm::Optional<uint64_t> getRecordedHash(const llvm::Function &F,
+                                         llvm::StringRef Kind);
+
+// Record Hash in F under the metadata Kind.
+void recordHash(llvm::Function &F, llvm::StringRef Kind, uint64_t Hash);
+
+// Return the hash recorded in M under the named metadata Kind, if any.
+llvm::Optional<uint64_t> getRecordedHash(const llvm::Module &M,
+                                         llvm::StringRef Kind);
+
+// Record Hash in M under the named metadata Kind.
+void recordHash(llvm::Module &M, llvm::StringRef Kind, uint64_t Hash);
+
+// Hash of the module at the point where the pass is scheduled. A pass
+// that requires an instrumentation pass (e.g., sea-dsa ShadowMemPass)
+// can require this pass before it to get the hash of its input.
+class ModuleHashPass : public llvm::ModulePass {
+  uint64_t m_hash;
+
+public:
+  static char ID;
+
+  ModuleHashPass() : ModulePass(ID), m_hash(0) {}
+
+  uint64_t getHash() const { return m_hash; }
+
+  bool runOnModule(llvm::Module &M) override;
+  void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+  llvm::StringRef getPassName() const override { return "ModuleHashPass"; }
+};
+
+} // end namespace analysis
+} // end namespace previrt
@@ -7,6 +7,8 @@
 #include "llvm/Pass.h"
 #include "llvm/Support/ErrorHandling.h"
 
+#include <map>
+
 /* Notes about sea_dsa::ShadowMem
 
    sea_dsa does not provide a direct API to access to memory SSA
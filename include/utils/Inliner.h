@@ -9,6 +9,10 @@ template <typename PtrType, unsigned SmallSize> class SmallPtrSet;
 namespace previrt {
 namespace utils {
 
+// Function attribute used to mark functions (e.g., hot specialized
+// copies) that should be inlined by InlinerPass.
+static const char *const InlineHintAttr = "occam-inline";
+
 // Force to inline a function only if it belongs to inlined_functions.
 bool inlineOnly(llvm::Module &M,
                 const llvm::SmallPtrSet<llvm::Function *, 8> &inline_functions);
@@ -57,12 +57,38 @@ def interface(input_file, output_file, wrt, use_seadsa):
     args += driver.all_args('-Pinterface-entry', wrt)
     return driver.previrt(input_file, '/dev/null', args)
 
-def propagate_interfaces(libs, ifaces, use_seadsa):
+def propagate_interfaces(libs, ifaces, use_seadsa, symbols=None):
     """ compute interfaces for all modules and perform global refinement
     until stabilization.
+
+    If symbols is not None then the whole-program symbol index is
+    written there. Only supported without sea-dsa and the file is
+    removed if the single opt process fails.
     """
     tf = tempfile.NamedTemporaryFile(suffix='.iface', delete=False)
     tf.close()
+
+    if libs and not use_seadsa:
+        # all modules are processed by a single opt process
+        args = ['-Ppropagate-interfaces',
+                '-Ppropagate-interfaces-output', tf.name]
+        args += driver.all_args('-Ppropagate-interfaces-input', ifaces)
+        args += driver.all_args('-Ppropagate-interfaces-module', libs[1:])
+        if symbols is not None:
+            args += ['-Ppropagate-interfaces-symbols', symbols]
+        retcode = driver.previrt(libs[0], '/dev/null', args,
+                                 fail_on_error=False)
+        if retcode == 0:
+            iface = inter.parseInterface(tf.name)
+            os.unlink(tf.name)
+            return iface
+        # fall back to one opt process per module. The symbol index
+        # is only computed by the single process.
+        sys.stderr.write('propagate_interfaces: opt returned {0}, '
+                         'propagating module by module\n'.format(retcode))
+        if symbols is not None and os.path.exists(symbols):
+            os.unlink(symbols)
+
     iface = inter.parseInterface(ifaces[0])
     for i in ifaces[1:]:
         inter.joinInterfaces(iface, inter.parseInterface(i))
@@ -82,7 +108,7 @@ def propagate_interfaces(libs, ifaces, use_seadsa):
     return iface
 
 def specialize(input_file, output_file, rewrite_file, interfaces, \
-               policy, max_bounded):
+               policy, max_bounded, profile=None, max_growth=None):
     """ inter module specialization.
     """
     args = ['-Pspecialize']
@@ -93,6 +119,10 @@ def specialize(input_file, output_file, rewrite_file, interfaces, \
         args += ['-Pspecialize-policy={0}'.format(policy)]
     if policy == 'bounded':
         args += ['-Pspecialize-max-bounded={0}'.format(max_bounded)]
+    if policy == 'profile' and profile is not None:
+        args += ['-Pspecialize-profile={0}'.format(profile)]
+    if policy in ('cost-benefit', 'budgeted') and max_growth is not None:
+        args += ['-Pspecialize-max-growth={0}'.format(max_growth)]
     if output_file is None:
         output_file = '/dev/null'
     return driver.previrt(input_file, output_file, args)
@@ -142,10 +172,11 @@ def rewrite(input_file, output_file, rewrites, output=None):
     args = ['-Prewrite'] + driver.all_args('-Prewrite-input', rewrites)
     return driver.previrt_progress(input_file, output_file, args, output)
 
-def force_inline(input_file, output_file, inline_bounce, inline_specialized, output=None):
+def force_inline(input_file, output_file, inline_bounce, inline_specialized, \
+                 inline_hinted=False, output=None):
     """ Force inlining of special functions
     """
-    if not inline_bounce and not inline_specialized:
+    if not inline_bounce and not inline_specialized and not inline_hinted:
         shutil.copy(input_file, output_file)
         return 0
 
@@ -156,13 +187,24 @@ def force_inline(input_file, output_file, inline_bounce, inline_specialized, out
     if inline_specialized:
         sys.stderr.write("\tinlining specialized functions\n")
         args += ['-Pinline-specialized-functions']
+    if inline_hinted:
+        sys.stderr.write("\tinlining hot specialized functions\n")
+        args += ['-Pinline-hinted-functions']
     return driver.previrt_progress(input_file, output_file, args, output)
 
-def internalize(input_file, output_file, interfaces, whitelist):
+def merge_specialized(input_file, output_file, output=None):
+    """ Merge identical functions created by specialization and devirtualization
+    """
+    args = ['-Pmerge-specialized']
+    return driver.previrt_progress(input_file, output_file, args, output)
+
+def internalize(input_file, output_file, interfaces, whitelist, index=None):
     """ marks unused symbols as internal/hidden
     """
     args = ['-Pinternalize'] + \
            driver.all_args('-Pinternalize-wrt-interfaces', interfaces)
+    if index is not None:
+        args += ['-Pinternalize-wrt-index', index]
 
     if whitelist is not None:
         args = args + ['-Pkeep-external', whitelist]
@@ -224,7 +266,8 @@ def peval(input_file, output_file, \
           policy, max_bounded, \
           use_seaopt, use_seadsa,
           force_inline_spec, \
-          use_ipdse, use_crabopt, log=None):
+          use_ipdse, use_crabopt, log=None, profile=None, merge_spec=False, \
+          lazy_spec=False, max_growth=None):
     """ intra module specialization/optimization
     """
     opt = tempfile.NamedTemporaryFile(suffix='.bc', delete=False)
@@ -290,11 +333,16 @@ def peval(input_file, output_file, \
         passes = [
             ## Options for sea-dsa
             '--sea-dsa=cs', '--sea-dsa-type-aware', '--horn-sea-dsa-split', \
-            ## Options to run ipdse
-            '--ipdse', '--ipdse-only-singleton=true', '-ipdse-max-def-use=200'
+            ## Options to run ipdse. ipdse records a hash of the module
+            ## so that it does nothing if nothing changed.
+            '--ipdse', '--ipdse-only-singleton=false', '--ipdse-skip-unchanged'
         ]
-        ## 2. perform OCCAM IPSCCP
-        passes += ['-Pipsccp']
+        ## 2. perform OCCAM IPSCCP (tracking ranges of integers and fields
+        ##    of globals using the same sea-dsa analysis). IPSCCP records
+        ##    a hash of each function so that the next iteration of the
+        ##    slash fixpoint only solves the functions that changed.
+        passes += ['-Pipsccp', '-Pipsccp-track-ranges', '-Pipsccp-track-fields',
+                   '-Pipsccp-incremental']
         ## 3. cleanup after IPSCCP
         passes += ['-globaldce']
 
@@ -335,18 +383,31 @@ def peval(input_file, output_file, \
 
             ### perform specialization using policies
             pass_args += ['-Ppeval', '-Ppeval-policy={0}'.format(policy), '-Ppeval-opt']
+            if lazy_spec:
+                ## only clone for the callsites that survive the
+                ## simplification of their callers
+                pass_args += ['-Ppeval-lazy']
             if policy == 'bounded':
                 pass_args += ['-Ppeval-max-bounded={0}'.format(max_bounded)]
+            if policy == 'profile' and profile is not None:
+                pass_args += ['-Ppeval-profile={0}'.format(profile)]
+            if policy in ('cost-benefit', 'budgeted') and max_growth is not None:
+                pass_args += ['-Ppeval-max-growth={0}'.format(max_growth)]
 
             progress = driver.previrt_progress(opt.name, tmp.name, pass_args, output=out)
             sys.stderr.write("\tintra-module specialization finished\n")
             # forcing inlining of specialized functions if option is enabled
-            force_inline(tmp.name, done.name, False, force_inline_spec)
+            force_inline(tmp.name, done.name, False, force_inline_spec, \
+                         inline_hinted=(policy == 'profile'))
             if progress:
                 if log is not None:
                     log.write(out[0])
             else:
                 break
+        ## merge specialized copies that became identical after optimization
+        if merge_spec and merge_specialized(done.name, tmp.name):
+            shutil.copy(tmp.name, done.name)
+            sys.stderr.write("\tmerged identical specialized functions\n")
     else:
         print("\tskipped intra-module specialization")
 
@@ -73,10 +73,12 @@ instructions = """slash has three modes of use:
         --print-after-all          : Pass the print-after-all flag into all calls to opt
         --amalgamate=<file>        : Amalgamate the bitcode into a single <file> before linking (used to deal with duplicate symbols)
         --intra-spec-policy=<type> : Specialization policy for intramodule calls
-                                     (<type> should be either none, aggressive, nonrec-aggressive, bounded, or onlyonce)
+                                     (<type> should be either none, aggressive, nonrec-aggressive, bounded, onlyonce, cost-benefit, profile, or budgeted)
         --inter-spec-policy=<type> : Specialization policy for intermodule calls
-                                     (<type> should be either none, aggressive, nonrec-aggressive, bounded, or onlyonce)
+                                     (<type> should be either none, aggressive, nonrec-aggressive, bounded, onlyonce, cost-benefit, profile, or budgeted)
         --max-bounded-spec=N       : Maximum number of function specialization if spec policy is bounded
+        --max-spec-growth=N        : Maximum growth (in % of the module size) if spec policy is cost-benefit or budgeted
+        --spec-profile=<file>      : Callsite counts (<caller> <callee> <count> per line) if spec policy is profile
         --use-pointer-analysis     : Use pointer analysis for dealing with indirect calls
         --use-seaopt               : Enable LLVM optimizer using seadsa-based alias analysis
         --use-crabopt              : Enable LLVM optimizer using the Crab abstract interpreter
@@ -84,6 +86,8 @@ instructions = """slash has three modes of use:
         --config-prime-spec-only-globals: configuration priming specializes only reads/writes from/to globals
         --disable-inlining         : Disable inlining
         --force-inline-spec        : Force inlining of functions generated by specialization
+        --merge-spec               : Merge identical functions generated by specialization
+        --lazy-spec                : Only clone functions for callsites that survive the simplification of their callers
         --keep-external=<file>     : Pass a list of function names that should remain external
         --entry-point              : Entry points of a library (function names separated by comma)
         --remove-functions         : List of functions to be removed at the user's risk.
@@ -105,7 +109,7 @@ def entrypoint():
 
 
 def  usage(exe):
-    template = '{0} [--work-dir=<dir>]  [--force] [--help] [--stats] [--opt-stats] [--no-strip] [--verbose] [--debug-manager=] [--debug-pass=] [--debug] [--entry-point] [--print-after-all] [--intra-spec-policy=<type>] [--inter-spec-policy=<type>] [--max-bounded-spec=N] [--disable-inlining] [--use-pointer-analysis] [--use-seaopt] [--use-crabopt] [--force-inline-spec] [--keep-external=<file>] [--enable-config-prime] [--config-prime-spec-only-globals] [--ipdse] [--rop-guided-dce] [--remove-functions] <manifest>\n'
+    template = '{0} [--work-dir=<dir>]  [--force] [--help] [--stats] [--opt-stats] [--no-strip] [--verbose] [--debug-manager=] [--debug-pass=] [--debug] [--entry-point] [--print-after-all] [--intra-spec-policy=<type>] [--inter-spec-policy=<type>] [--max-bounded-spec=N] [--max-spec-growth=N] [--spec-profile=<file>] [--disable-inlining] [--use-pointer-analysis] [--use-seaopt] [--use-crabopt] [--force-inline-spec] [--merge-spec] [--lazy-spec] [--keep-external=<file>] [--enable-config-prime] [--config-prime-spec-only-globals] [--ipdse] [--rop-guided-dce] [--remove-functions] <manifest>\n'
     sys.stderr.write(template.format(exe))
 
 class Slash:
@@ -132,11 +136,15 @@ class Slash:
                         'intra-spec-policy=',
                         'inter-spec-policy=',
                         'max-bounded-spec=',
+                        'max-spec-growth=',
+                        'spec-profile=',
                         'disable-inlining',
                         'use-pointer-analysis',
                         'use-seaopt',
                         'use-crabopt',
                         'force-inline-spec',
+                        'merge-spec',
+                        'lazy-spec',
                         'tool=',
                         'verbose',
                         'keep-external=',
@@ -194,11 +202,11 @@ class Slash:
             return 1
 
         def check_spec_policy(policy):
-            """ Supported policies: none, aggressive, nonrec-aggressive, bounded or onlyonce """
-            if not policy in ('none', 'aggressive', 'bounded', 'onlyonce', 'nonrec-aggressive'):
+            """ Supported policies: none, aggressive, nonrec-aggressive, bounded, onlyonce, cost-benefit, profile or budgeted """
+            if not policy in ('none', 'aggressive', 'bounded', 'onlyonce', 'nonrec-aggressive', 'cost-benefit', 'profile', 'budgeted'):
                 sys.stderr.write('Error: unsupported specialization policy. ' + \
                                  'Valid policies: none, aggressive, nonrec-aggressive, ' + \
-                                 'bounded, onlyonce\n')
+                                 'bounded, onlyonce, cost-benefit, profile, budgeted\n')
                 return False
             return True
 
@@ -237,11 +245,17 @@ class Slash:
             return 1
         # Only used if intra_spec_policy or inter_spec_policy = bounded
         max_bounded_spec = utils.get_flag(self.flags, 'max-bounded-spec', None)
+        # Only used if intra_spec_policy or inter_spec_policy = cost-benefit or budgeted
+        max_spec_growth = utils.get_flag(self.flags, 'max-spec-growth', None)
+        # Only used if intra_spec_policy or inter_spec_policy = profile
+        spec_profile = utils.get_flag(self.flags, 'spec-profile', None)
         no_inlining = utils.get_bool_flag(self.flags, 'disable-inlining')
         use_seadsa = utils.get_bool_flag(self.flags, 'use-pointer-analysis')
         use_seaopt = utils.get_bool_flag(self.flags, 'use-seaopt')
         use_crabopt = utils.get_bool_flag(self.flags, 'use-crabopt')
         inline_spec = utils.get_bool_flag(self.flags, 'force-inline-spec')
+        merge_spec = utils.get_bool_flag(self.flags, 'merge-spec')
+        lazy_spec = utils.get_bool_flag(self.flags, 'lazy-spec')
         native_lib_flags = []
         #this is simplistic. we are assuming they are (possibly)
         #relative paths, if we need to use a search path then this
@@ -404,6 +418,7 @@ class Slash:
         # Begin main loop
         iface_before_file = provenance.VersionedFile('interface_before', 'iface')
         iface_after_file = provenance.VersionedFile('interface_after', 'iface')
+        symbols_file = provenance.VersionedFile('symbols', 'idx')
         progress = True
         rewrite_files = {}
         for m, _ in files.items():
@@ -448,7 +463,9 @@ class Slash:
                              use_seadsa, \
                              inline_spec, \
                              use_ipdse, use_crabopt, \
-                             log=open(fn, 'w'))
+                             log=open(fn, 'w'), profile=spec_profile, \
+                             merge_spec=merge_spec, lazy_spec=lazy_spec, \
+                             max_growth=max_spec_growth)
 
             pool.InParallel(intra, files.values(), self.pool)
 
@@ -468,7 +485,9 @@ class Slash:
                     post = m.new('s')
                     rw = rewrite_files[nm].new()
                     passes.specialize(pre, post, rw, [iface_before_file.get()],
-                                      inter_spec_policy, max_bounded_spec)
+                                      inter_spec_policy, max_bounded_spec,
+                                      profile=spec_profile,
+                                      max_growth=max_spec_growth)
 
                 print("\tInter-specialization policy={0}".format(inter_spec_policy))
                 if inter_spec_policy == 'bounded':
@@ -505,9 +524,13 @@ class Slash:
 
             ### 6. Sealing
 
-            # Compute the interfaces again after new specialized functions
+            # Compute the interfaces again after new specialized
+            # functions. The symbol index is computed from the same
+            # modules so it is only valid for sealing.
+            symbols = None if use_seadsa else symbols_file.new()
             iface = passes.propagate_interfaces([x.get() for x in files.values()],
-                                                ['main.iface'], use_seadsa)
+                                                ['main.iface'], use_seadsa,
+                                                symbols=symbols)
             interface.writeInterface(iface, iface_after_file.new())
 
             # internalize
@@ -515,7 +538,8 @@ class Slash:
                 "Hides exported functions that are not referenced from outside the module"
                 pre = m.get()
                 post = m.new('h')
-                passes.internalize(pre, post, [iface_after_file.get()], self.whitelist)
+                passes.internalize(pre, post, [iface_after_file.get()], self.whitelist,
+                                   index=symbols)
 
             pool.InParallel(sealing, files.values(), self.pool)
 
@@ -33,6 +33,7 @@
 //
 
 #include "AggressiveSpecPolicy.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallBitVector.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -84,4 +85,11 @@ bool AggressiveSpecPolicy::interSpecializeOn(
   return specialize;
 }
 
+bool AggressiveSpecPolicy::interCopyOn(
+    const Function &CalleeF /*unused*/, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface /*unused*/) {
+  return llvm::any_of(args,
+                      [](const InterfaceType &ty) { return !ty.isUnknown(); });
+}
+
 } // end namespace
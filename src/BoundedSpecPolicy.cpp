@@ -143,4 +143,23 @@ bool BoundedSpecPolicy::interSpecializeOn(
   return false;
 }
 
+bool BoundedSpecPolicy::interCopyOn(const Function &calleeF,
+                                    const std::vector<InterfaceType> &args,
+                                    const ComponentInterface &interface) {
+  if (calleeF.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+
+  if (m_subpolicy->interCopyOn(calleeF, args, interface)) {
+    unsigned num_copies = addCounter(calleeF);
+    bool res = (num_copies <= m_threshold);
+    if (!res) {
+      BSP_LOG(errs() << "[BoundedSpecPolicy] " << calleeF.getName()
+                     << " cannot be copied anymore\n";);
+    }
+    return res;
+  }
+  return false;
+}
+
 } // end namespace previrt
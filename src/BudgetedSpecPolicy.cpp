@@ -0,0 +1,382 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "BudgetedSpecPolicy.h"
+#include "CostBenefitSpecPolicy.h"
+#include "Specializer.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/GlobalAlias.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+
+using namespace llvm;
+
+#define BGSP_LOG(...) __VA_ARGS__
+//#define BGSP_LOG(...)
+
+namespace previrt {
+
+static StringRef OccamSpecStr = "__occam_spec.";
+
+namespace {
+// A specialized copy that the subpolicy agrees to build.
+struct Candidate {
+  // estimated benefit of the copy
+  unsigned benefit;
+  // number of instructions added by the copy
+  unsigned size;
+  // position of the candidate, used to break ties deterministically
+  unsigned seq;
+  // candidates with the same copy_id share the same copy
+  unsigned copy_id;
+  // the copy was built by a previous run (its size is already part
+  // of the growth)
+  bool built;
+};
+
+// Order candidates by benefit per added instruction. The priority
+// queue pops the greatest element so return true if a is worse than b.
+struct WorseCandidate {
+  bool operator()(const Candidate &a, const Candidate &b) const {
+    uint64_t lhs = (uint64_t)a.benefit * b.size;
+    uint64_t rhs = (uint64_t)b.benefit * a.size;
+    if (lhs != rhs) {
+      return lhs < rhs;
+    }
+    return a.seq > b.seq;
+  }
+};
+} // end namespace
+
+// Accept greedily the best candidates that fit in the budget. Return
+// the seq of the accepted candidates.
+static std::vector<unsigned> select(const std::vector<Candidate> &candidates,
+                                    uint64_t budget, uint64_t &growth) {
+  std::priority_queue<Candidate, std::vector<Candidate>, WorseCandidate> queue(
+      WorseCandidate(), candidates);
+  DenseSet<unsigned> built;
+  std::vector<unsigned> res;
+  while (!queue.empty()) {
+    Candidate c = queue.top();
+    queue.pop();
+    if (c.built || built.count(c.copy_id)) {
+      // the copy is already paid
+      res.push_back(c.seq);
+      continue;
+    }
+    if (growth + c.size > budget) {
+      // a smaller candidate might still fit
+      continue;
+    }
+    growth += c.size;
+    built.insert(c.copy_id);
+    res.push_back(c.seq);
+  }
+  return res;
+}
+
+BudgetedSpecPolicy::BudgetedSpecPolicy(
+    Module &M, std::unique_ptr<SpecializationPolicy> subpolicy,
+    unsigned max_growth)
+    : m_subpolicy(std::move(subpolicy)), m_module(M), m_budget(0),
+      m_growth(0), m_inter_ranked(false) {
+  // Copies built by previous runs of the specializer are part of the
+  // growth so the budget holds across runs.
+  uint64_t module_size = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    if (F.getName().startswith(OccamSpecStr)) {
+      m_growth += CostBenefitSpecPolicy::size(F);
+    } else {
+      module_size += CostBenefitSpecPolicy::size(F);
+    }
+  }
+  m_budget = (module_size * max_growth) / 100;
+  errs() << "## Running budgeted specialization policy: module has "
+         << module_size << " instructions, the budget is " << m_budget
+         << " new instructions and " << m_growth << " are already used.\n";
+
+  rankIntraCandidates();
+}
+
+void BudgetedSpecPolicy::rankIntraCandidates() {
+  std::vector<Candidate> candidates;
+  std::vector<std::pair<const Instruction *, std::vector<Value *>>> sites;
+  // callsites with the same callee and marks share the same copy
+  std::map<std::pair<const Function *, std::vector<Value *>>, unsigned>
+      copies;
+
+  for (auto &F : m_module) {
+    for (auto &I : instructions(F)) {
+      CallSite CS(&I);
+      if (!CS) {
+        continue;
+      }
+      Function *callee = CS.getCalledFunction();
+      // do not specialize copies made by a previous run: their size
+      // was already charged against the budget.
+      if (!callee || callee->isDeclaration() || callee->isVarArg() ||
+          !callee->hasLocalLinkage() ||
+          callee->getName().startswith(OccamSpecStr) ||
+          callee->hasFnAttribute(Attribute::OptimizeNone)) {
+        continue;
+      }
+      std::vector<Value *> marks;
+      if (!m_subpolicy->intraSpecializeOn(CS, marks)) {
+        continue;
+      }
+      SmallBitVector known(marks.size());
+      for (unsigned i = 0, e = marks.size(); i < e; ++i) {
+        if (marks[i]) {
+          known.set(i);
+        }
+      }
+      CostBenefitSpecPolicy::Estimate e =
+          CostBenefitSpecPolicy::estimate(*callee, known);
+      if (e.benefit() == 0) {
+        continue;
+      }
+      auto it = copies.insert({{callee, marks}, copies.size()}).first;
+      Candidate c;
+      c.benefit = e.benefit();
+      c.size = std::max(e.size, 1U);
+      c.seq = candidates.size();
+      c.copy_id = it->second;
+      c.built = findSpecialization(callee, marks) != nullptr;
+      candidates.push_back(c);
+      sites.push_back({&I, std::move(marks)});
+    }
+  }
+
+  std::vector<unsigned> selected = select(candidates, m_budget, m_growth);
+  for (unsigned seq : selected) {
+    m_intra_selected.insert({sites[seq].first, std::move(sites[seq].second)});
+  }
+  BGSP_LOG(errs() << "[BudgetedSpecPolicy] selected " << selected.size()
+                  << " out of " << candidates.size()
+                  << " intra-module callsites. Growth is " << m_growth
+                  << " instructions.\n";);
+}
+
+// Key of an inter-module copy: the callee and the marked arguments
+static BudgetedSpecPolicy::InterKey
+copyKey(const Function &F, const std::vector<InterfaceType> &args,
+        const SmallBitVector &marks) {
+  BudgetedSpecPolicy::InterKey key{&F, args};
+  for (unsigned i = 0, e = key.args.size(); i < e; ++i) {
+    if (i >= marks.size() || !marks.test(i)) {
+      key.args[i] = InterfaceType::unknown();
+    }
+  }
+  return key;
+}
+
+// Build in c the candidate for a call to F with args if the subpolicy
+// agrees and the copy has some benefit.
+static bool makeInterCandidate(SpecializationPolicy &subpolicy,
+                               BudgetedSpecPolicy::InterCopies &copies,
+                               const Function &F,
+                               const std::vector<InterfaceType> &args,
+                               const ComponentInterface &interface,
+                               SmallBitVector &marks, Candidate &c) {
+  if (F.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+  if (!subpolicy.interSpecializeOn(F, args, interface, marks)) {
+    return false;
+  }
+  CostBenefitSpecPolicy::Estimate e = CostBenefitSpecPolicy::estimate(F, marks);
+  if (e.benefit() == 0) {
+    return false;
+  }
+  BudgetedSpecPolicy::InterKey key = copyKey(F, args, marks);
+  c.benefit = e.benefit();
+  c.size = std::max(e.size, 1U);
+  c.copy_id = copies.insert({key, copies.size()}).first->second;
+  c.built = findSpecialization(const_cast<Function *>(&F), args, marks) !=
+            nullptr;
+  return true;
+}
+
+void BudgetedSpecPolicy::rankInterCandidates(
+    const ComponentInterface &interface) {
+  m_inter_ranked = true;
+  std::vector<Candidate> candidates;
+  std::vector<std::pair<InterKey, SmallBitVector>> calls;
+
+  for (auto fName : llvm::make_range(interface.begin(), interface.end())) {
+    Function *F = m_module.getFunction(fName);
+    if (!F) {
+      if (GlobalAlias *GA = m_module.getNamedAlias(fName)) {
+        F = dyn_cast<Function>(
+            const_cast<GlobalObject *>(GA->getBaseObject()));
+      }
+    }
+    if (!F || F->isDeclaration() || F->isVarArg()) {
+      continue;
+    }
+    for (const CallInfo *call : llvm::make_range(interface.call_begin(fName),
+                                                 interface.call_end(fName))) {
+      if (call->num_args() != F->arg_size()) {
+        continue;
+      }
+      InterKey key{F, call->get_args()};
+      if (m_inter_decisions.count(key)) {
+        // two calls with the same arguments
+        continue;
+      }
+      m_inter_decisions[key] = SmallBitVector();
+      SmallBitVector marks(call->num_args());
+      Candidate c;
+      if (!makeInterCandidate(*m_subpolicy, m_inter_copies, *F,
+                              call->get_args(), interface, marks, c)) {
+        continue;
+      }
+      c.seq = candidates.size();
+      candidates.push_back(c);
+      calls.push_back({key, marks});
+    }
+  }
+
+  std::vector<unsigned> selected = select(candidates, m_budget, m_growth);
+  for (unsigned seq : selected) {
+    m_inter_decisions[calls[seq].first] = calls[seq].second;
+    m_inter_paid.insert(candidates[seq].copy_id);
+  }
+  BGSP_LOG(errs() << "[BudgetedSpecPolicy] selected " << selected.size()
+                  << " out of " << candidates.size()
+                  << " inter-module calls. Growth is " << m_growth
+                  << " instructions.\n";);
+}
+
+bool BudgetedSpecPolicy::intraSpecializeOn(CallSite CS,
+                                           std::vector<Value *> &marks) {
+  auto it = m_intra_selected.find(CS.getInstruction());
+  if (it == m_intra_selected.end()) {
+    return false;
+  }
+  marks = it->second;
+  return true;
+}
+
+bool BudgetedSpecPolicy::interSpecializeOn(
+    const Function &calleeF, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface, SmallBitVector &marks) {
+  if (!m_inter_ranked) {
+    rankInterCandidates(interface);
+  }
+  InterKey key{&calleeF, args};
+  auto it = m_inter_decisions.find(key);
+  if (it == m_inter_decisions.end()) {
+    // The arguments are not those of a call in the interface (e.g.,
+    // one value of a set of integers): decide now with the budget
+    // left.
+    SmallBitVector newMarks(args.size());
+    Candidate c;
+    bool accepted = false;
+    if (makeInterCandidate(*m_subpolicy, m_inter_copies, calleeF, args,
+                           interface, newMarks, c)) {
+      if (c.built || m_inter_paid.count(c.copy_id)) {
+        accepted = true;
+      } else if (m_growth + c.size <= m_budget) {
+        m_growth += c.size;
+        accepted = true;
+      }
+    }
+    if (accepted) {
+      m_inter_paid.insert(c.copy_id);
+    } else {
+      newMarks.clear();
+    }
+    it = m_inter_decisions.insert({key, newMarks}).first;
+  }
+  if (it->second.none()) {
+    return false;
+  }
+  marks = it->second;
+  return true;
+}
+
+bool BudgetedSpecPolicy::interCopyOn(const Function &calleeF,
+                                     const std::vector<InterfaceType> &args,
+                                     const ComponentInterface &interface) {
+  if (calleeF.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+  if (!m_subpolicy->interCopyOn(calleeF, args, interface)) {
+    return false;
+  }
+  // Copies are not ranked with the calls in the interface: they get
+  // the budget left by the selected calls.
+  if (!m_inter_ranked) {
+    rankInterCandidates(interface);
+  }
+  SmallBitVector known(args.size());
+  for (unsigned i = 0, e = args.size(); i < e; ++i) {
+    if (!args[i].isUnknown()) {
+      known.set(i);
+    }
+  }
+  CostBenefitSpecPolicy::Estimate e =
+      CostBenefitSpecPolicy::estimate(calleeF, known);
+  if (e.benefit() == 0) {
+    return false;
+  }
+  InterKey key{&calleeF, args};
+  unsigned copy_id =
+      m_inter_copies.insert({key, m_inter_copies.size()}).first->second;
+  if (m_inter_paid.count(copy_id)) {
+    return true;
+  }
+  unsigned size = std::max(e.size, 1U);
+  if (m_growth + size > m_budget) {
+    BGSP_LOG(errs() << "[BudgetedSpecPolicy] " << calleeF.getName()
+                    << " cannot be copied: code growth budget exhausted\n";);
+    return false;
+  }
+  m_growth += size;
+  m_inter_paid.insert(copy_id);
+  return true;
+}
+
+} // end namespace previrt
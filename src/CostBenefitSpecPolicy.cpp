@@ -0,0 +1,280 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "CostBenefitSpecPolicy.h"
+#include "Specializer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define CBSP_LOG(...) __VA_ARGS__
+//#define CBSP_LOG(...)
+
+namespace previrt {
+
+static StringRef OccamSpecStr = "__occam_spec.";
+
+// A folded branch removes at least one successor block so it is
+// considered more valuable than a folded instruction.
+static const unsigned BranchWeight = 5;
+
+unsigned CostBenefitSpecPolicy::Estimate::benefit() const {
+  return folded_insts + BranchWeight * folded_branches;
+}
+
+static bool isFoldable(const Instruction &I) {
+  return isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<CastInst>(I) ||
+         isa<GetElementPtrInst>(I) || isa<SelectInst>(I) ||
+         isa<ExtractValueInst>(I) || isa<InsertValueInst>(I);
+}
+
+unsigned CostBenefitSpecPolicy::size(const Function &F) {
+  unsigned res = 0;
+  for (auto &I : instructions(F)) {
+    if (!isa<DbgInfoIntrinsic>(I)) {
+      res++;
+    }
+  }
+  return res;
+}
+
+CostBenefitSpecPolicy::Estimate
+CostBenefitSpecPolicy::estimate(const Function &F,
+                                const SmallBitVector &known) {
+  Estimate res;
+  // Values that will be constant in the specialized copy (excluding
+  // constants that are already in the original function)
+  SmallPtrSet<const Value *, 32> knownVals;
+  unsigned i = 0;
+  for (auto &A : F.args()) {
+    if (i < known.size() && known.test(i)) {
+      knownVals.insert(&A);
+    }
+    ++i;
+  }
+
+  auto isKnown = [&knownVals](const Value *V) {
+    return isa<Constant>(V) || knownVals.count(V) > 0;
+  };
+  auto isNewlyKnown = [&knownVals](const Value *V) {
+    return knownVals.count(V) > 0;
+  };
+
+  // Instructions are visited in layout order so a value defined in a
+  // later block (e.g., loop back-edges) is considered unknown. This is
+  // fine since we only want a cheap preview.
+  for (auto &I : instructions(F)) {
+    if (isa<DbgInfoIntrinsic>(I)) {
+      continue;
+    }
+    res.size++;
+    if (knownVals.empty()) {
+      continue;
+    }
+
+    if (const BranchInst *BI = dyn_cast<BranchInst>(&I)) {
+      if (BI->isConditional() && isNewlyKnown(BI->getCondition())) {
+        res.folded_branches++;
+      }
+      continue;
+    }
+    if (const SwitchInst *SI = dyn_cast<SwitchInst>(&I)) {
+      if (isNewlyKnown(SI->getCondition())) {
+        res.folded_branches++;
+      }
+      continue;
+    }
+    if (const SelectInst *SI = dyn_cast<SelectInst>(&I)) {
+      if (isNewlyKnown(SI->getCondition())) {
+        // the select goes away even if the operands are unknown
+        res.folded_insts++;
+        if (isKnown(SI->getTrueValue()) && isKnown(SI->getFalseValue())) {
+          knownVals.insert(&I);
+        }
+        continue;
+      }
+    }
+    if (!isFoldable(I)) {
+      continue;
+    }
+    if (llvm::all_of(I.operands(), isKnown) &&
+        llvm::any_of(I.operands(), isNewlyKnown)) {
+      knownVals.insert(&I);
+      res.folded_insts++;
+    }
+  }
+  return res;
+}
+
+CostBenefitSpecPolicy::CostBenefitSpecPolicy(
+    Module &M, std::unique_ptr<SpecializationPolicy> subpolicy,
+    unsigned min_benefit, unsigned max_growth)
+    : m_subpolicy(std::move(subpolicy)), m_min_benefit(min_benefit),
+      m_budget(0), m_growth(0) {
+  // Copies built by previous runs of the specializer are part of the
+  // growth so the budget holds across runs.
+  uint64_t module_size = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    if (F.getName().startswith(OccamSpecStr)) {
+      m_growth += size(F);
+    } else {
+      module_size += size(F);
+    }
+  }
+  m_budget = (module_size * max_growth) / 100;
+  errs() << "## Running cost-benefit specialization policy: module has "
+         << module_size << " instructions, the budget is " << m_budget
+         << " new instructions and " << m_growth << " are already used.\n";
+}
+
+bool CostBenefitSpecPolicy::payOff(const Function &F,
+                                   const SmallBitVector &known, bool isPaid) {
+  Estimate e = estimate(F, known);
+  if ((uint64_t)e.benefit() * 100 < (uint64_t)m_min_benefit * e.size) {
+    CBSP_LOG(errs() << "[CostBenefitSpecPolicy] " << F.getName()
+                    << " not worth to copy: size=" << e.size
+                    << " folded instructions=" << e.folded_insts
+                    << " folded branches=" << e.folded_branches << "\n";);
+    return false;
+  }
+  if (isPaid) {
+    CBSP_LOG(errs() << "[CostBenefitSpecPolicy] " << F.getName()
+                    << " will reuse an existing copy\n";);
+    return true;
+  }
+  if (m_growth + e.size > m_budget) {
+    CBSP_LOG(errs() << "[CostBenefitSpecPolicy] " << F.getName()
+                    << " cannot be copied: code growth budget exhausted\n";);
+    return false;
+  }
+  m_growth += e.size;
+  CBSP_LOG(errs() << "[CostBenefitSpecPolicy] " << F.getName()
+                  << " will be copied: size=" << e.size
+                  << " folded instructions=" << e.folded_insts
+                  << " folded branches=" << e.folded_branches << "\n";);
+  return true;
+}
+
+bool CostBenefitSpecPolicy::intraSpecializeOn(CallSite CS,
+                                              std::vector<Value *> &marks) {
+  Function *calleeF = CS.getCalledFunction();
+  if (!calleeF) {
+    return false;
+  }
+  if (calleeF->getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+
+  if (m_subpolicy->intraSpecializeOn(CS, marks)) {
+    SmallBitVector known(marks.size());
+    for (unsigned i = 0, e = marks.size(); i < e; ++i) {
+      if (marks[i]) {
+        known.set(i);
+      }
+    }
+    auto key = std::make_pair((const Function *)calleeF, marks);
+    bool isPaid =
+        m_intra_paid.count(key) > 0 || findSpecialization(calleeF, marks);
+    if (!payOff(*calleeF, known, isPaid)) {
+      return false;
+    }
+    m_intra_paid.insert(key);
+    return true;
+  }
+  return false;
+}
+
+bool CostBenefitSpecPolicy::interSpecializeOn(
+    const Function &calleeF, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface, SmallBitVector &marks) {
+  if (calleeF.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+
+  if (m_subpolicy->interSpecializeOn(calleeF, args, interface, marks)) {
+    InterKey key{&calleeF, args};
+    for (unsigned i = 0, e = key.args.size(); i < e; ++i) {
+      if (i >= marks.size() || !marks.test(i)) {
+        key.args[i] = InterfaceType::unknown();
+      }
+    }
+    bool isPaid = m_inter_paid.count(key) > 0 ||
+                  findSpecialization(const_cast<Function *>(&calleeF), args,
+                                     marks);
+    if (!payOff(calleeF, marks, isPaid)) {
+      return false;
+    }
+    m_inter_paid.insert(key);
+    return true;
+  }
+  return false;
+}
+
+bool CostBenefitSpecPolicy::interCopyOn(const Function &calleeF,
+                                        const std::vector<InterfaceType> &args,
+                                        const ComponentInterface &interface) {
+  if (calleeF.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+
+  if (m_subpolicy->interCopyOn(calleeF, args, interface)) {
+    // The estimate takes the arguments with facts as constants so it
+    // is optimistic but the copy is still charged to the budget.
+    SmallBitVector known(args.size());
+    for (unsigned i = 0, e = args.size(); i < e; ++i) {
+      if (!args[i].isUnknown()) {
+        known.set(i);
+      }
+    }
+    InterKey key{&calleeF, args};
+    if (!payOff(calleeF, known, m_inter_paid.count(key) > 0)) {
+      return false;
+    }
+    m_inter_paid.insert(key);
+    return true;
+  }
+  return false;
+}
+
+} // end namespace previrt
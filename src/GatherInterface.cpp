@@ -40,14 +40,19 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "GatherInterface.h"
 #include "Interfaces.h"
+#include "MappedInterface.h"
 
 #include "seadsa/InitializePasses.hh"
 #include "seadsa/CompleteCallGraph.hh"
 
 #include <fstream>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -60,10 +65,20 @@ static cl::opt<std::string> GatherInterfaceOutput(
     "Pinterface-output", cl::init(""), cl::Hidden,
     cl::desc("specifies the output file for the interface description"));
 
+static cl::opt<bool> GatherInterfaceOutputMapped(
+    "Pinterface-output-mapped", cl::init(false), cl::Hidden,
+    cl::desc("Write the interface in the mmap-able format instead of "
+             "protobuf"));
+
 static cl::list<std::string> GatherInterfaceEntry(
     "Pinterface-entry", cl::Hidden,
     cl::desc("specifies the interface that is used (only function names)"));
 
+static cl::opt<unsigned> GatherInterfaceThreads(
+    "Pinterface-threads", cl::init(1), cl::Hidden,
+    cl::desc("Number of threads used to abstract the external calls (0 "
+             "means one per hardware thread)"));
+
 // We should use always seadsa callgraph because it will be more
 // precise. However, it might be slower to compute so that's why by
 // default we use LLVM callgraph.
@@ -104,6 +119,206 @@ static Value *stripBitCast(Value *V) {
   }
 }
 
+// Number of external calls abstracted by a task. Chunks do not
+// depend on the number of threads so the merged interface does not
+// either.
+static const unsigned CallsPerChunk = 4096;
+
+// Add the external calls to interface. The calls are split in chunks
+// that are abstracted in parallel into their own interface. Then, the
+// chunks are joined in order so the calls to each function keep the
+// order of a serial traversal.
+static void addExternalCalls(
+    const std::vector<std::pair<const Function *, CallSite>> &calls,
+    ComponentInterface &interface, unsigned threads) {
+  auto addChunk = [&calls](unsigned begin, unsigned end,
+                           ComponentInterface &out) {
+    for (unsigned i = begin; i < end; ++i) {
+      CallSite CS = calls[i].second;
+      out.callTo(calls[i].first->getName(), CS.arg_begin(), CS.arg_end());
+    }
+  };
+
+  unsigned numChunks = (calls.size() + CallsPerChunk - 1) / CallsPerChunk;
+  if (threads == 1 || numChunks <= 1) {
+    addChunk(0, calls.size(), interface);
+    return;
+  }
+
+  std::vector<std::unique_ptr<ComponentInterface>> shards(numChunks);
+  {
+    std::unique_ptr<ThreadPool> pool(threads == 0 ? new ThreadPool()
+                                                  : new ThreadPool(threads));
+    for (unsigned i = 0; i < numChunks; ++i) {
+      shards[i].reset(new ComponentInterface());
+      unsigned begin = i * CallsPerChunk;
+      unsigned end = std::min<unsigned>(begin + CallsPerChunk, calls.size());
+      pool->async([&addChunk, &shards, begin, end, i]() {
+        addChunk(begin, end, *shards[i]);
+      });
+    }
+    pool->wait();
+  }
+  for (auto &shard : shards) {
+    interface.join(*shard);
+  }
+}
+
+void gatherInterface(Module &M, CallGraph &cg,
+                     const std::vector<Function *> *entries,
+                     ComponentInterface &interface, raw_ostream &log,
+                     unsigned threads) {
+  /*
+   * Compute an interface from M's call graph.
+   * 
+   * Keep in mind the following facts from a LLVM CallGraph:
+   *
+   * - Nodes in a CallGraph are functions plus two special nodes:
+   *   CallGraph::getCallsExternalNode() and
+   *   CallGraph::getExternalCallingNode. An edge from F1 to F2 if
+   *   there is a **direct** callsite in F1 that calls F2.
+   *
+   * - If function F is not internal and its address can be taken
+   *   then there is an edge from CallGraph::getExternalCallingNode
+   *   to F
+   * 
+   * - If function F has an indirect call or external call then
+   *   there is an edge from F to CallGraph::getCallsExternalNode()
+   */
+
+  // Add all nodes in llvm.compiler.used and llvm.used
+  // *** This is very important for correctly compiling libc
+  static const char *used_vars[2] = {"llvm.compiler.used", "llvm.used"};
+  for (int i = 0; i < 2; ++i) {
+    GlobalVariable *used = M.getGlobalVariable(used_vars[i], true);
+    if (used) {
+      Constant *value = used->getInitializer();
+      assert(value);
+
+      if (value->getType()->isVectorTy()) {
+        for (unsigned int i = 0; i < value->getNumOperands(); ++i) {
+          GlobalValue *gv = getGlobal(value->getAggregateElement(i));
+          if (!gv || gv->hasInternalLinkage())
+            continue;
+          interface.reference(gv->getName());
+          log << "adding reference to '" << gv->getName() << "'\n";
+        }
+        log << "vector!";
+      } else if (ConstantArray *ary = dyn_cast<ConstantArray>(value)) {
+        for (ConstantArray::op_iterator begin = ary->op_begin(),
+                                        end = ary->op_end();
+             begin != end; ++begin) {
+          if (GlobalValue *gv = getGlobal(begin->get())) {
+            interface.reference(gv->getName());
+          }
+        }
+      } else {
+        log << used_vars[i] << " = \n" << *value << "\n";
+      }
+    }
+  }
+
+  // Process the call graph. The traversal only collects the external
+  // calls; abstracting their arguments is the expensive part so it is
+  // done afterwards by addExternalCalls.
+  std::vector<CallGraphNode *> worklist;
+  std::vector<std::pair<const Function *, CallSite>> externalCalls;
+
+  // -- Initialize worklist with entry points of the current module
+  if (entries) {
+    for (Function *f : *entries) {
+      worklist.push_back(cg.getOrInsertFunction(f));
+    }
+  } else {
+    worklist.push_back(cg.getExternalCallingNode());
+  }
+
+  std::set<CallGraphNode*> visited; // break cycles
+  while (!worklist.empty()) {
+    CallGraphNode *cgn = worklist.back();
+    worklist.pop_back();
+
+    if (cgn->getFunction() && !isInternal(cgn->getFunction())) {
+      // this is a declaration and doesn't have any calls
+      continue;
+    }
+
+    // if (cgn == cg.getCallsExternalNode()) {
+    // 	// If we are here is because an external or indirect call
+    // 	// call. Add all the entries of the call graph
+    // 	// (CallGraph::getExternalCallingNode) in the worklist.
+	
+    //   cgn = cg.getExternalCallingNode();
+    //   if (visited.find(cgn) != visited.end()) {
+    //     continue;
+    //   }
+    // }
+
+    // -- Process edges in the callgraph.
+    // 
+    // A callRecord is a pair of a (callsite, CallGraphNode). The
+    // first element of the pair can be null when the source node is
+    // getExternalCallingNode()
+    for (auto &callRecord : *cgn) {
+      Value *calledV = stripBitCast(callRecord.first);
+      if (!calledV) {
+        assert(cgn == cg.getExternalCallingNode());
+        if (isInternal(callRecord.second->getFunction())) {
+          // Entry point of the module
+          interface.callFrom(callRecord.second->getFunction());
+        }
+      } else {
+        CallSite CS(calledV);
+        const Function *callee = callRecord.second->getFunction();
+        if (callee) {
+          // -- Direct call
+          if (!isInternal(callee)) {
+            log << "External call to "
+                << callRecord.second->getFunction()->getName() << "\n";
+            // Record a known external call
+            externalCalls.push_back({callee, CS});
+            continue;
+          }
+        } else {
+          // -- Indirect call: we don't know the callee
+        }
+      }
+
+      if (visited.insert(cgn).second) {
+        worklist.push_back(callRecord.second);
+      }
+    }
+  }
+
+  addExternalCalls(externalCalls, interface, threads);
+
+  // -- Record all external symbols of the current module
+    
+  // functions
+  for (Function &F : llvm::make_range(M.begin(), M.end())) {
+    if (F.isDeclaration() && !F.isIntrinsic()) {
+      log << "Added reference to function " << F.getName() << "\n";
+      interface.reference(F.getName());
+    }
+  }
+
+  // global variables
+  for (GlobalVariable &gv : M.globals()) {
+    if (gv.isDeclaration()) {
+      log << "Added reference to global " << gv.getName() << "\n";
+      interface.reference(gv.getName());
+    }
+  }
+
+  // aliases
+  for (GlobalAlias &alias : M.aliases()) {
+    if (alias.isDeclaration()) {
+      log << "Added reference to alias " << alias.getName() << "\n";
+      interface.reference(alias.getName());
+    }
+  }
+}
+
 class GatherInterfacePass : public ModulePass {
 public:
   ComponentInterface interface;
@@ -130,24 +345,6 @@ public:
   }
 
   virtual bool runOnModule(Module &M) {
-    /*
-     * Compute an interface from M's call graph.
-     * 
-     * Keep in mind the following facts from a LLVM CallGraph:
-     *
-     * - Nodes in a CallGraph are functions plus two special nodes:
-     *   CallGraph::getCallsExternalNode() and
-     *   CallGraph::getExternalCallingNode. An edge from F1 to F2 if
-     *   there is a **direct** callsite in F1 that calls F2.
-     *
-     * - If function F is not internal and its address can be taken
-     *   then there is an edge from CallGraph::getExternalCallingNode
-     *   to F
-     * 
-     * - If function F has an indirect call or external call then
-     *   there is an edge from F to CallGraph::getCallsExternalNode()
-     */
-    
     CallGraph *cg = nullptr;
     if (UseSeaDsa) {
       cg = &getAnalysis<seadsa::CompleteCallGraph>().getCompleteCallGraph();      
@@ -167,48 +364,24 @@ public:
     }
     cg->print(llvm::errs());
     #endif
-    
-    // Add all nodes in llvm.compiler.used and llvm.used
-    // *** This is very important for correctly compiling libc
-    static const char *used_vars[2] = {"llvm.compiler.used", "llvm.used"};
-    for (int i = 0; i < 2; ++i) {
-      GlobalVariable *used = M.getGlobalVariable(used_vars[i], true);
-      if (used) {
-        Constant *value = used->getInitializer();
-        assert(value);
-
-        if (value->getType()->isVectorTy()) {
-          for (unsigned int i = 0; i < value->getNumOperands(); ++i) {
-            GlobalValue *gv = getGlobal(value->getAggregateElement(i));
-            if (!gv || gv->hasInternalLinkage())
-              continue;
-            interface.reference(gv->getName());
-            errs() << "adding reference to '" << gv->getName() << "'\n";
-          }
-          errs() << "vector!";
-        } else if (ConstantArray *ary = dyn_cast<ConstantArray>(value)) {
-          for (ConstantArray::op_iterator begin = ary->op_begin(),
-                                          end = ary->op_end();
-               begin != end; ++begin) {
-            if (GlobalValue *gv = getGlobal(begin->get())) {
-              interface.reference(gv->getName());
-            }
-          }
-        } else {
-          errs() << used_vars[i] << " = \n" << *value << "\n";
-        }
-      }
-    }
 
-    // Process the call graph
-    std::vector<CallGraphNode *> worklist;
-
-    // -- Initialize worklist with entry points of the current module
     if (!GatherInterfaceEntry.empty()) {
+      // -- the entry points of the current module are given by the
+      // -- functions called in the interfaces
+      std::vector<Function *> entries;
       ComponentInterface ci;
       for (auto interfaceName: GatherInterfaceEntry) {
         errs() << "Reading interface from '" << interfaceName << "'...";
-        if (ci.readFromFile(interfaceName)) {
+        // only function names are needed so a mapped interface is
+        // queried in place.
+        if (auto mapped = MappedInterface::open(interfaceName)) {
+          errs() << "success\n";
+          for (unsigned i = 0, e = mapped->getNumFunctions(); i < e; ++i) {
+            if (Function *f = M.getFunction(mapped->getFunction(i))) {
+              entries.push_back(f);
+            }
+          }
+        } else if (ci.readFromFile(interfaceName)) {
           errs() << "success\n";
         } else {
           errs() << "failed\n";
@@ -216,100 +389,29 @@ public:
       }
       for (auto FH: llvm::make_range(ci.begin(), ci.end())) {
         if (Function *f = M.getFunction(FH)) {
-          worklist.push_back(cg->getOrInsertFunction(f));
+          entries.push_back(f);
         }
       }
+      gatherInterface(M, *cg, &entries, interface, errs(),
+                      GatherInterfaceThreads);
     } else {
-      worklist.push_back(cg->getExternalCallingNode());
-    }
-
-    std::set<CallGraphNode*> visited; // break cycles
-    while (!worklist.empty()) {
-      CallGraphNode *cgn = worklist.back();
-      worklist.pop_back();
-
-      if (cgn->getFunction() && !isInternal(cgn->getFunction())) {
-        // this is a declaration and doesn't have any calls
-        continue;
-      }
-
-      // if (cgn == cg->getCallsExternalNode()) {
-      // 	// If we are here is because an external or indirect call
-      // 	// call. Add all the entries of the call graph
-      // 	// (CallGraph::getExternalCallingNode) in the worklist.
-	
-      //   cgn = cg->getExternalCallingNode();
-      //   if (visited.find(cgn) != visited.end()) {
-      //     continue;
-      //   }
-      // }
-
-      // -- Process edges in the callgraph.
-      // 
-      // A callRecord is a pair of a (callsite, CallGraphNode). The
-      // first element of the pair can be null when the source node is
-      // getExternalCallingNode()
-      for (auto &callRecord : *cgn) {
-        Value *calledV = stripBitCast(callRecord.first);
-        if (!calledV) {
-          assert(cgn == cg->getExternalCallingNode());
-	  if (isInternal(callRecord.second->getFunction())) {
-	    // Entry point of the module
-	    interface.callFrom(callRecord.second->getFunction());
-	  }
-        } else {
-          CallSite CS(calledV);
-          const Function *callee = callRecord.second->getFunction();
-	  if (callee) {
-	    // -- Direct call
-	    if (!isInternal(callee)) {
-	      errs() << "External call to "
-		     << callRecord.second->getFunction()->getName() << "\n";
-	      // Record a known external call
-	      interface.callTo(callee->getName(), CS.arg_begin(), CS.arg_end());
-	      continue;
-	    }
-	  } else {
-	    // -- Indirect call: we don't know the callee
-	  }
-        }
-
-        if (visited.insert(cgn).second) {
-          worklist.push_back(callRecord.second);
-        }
-      }
-    }
-
-    // -- Record all external symbols of the current module
-    
-    // functions
-    for (Function &F : llvm::make_range(M.begin(), M.end())) {
-      if (F.isDeclaration() && !F.isIntrinsic()) {
-        errs() << "Added reference to function " << F.getName() << "\n";
-        interface.reference(F.getName());
-      }
-    }
-
-    // global variables
-    for (GlobalVariable &gv : M.globals()) {
-      if (gv.isDeclaration()) {
-        errs() << "Added reference to global " << gv.getName() << "\n";
-        interface.reference(gv.getName());
-      }
-    }
-
-    // aliases
-    for (GlobalAlias &alias : M.aliases()) {
-      if (alias.isDeclaration()) {
-        errs() << "Added reference to alias " << alias.getName() << "\n";
-        interface.reference(alias.getName());
-      }
+      gatherInterface(M, *cg, nullptr, interface, errs(),
+                      GatherInterfaceThreads);
     }
 
     errs() << "Generated interface for " << M.getModuleIdentifier() << "\n";
     errs() << interface << "\n";
     
-    if (GatherInterfaceOutput != "") {
+    if (GatherInterfaceOutput != "" && GatherInterfaceOutputMapped) {
+      std::error_code EC;
+      raw_fd_ostream output(GatherInterfaceOutput, EC, sys::fs::OF_None);
+      if (EC) {
+        errs() << "[GatherInterface] failed to write out interface: "
+               << EC.message() << "\n";
+      } else {
+        MappedInterface::write(interface, nullptr, output);
+      }
+    } else if (GatherInterfaceOutput != "") {
       proto::ComponentInterface ci;
       codeInto<ComponentInterface, proto::ComponentInterface>(interface, ci);
       std::ofstream output(GatherInterfaceOutput.c_str(), std::ios::binary);
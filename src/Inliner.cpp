@@ -42,7 +42,10 @@
  *
  * 1) created by devirtualization, or
  *
- * 2) created by specialization.
+ * 2) created by specialization, or
+ *
+ * 3) marked with the InlineHintAttr attribute (e.g., hot specialized
+ *    functions).
  **/
 
 #include "llvm/ADT/SmallPtrSet.h"
@@ -66,6 +69,12 @@ static cl::opt<bool>
                                cl::Hidden,
                                cl::desc("Inline specialized functions"));
 
+static cl::opt<bool>
+    InlineHintedFunctions("Pinline-hinted-functions", cl::init(false),
+                          cl::Hidden,
+                          cl::desc("Inline functions marked as hot by the "
+                                   "specialization policy"));
+
 static const StringRef bounce_prefix = "__occam.bounce";
 static const StringRef spec_prefix = "__occam_spec.";
 
@@ -77,7 +86,8 @@ public:
   InlinerPass() : ModulePass(ID) {}
 
   virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
-    if (!InlineBounceFunctions && !InlineSpecializedFunctions) {
+    if (!InlineBounceFunctions && !InlineSpecializedFunctions &&
+        !InlineHintedFunctions) {
       AU.setPreservesAll();
     } else {
       // TODO: update the call graph so the pass manager does not
@@ -90,7 +100,8 @@ public:
   }
 
   virtual bool runOnModule(llvm::Module &M) override {
-    if (!InlineBounceFunctions && !InlineSpecializedFunctions) {
+    if (!InlineBounceFunctions && !InlineSpecializedFunctions &&
+        !InlineHintedFunctions) {
       /// HACK: do not remove this line. The python code searches for it ...            
       errs() << "...no progress...\n";
       return false;
@@ -103,6 +114,9 @@ public:
           } else if (InlineSpecializedFunctions &&
                      F.getName().startswith(spec_prefix)) {
             ToInline.insert(&F);
+          } else if (InlineHintedFunctions &&
+                     F.hasFnAttribute(utils::InlineHintAttr)) {
+            ToInline.insert(&F);
           }
         }
       }
@@ -32,7 +32,9 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/User.h"
@@ -82,35 +84,46 @@ static Instruction *applyRewriteToCall(Module &M, const CallRewrite *const rw,
 
 // Specialize M's callsites if the callee is external according to T
 bool TransformComponent(Module &M, ComponentInterfaceTransform &T) {
-  bool modified = false;
-
+  // -- functions of M with some rewrite
+  DenseMap<const Function *, FunctionHandle> targets;
   for (FunctionHandle FH : T.functions()) {
-    errs() << "Looking for calls to " << FH << "\n";
-    Function *f = M.getFunction(FH);
-    if (!f)
-      continue;
-
-    // Go over all uses of the function
-    for (Function::use_iterator ui = f->use_begin(), ue = f->use_end();
-         ui != ue; ++ui) {
-      Use *use = &(*ui);
-      User *user = ui->getUser();
-
-      if (isa<CallInst>(user) || isa<InvokeInst>(user)) {
-
-        // The instruction is a call site
-        CallSite cs(cast<Instruction>(user));
+    if (Function *f = M.getFunction(FH)) {
+      errs() << "Looking for calls to " << FH << "\n";
+      targets[f] = FH;
+    }
+  }
+  if (targets.empty()) {
+    return false;
+  }
 
-        // If we are not the callee we should bail
-        if (!cs.isCallee(use)) {
-          continue;
-        }
+  // -- collect all the callsites to rewrite in a single traversal of
+  // -- the module. They are rewritten afterwards since rewriting
+  // -- modifies the instruction lists and the use lists.
+  std::vector<std::pair<Instruction *, const CallRewrite *>> worklist;
+  for (Function &F : M) {
+    for (Instruction &I : instructions(F)) {
+      if (!isa<CallInst>(I) && !isa<InvokeInst>(I)) {
+        continue;
+      }
+      CallSite cs(&I);
+      Function *callee = cs.getCalledFunction();
+      if (!callee) {
+        continue;
+      }
+      auto it = targets.find(callee);
+      if (it == targets.end()) {
+        continue;
+      }
+      if (const CallRewrite *rw =
+              T.lookupRewrite(it->second, cs.arg_begin(), cs.arg_end())) {
+        worklist.push_back({&I, rw});
+      }
+    }
+  }
 
-        const CallRewrite *const rw =
-            T.lookupRewrite(FH, cs.arg_begin(), cs.arg_end());
-        if (!rw) {
-          continue;
-        }
+  for (auto &kv : worklist) {
+    CallSite cs(kv.first);
+    const CallRewrite *const rw = kv.second;
 
 #if 0
 	  BasicBlock* owner = cs.getInstruction()->getParent();
@@ -130,34 +143,30 @@ bool TransformComponent(Module &M, ComponentInterfaceTransform &T) {
 	  errs() << "]\n";
 #endif
 
-        if (cs.getCalledFunction() &&
-            cs.getCalledFunction()->hasExternalLinkage()) {
-          for (unsigned int i = 0; i < cs.arg_size(); ++i) {
-            if (std::find(rw->get_args().begin(), rw->get_args().end(), i) ==
-                rw->get_args().end()) {
-              if (Function *funptr = dyn_cast<Function>(cs.getArgument(i))) {
-                // XXX: we are specializing a callsite that has an
-                // argument with the address of a function
-                // foo. After the specialization, foo may be dead in
-                // the current module but it might be called in
-                // another module.  This code ensures that foo will
-                // not be remove from the current module, otherwise
-                // the linker will complain.
-                funptr->setLinkage(GlobalValue::ExternalLinkage);
-                llvm::errs() << "Marking " << funptr->getName()
-                             << "  as external.\n";
-              }
-            }
+    if (cs.getCalledFunction()->hasExternalLinkage()) {
+      for (unsigned int i = 0; i < cs.arg_size(); ++i) {
+        if (std::find(rw->get_args().begin(), rw->get_args().end(), i) ==
+            rw->get_args().end()) {
+          if (Function *funptr = dyn_cast<Function>(cs.getArgument(i))) {
+            // XXX: we are specializing a callsite that has an
+            // argument with the address of a function
+            // foo. After the specialization, foo may be dead in
+            // the current module but it might be called in
+            // another module.  This code ensures that foo will
+            // not be remove from the current module, otherwise
+            // the linker will complain.
+            funptr->setLinkage(GlobalValue::ExternalLinkage);
+            llvm::errs() << "Marking " << funptr->getName()
+                         << "  as external.\n";
           }
         }
-
-        Instruction *newInst = applyRewriteToCall(M, rw, cs);
-        llvm::ReplaceInstWithInst(cs.getInstruction(), newInst);
-        modified = true;
       }
     }
+
+    Instruction *newInst = applyRewriteToCall(M, rw, cs);
+    llvm::ReplaceInstWithInst(cs.getInstruction(), newInst);
   }
-  return modified;
+  return !worklist.empty();
 }
 
 class InterRewriterPass : public ModulePass {
@@ -41,24 +41,36 @@
 #include "llvm/ADT/SmallBitVector.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "Interfaces.h"
+#include "MappedInterface.h"
 #include "SpecializationPolicy.h"
+#include "SpecializationTable.h"
 #include "Specializer.h"
 /* here specialization policies */
 #include "AggressiveSpecPolicy.h"
 #include "BoundedSpecPolicy.h"
+#include "BudgetedSpecPolicy.h"
+#include "CostBenefitSpecPolicy.h"
 #include "OnlyOnceSpecPolicy.h"
+#include "ProfileGuidedSpecPolicy.h"
 #include "RecursiveGuardSpecPolicy.h"
+#include "utils/Inliner.h"
 
 #include "llvm/Support/raw_ostream.h"
 #include <fstream>
+#include <numeric>
 #include <string>
 #include <vector>
 
@@ -78,7 +90,17 @@ static cl::opt<previrt::SpecializationPolicyType> SpecPolicy(
                    "Ppeval-max-spec-copies"),
         clEnumValN(previrt::SpecializationPolicyType::NONREC,
                    "nonrec-aggressive", "Specialize always if some constant "
-                                        "arg and function is non-recursive")),
+                                        "arg and function is non-recursive"),
+        clEnumValN(previrt::SpecializationPolicyType::COST_BENEFIT,
+                   "cost-benefit", "Specialize if some constant arg and the "
+                                   "estimated benefit pays off the size of "
+                                   "the copy"),
+        clEnumValN(previrt::SpecializationPolicyType::PROFILE, "profile",
+                   "Specialize if some constant arg and the function is hot "
+                   "according to -Pspecialize-profile"),
+        clEnumValN(previrt::SpecializationPolicyType::BUDGETED, "budgeted",
+                   "Specialize the calls with the best estimated benefit per "
+                   "added instruction within -Pspecialize-max-growth")),
     cl::init(previrt::SpecializationPolicyType::NONREC));
 
 static cl::opt<unsigned>
@@ -86,6 +108,44 @@ static cl::opt<unsigned>
                   cl::desc("Maximum number of copies for a function if "
                            "-Pspecialize-policy=bounded"));
 
+static cl::opt<unsigned>
+    MinSpecBenefit("Pspecialize-min-benefit", cl::init(10),
+                   cl::desc("Minimum percentage of the callee that must be "
+                            "folded to copy it if "
+                            "-Pspecialize-policy=cost-benefit"));
+
+static cl::opt<unsigned>
+    MaxSpecGrowth("Pspecialize-max-growth", cl::init(100),
+                  cl::desc("Maximum code growth (in percentage of the module "
+                           "size) if -Pspecialize-policy=cost-benefit or "
+                           "budgeted"));
+
+static cl::opt<std::string>
+    SpecProfile("Pspecialize-profile", cl::init(""),
+                cl::desc("Callsite-count profile if "
+                         "-Pspecialize-policy=profile"));
+
+static cl::opt<unsigned long long>
+    HotCount("Pspecialize-hot-count", cl::init(0),
+             cl::desc("Minimum count for a function to be hot if "
+                      "-Pspecialize-policy=profile (0: 1% of the hottest "
+                      "count)"));
+
+static cl::opt<bool> SpecCompOutMapped(
+    "Pspecialize-output-mapped", cl::init(false), cl::Hidden,
+    cl::desc("Write the rewrite file in the mmap-able format instead of "
+             "protobuf"));
+
+static cl::opt<bool> SpecIntSets(
+    "Pspecialize-int-sets", cl::init(true),
+    cl::desc("Specialize calls whose integer argument is one of a few "
+             "constants by dispatching to a specialized copy per constant"));
+
+static cl::opt<bool> SpecIntRanges(
+    "Pspecialize-int-ranges", cl::init(false),
+    cl::desc("Copy the callee of calls whose integer argument is in a known "
+             "range and assume the range in the copy"));
+
 static cl::list<std::string>
     SpecCompIn("Pspecialize-input", cl::NotHidden,
                cl::desc("Specify the interface to specialize with respect to"));
@@ -110,6 +170,226 @@ static Function *resolveFunction(Module &M, StringRef name) {
   return nullptr;
 }
 
+// Return the position of the first argument of call that is an
+// IntSet (IntRange if range is true) or -1 if none.
+static int findIntArg(const CallInfo &call, bool range) {
+  for (unsigned i = 0, e = call.num_args(); i < e; ++i) {
+    const InterfaceType &ty = call.get_args()[i];
+    if (range ? ty.isIntRange() : ty.isIntSet()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Concretize the arguments of a call selected by marks. argPerm
+// contains the positions of the rest of arguments.
+static void concretizeArgs(Module &M, Function &func,
+                           const std::vector<InterfaceType> &callArgs,
+                           const SmallBitVector &marks,
+                           std::vector<Value *> &args,
+                           std::vector<unsigned> &argPerm) {
+  const unsigned arg_count = callArgs.size();
+  args.reserve(arg_count);
+  argPerm.reserve(arg_count - marks.count());
+  for (unsigned i = 0; i < arg_count; i++) {
+    if (marks.test(i)) {
+      Type *paramType = func.getFunctionType()->getParamType(i);
+      Value *concreteArg = callArgs[i].concretize(M, paramType);
+      args.push_back(concreteArg);
+      assert(concreteArg->getType() == paramType &&
+             "Specializing function with concrete argument of wrong type!");
+    } else {
+      args.push_back(nullptr);
+      argPerm.push_back(i);
+    }
+  }
+}
+
+// Name of a copy of f that keeps all the parameters. It must not end
+// with ")" otherwise specializeName would parse it as a specialized
+// function.
+static std::string copyName(Function &f, StringRef kind,
+                            const std::vector<InterfaceType> &args) {
+  std::string name = "__occam_spec." + f.getName().str() + "." + kind.str() +
+                     "<";
+  for (unsigned i = 0, e = args.size(); i < e; ++i) {
+    if (i > 0) {
+      name += ",";
+    }
+    name += args[i].to_string();
+  }
+  return name + ">";
+}
+
+namespace {
+struct DispatchCase {
+  ConstantInt *value;
+  Function *callee;
+  std::vector<unsigned> argPerm;
+};
+} // end namespace
+
+// Build a function with the same type as f that calls cases[i].callee
+// if its k-th argument is cases[i].value and f otherwise.
+static Function *buildDispatcher(Function &f, unsigned k,
+                                 const std::vector<DispatchCase> &cases,
+                                 const std::string &name) {
+  Module &M = *f.getParent();
+  if (Function *d = M.getFunction(name)) {
+    // already built by a previous run
+    return d;
+  }
+  LLVMContext &ctx = M.getContext();
+  Function *d = Function::Create(f.getFunctionType(),
+                                 GlobalValue::ExternalLinkage, name, &M);
+  d->setCallingConv(f.getCallingConv());
+  // Same parameter and return attributes as f (e.g., signext) but not
+  // its function attributes since d is a different function.
+  AttributeList fAttrs = f.getAttributes();
+  std::vector<AttributeSet> paramAttrs;
+  for (unsigned i = 0, e = f.arg_size(); i < e; ++i) {
+    paramAttrs.push_back(fAttrs.getParamAttributes(i));
+  }
+  d->setAttributes(AttributeList::get(ctx, AttributeSet(),
+                                      fAttrs.getRetAttributes(), paramAttrs));
+  d->addFnAttr(Attribute::InlineHint);
+  std::vector<Value *> params;
+  for (Argument &a : d->args()) {
+    params.push_back(&a);
+  }
+
+  auto emitCall = [&f](BasicBlock *bb, Function *callee,
+                       ArrayRef<Value *> args) {
+    IRBuilder<> builder(bb);
+    CallInst *ci = builder.CreateCall(callee, args);
+    ci->setCallingConv(callee->getCallingConv());
+    ci->setAttributes(callee->getAttributes());
+    ci->setTailCall();
+    if (f.getReturnType()->isVoidTy()) {
+      builder.CreateRetVoid();
+    } else {
+      builder.CreateRet(ci);
+    }
+  };
+
+  BasicBlock *entry = BasicBlock::Create(ctx, "entry", d);
+  BasicBlock *dflt = BasicBlock::Create(ctx, "default", d);
+  emitCall(dflt, &f, params);
+  SwitchInst *sw = SwitchInst::Create(params[k], dflt, cases.size(), entry);
+  for (const DispatchCase &c : cases) {
+    BasicBlock *bb = BasicBlock::Create(ctx, "case", d);
+    std::vector<Value *> args;
+    for (unsigned i : c.argPerm) {
+      args.push_back(params[i]);
+    }
+    emitCall(bb, c.callee, args);
+    sw->addCase(c.value, bb);
+  }
+  return d;
+}
+
+// Copy f and assume at its entry that the k-th argument is in range.
+// The copy keeps the attributes of f and of its parameters.
+static Function *buildRangeCopy(Function &f, unsigned k,
+                                const ConstantRange &range,
+                                const std::string &name) {
+  Module &M = *f.getParent();
+  ValueToValueMapTy vmap;
+  Function *copy = CloneFunction(&f, vmap);
+  copy->setName(name);
+  copy->setLinkage(GlobalValue::ExternalLinkage);
+
+  IRBuilder<> builder(&*copy->getEntryBlock().getFirstInsertionPt());
+  // lower <= x < upper (modulo wrapping) iff x - lower <u upper - lower
+  Value *x = copy->getArg(k);
+  Value *offset = builder.CreateSub(x, builder.getInt(range.getLower()));
+  Value *inRange = builder.CreateICmpULT(
+      offset, builder.getInt(range.getUpper() - range.getLower()));
+  Function *assume = Intrinsic::getDeclaration(&M, Intrinsic::assume);
+  builder.CreateCall(assume, inRange);
+  return copy;
+}
+
+/*
+ * The k-th argument of call is one of a few integers. For each
+ * integer ask the policy whether the call would be specialized if
+ * the argument was that integer and then rewrite the call to a
+ * dispatcher that switches over the integers.
+ */
+static bool specializeOnIntSet(Module &M, ComponentInterfaceTransform &T,
+                               SpecializationPolicy &policy,
+                               SpecializationTable &table,
+                               std::vector<Function *> &to_add,
+                               StringRef fName, Function &func,
+                               const CallInfo &call, unsigned k) {
+  const ComponentInterface &I = T.getInterface();
+  std::vector<DispatchCase> cases;
+  for (const APInt &v : call.get_args()[k].getIntSet()) {
+    ConstantInt *value = ConstantInt::get(M.getContext(), v);
+    std::vector<InterfaceType> callArgs(call.get_args());
+    callArgs[k] = InterfaceType::abstract(value);
+
+    SmallBitVector marks(callArgs.size());
+    if (!policy.interSpecializeOn(func, callArgs, I, marks)) {
+      continue;
+    }
+    std::vector<Value *> args;
+    std::vector<unsigned> argPerm;
+    concretizeArgs(M, func, callArgs, marks, args, argPerm);
+    bool isNew = false;
+    Function *specialized_func =
+        getOrCreateSpecialization(table, &func, args, isNew);
+    if (!specialized_func) {
+      continue;
+    }
+    if (isNew) {
+      to_add.push_back(specialized_func);
+    }
+    cases.push_back({value, specialized_func, argPerm});
+  }
+
+  if (cases.empty()) {
+    return false;
+  }
+
+  Function *dispatcher =
+      buildDispatcher(func, k, cases, copyName(func, "dispatch", call.get_args()));
+  std::vector<unsigned> argPerm(call.num_args());
+  std::iota(argPerm.begin(), argPerm.end(), 0);
+  T.rewrite(fName, &call, dispatcher->getName(), argPerm);
+  errs() << "Specialized  " << fName << " to " << dispatcher->getName()
+         << " with " << cases.size() << " cases\n";
+  return true;
+}
+
+/*
+ * The k-th argument of call is in a range of integers. Rewrite the
+ * call to a copy of func that knows the range if the policy agrees.
+ */
+static bool specializeOnIntRange(ComponentInterfaceTransform &T,
+                                 SpecializationPolicy &policy,
+                                 StringRef fName, Function &func,
+                                 const CallInfo &call, unsigned k) {
+  const InterfaceType &ty = call.get_args()[k];
+  std::vector<InterfaceType> key(call.num_args());
+  key[k] = ty;
+  std::string name = copyName(func, "range", key);
+  Function *copy = func.getParent()->getFunction(name);
+  if (!copy) {
+    // a copy built by a previous run was already accepted
+    if (!policy.interCopyOn(func, key, T.getInterface())) {
+      return false;
+    }
+    copy = buildRangeCopy(func, k, ty.getIntRange(), name);
+  }
+  std::vector<unsigned> argPerm(call.num_args());
+  std::iota(argPerm.begin(), argPerm.end(), 0);
+  T.rewrite(fName, &call, copy->getName(), argPerm);
+  errs() << "Specialized  " << fName << " to " << copy->getName() << "\n";
+  return true;
+}
+
 /*
  * Reduce this module with respect to the given interface.
  * - The interface suggests some of the uses of the functions,
@@ -119,6 +399,7 @@ static Function *resolveFunction(Module &M, StringRef name) {
  */
 static bool SpecializeComponent(Module &M, ComponentInterfaceTransform &T,
                                 SpecializationPolicy &policy,
+                                SpecializationTable &table,
                                 std::vector<Function *> &to_add) {
   errs() << "SpecializeComponent()\n";
 
@@ -153,6 +434,15 @@ static bool SpecializeComponent(Module &M, ComponentInterfaceTransform &T,
         continue;
       }
 
+      // -- the argument is one of a few integers
+      int k = findIntArg(*call, false);
+      if (SpecIntSets && k >= 0 &&
+          specializeOnIntSet(M, T, policy, table, to_add, fName, *func, *call,
+                             k)) {
+        rewrite_count++;
+        continue;
+      }
+
       /*
         should we specialize? if yes then each bit in marks will
         indicate whether the argument is a specializable constant
@@ -161,25 +451,19 @@ static bool SpecializeComponent(Module &M, ComponentInterfaceTransform &T,
       bool shouldSpecialize =
 	policy.interSpecializeOn(*func, call->get_args(), I, marks);
 
-      if (!shouldSpecialize)
+      if (!shouldSpecialize) {
+        // -- the argument is in a range of integers
+        k = findIntArg(*call, true);
+        if (SpecIntRanges && k >= 0 &&
+            specializeOnIntRange(T, policy, fName, *func, *call, k)) {
+          rewrite_count++;
+        }
         continue;
+      }
 
       std::vector<Value *> args;
       std::vector<unsigned> argPerm;
-      args.reserve(arg_count);
-      argPerm.reserve(marks.count());
-      for (unsigned i = 0; i < arg_count; i++) {
-        if (marks.test(i)) {
-          Type *paramType = func->getFunctionType()->getParamType(i);
-          Value *concreteArg = call->get_args()[i].concretize(M, paramType);
-          args.push_back(concreteArg);
-          assert(concreteArg->getType() == paramType &&
-                 "Specializing function with concrete argument of wrong type!");
-        } else {
-          args.push_back(nullptr);
-          argPerm.push_back(i);
-        }
-      }
+      concretizeArgs(M, *func, call->get_args(), marks, args, argPerm);
 
       /*
         args is a list of pointers to values
@@ -192,14 +476,21 @@ static bool SpecializeComponent(Module &M, ComponentInterfaceTransform &T,
         args[i] = nullptr iff i is in argsPerm for i < arg_count.
       */
 
-      Function *specialized_func = specializeFunction(func, args);
+      bool isNew = false;
+      Function *specialized_func =
+          getOrCreateSpecialization(table, func, args, isNew);
       if (!specialized_func) {
         continue;
       }
       specialized_func->setLinkage(GlobalValue::ExternalLinkage);
       FunctionHandle rewriteTo = specialized_func->getName();
       T.rewrite(fName, call, rewriteTo, argPerm);
-      to_add.push_back(specialized_func);
+      if (isNew) {
+        to_add.push_back(specialized_func);
+      }
+      if (policy.isHotCall(*func, call->get_args())) {
+        specialized_func->addFnAttr(utils::InlineHintAttr);
+      }
       errs() << "Specialized  " << fName << " to " << rewriteTo << "\n";
 
 #if 0
@@ -282,6 +573,27 @@ public:
       policy.reset(new RecursiveGuardSpecPolicy(std::move(subpolicy), cg));
       break;
     }
+    case SpecializationPolicyType::COST_BENEFIT: {
+      std::unique_ptr<SpecializationPolicy> subpolicy =
+          std::make_unique<AggressiveSpecPolicy>();
+      policy.reset(new CostBenefitSpecPolicy(M, std::move(subpolicy),
+                                             MinSpecBenefit, MaxSpecGrowth));
+      break;
+    }
+    case SpecializationPolicyType::PROFILE: {
+      std::unique_ptr<SpecializationPolicy> subpolicy =
+          std::make_unique<AggressiveSpecPolicy>();
+      policy.reset(new ProfileGuidedSpecPolicy(M, std::move(subpolicy),
+                                               SpecProfile, HotCount));
+      break;
+    }
+    case SpecializationPolicyType::BUDGETED: {
+      std::unique_ptr<SpecializationPolicy> subpolicy =
+          std::make_unique<AggressiveSpecPolicy>();
+      policy.reset(
+          new BudgetedSpecPolicy(M, std::move(subpolicy), MaxSpecGrowth));
+      break;
+    }
     default:;
       ;
     }
@@ -291,7 +603,8 @@ public:
     }
 
     std::vector<Function *> to_add;
-    bool modified = SpecializeComponent(M, transform, *policy, to_add);
+    SpecializationTable table(&M);
+    bool modified = SpecializeComponent(M, transform, *policy, table, to_add);
 
     /*
        adding the "new" specialized definitions (in to_add) to M;
@@ -314,7 +627,17 @@ public:
 
     /* writing the output ("rw" rewrite file) to the -Pspecialize-output
      * argument */
-    if (SpecCompOut != "") {
+    if (SpecCompOut != "" && SpecCompOutMapped) {
+      std::error_code EC;
+      raw_fd_ostream output(SpecCompOut, EC, sys::fs::OF_None);
+      if (EC) {
+        errs() << "Failed to write out rewrite file: " << EC.message()
+               << "\n";
+      } else {
+        MappedInterface::write(this->transform.getInterface(),
+                               &this->transform, output);
+      }
+    } else if (SpecCompOut != "") {
       proto::ComponentInterfaceTransform buf;
       codeInto(this->transform, buf);
       std::ofstream output(SpecCompOut.c_str(),
@@ -40,9 +40,13 @@
  */
 
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/ConstantRange.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
@@ -52,72 +56,263 @@
 #include "llvm/IR/Module.h"
 
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "InterfaceTypes.h"
 #include "Specializer.h"
 #include "proto/Previrt.pb.h"
 
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+
 using namespace llvm;
 
+static cl::opt<unsigned> MaxIntSetSize(
+    "Pinterface-max-int-set", cl::init(4), cl::Hidden,
+    cl::desc("Maximum number of values of a non-constant integer argument "
+             "recorded in the interface (0 disables integer sets)"));
+
+// Off by default as -Pspecialize-int-ranges: the ranges are only used
+// by the specializer if the latter is set.
+static cl::opt<bool> AbstractIntRanges(
+    "Pinterface-int-ranges", cl::init(false), cl::Hidden,
+    cl::desc("Record the range of non-constant integer arguments in the "
+             "interface"));
+
 namespace previrt {
 InterfaceType::EqCache InterfaceType::cacheEq;
 
-InterfaceType::InterfaceType() { buffer.set_type(proto::U); }
+using TypeKind = InterfaceType::Kind;
+
+struct InterfaceType::Data {
+  TypeKind kind;
+  // I: bit width, F: proto::FloatSemantics
+  unsigned bits;
+  // S: cstr, G: is_const
+  bool flag;
+  // I: hex value, F: hex value, S: bytes, G: name
+  std::string value;
+  // precomputed by intern
+  size_t hash;
+
+  Data(TypeKind k, unsigned b = 0, bool f = false, StringRef v = "")
+      : kind(k), bits(b), flag(f), value(v.str()), hash(0) {}
+
+  size_t computeHash() const {
+    return hash_combine((uint8_t)kind, bits, flag, value);
+  }
+
+  bool operator==(const Data &o) const {
+    return kind == o.kind && bits == o.bits && flag == o.flag &&
+           value == o.value;
+  }
+
+  struct Hash {
+    size_t operator()(const Data &d) const { return d.hash; }
+  };
+};
+
+const InterfaceType::Data *InterfaceType::intern(const Data &d) {
+  // Elements of an unordered_set are never moved so pointers to them
+  // are stable. The table is shared by all the modules gathered
+  // concurrently by -Ppropagate-interfaces.
+  static std::unordered_set<Data, Data::Hash> table;
+  static std::mutex lock;
+  Data key(d);
+  key.hash = key.computeHash();
+  std::lock_guard<std::mutex> guard(lock);
+  return &*table.insert(std::move(key)).first;
+}
+
+InterfaceType::InterfaceType() {
+  static const Data *U = intern(Data(TypeKind::U));
+  m_data = U;
+}
+
+hash_code hash_value(const InterfaceType &ty) { return ty.m_data->hash; }
+
+InterfaceType InterfaceType::get(Kind kind, unsigned bits, bool flag,
+                                 StringRef value) {
+  return InterfaceType(intern(Data(kind, bits, flag, value)));
+}
+
+InterfaceType::Kind InterfaceType::getKind() const { return m_data->kind; }
+
+unsigned InterfaceType::getBits() const { return m_data->bits; }
+
+bool InterfaceType::getFlag() const { return m_data->flag; }
+
+const std::string &InterfaceType::getValue() const { return m_data->value; }
+
+bool InterfaceType::isIntSet() const { return m_data->kind == TypeKind::IS; }
+
+bool InterfaceType::isIntRange() const { return m_data->kind == TypeKind::IR; }
+
+std::vector<APInt> InterfaceType::getIntSet() const {
+  assert(isIntSet());
+  SmallVector<StringRef, 8> values;
+  StringRef(m_data->value).split(values, ',');
+  std::vector<APInt> result;
+  result.reserve(values.size());
+  for (StringRef v : values) {
+    result.push_back(APInt(m_data->bits, v, 16));
+  }
+  return result;
+}
+
+ConstantRange InterfaceType::getIntRange() const {
+  assert(isIntRange());
+  std::pair<StringRef, StringRef> bounds = StringRef(m_data->value).split(',');
+  return ConstantRange(APInt(m_data->bits, bounds.first, 16),
+                       APInt(m_data->bits, bounds.second, 16));
+}
 
-InterfaceType::InterfaceType(const proto::PrevirtType &pt) {
-  buffer.CopyFrom(pt);
+InterfaceType InterfaceType::intSet(ArrayRef<APInt> values) {
+  assert(!values.empty());
+  std::vector<APInt> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const APInt &a, const APInt &b) { return a.ult(b); });
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  std::string encoded;
+  for (const APInt &v : sorted) {
+    if (!encoded.empty()) {
+      encoded += ",";
+    }
+    encoded += v.toString(16, true);
+  }
+  return InterfaceType(
+      intern(Data(TypeKind::IS, sorted[0].getBitWidth(), false, encoded)));
 }
 
-InterfaceType &InterfaceType::operator=(const InterfaceType &from) {
-  this->buffer.CopyFrom(from.buffer);
-  return *this;
+InterfaceType InterfaceType::intConstant(const APInt &value) {
+  return InterfaceType(intern(Data(TypeKind::I, value.getBitWidth(), false,
+                                   value.toString(16, true))));
 }
 
-bool InterfaceType::operator!=(const InterfaceType &other) const {
-  return !(*this == other);
+InterfaceType InterfaceType::intRange(const ConstantRange &range) {
+  std::string encoded = range.getLower().toString(16, true) + "," +
+                        range.getUpper().toString(16, true);
+  return InterfaceType(
+      intern(Data(TypeKind::IR, range.getBitWidth(), false, encoded)));
 }
 
-bool InterfaceType::operator==(const InterfaceType &other) const {
-  if (buffer.type() != other.buffer.type())
+// Return true if a <= b where b is an IntSet or an IntRange.
+static bool isIncludedInInts(const InterfaceType &a, const InterfaceType &b) {
+  if (a == b) {
+    return true;
+  }
+  if (a.getBits() != b.getBits()) {
     return false;
-  switch (buffer.type()) {
+  }
+  switch (a.getKind()) {
+  case TypeKind::I: {
+    APInt v(a.getBits(), a.getValue(), 16);
+    if (b.isIntSet()) {
+      return is_contained(b.getIntSet(), v);
+    }
+    return b.getIntRange().contains(v);
+  }
+  case TypeKind::IS: {
+    std::vector<APInt> values = a.getIntSet();
+    if (b.isIntSet()) {
+      std::vector<APInt> others = b.getIntSet();
+      return llvm::all_of(
+          values, [&others](const APInt &v) { return is_contained(others, v); });
+    }
+    ConstantRange range = b.getIntRange();
+    return llvm::all_of(
+        values, [&range](const APInt &v) { return range.contains(v); });
+  }
+  case TypeKind::IR:
+    return b.isIntRange() && b.getIntRange().contains(a.getIntRange());
   default:
-    assert(false && "missing case in InterfaceType::operator==");
-  case proto::U:
-  case proto::N:
-    return true;
-  case proto::S:
-    return buffer.str().data() == other.buffer.str().data();
-  case proto::I:
-  case proto::F:
-    return buffer.int_().bits() == other.buffer.int_().bits() &&
-           buffer.int_().value() == other.buffer.int_().value();
-  case proto::G:
-    return buffer.global().name() == other.buffer.global().name();
+    return false;
   }
-  return false;
 }
 
 static bool StringFromValue(const Value *val, StringRef &out) {
   return getConstantStringInfo(val, out, 0, false);
 }
 
-InterfaceType InterfaceType::unknown() {
-  InterfaceType t;
-  t.buffer.set_type(proto::U);
-  return t;
+InterfaceType InterfaceType::unknown() { return InterfaceType(); }
+
+// Add to values the integer constants that v can take if v is a
+// (possibly nested) phi node or select of integer constants.
+static bool collectIntConstants(const Value *v,
+                                SmallPtrSetImpl<const Value *> &visited,
+                                SmallVectorImpl<APInt> &values) {
+  // enough to compute the range of a large set
+  const unsigned MaxCollected = 64;
+  if (!visited.insert(v).second) {
+    return true;
+  }
+  if (const ConstantInt *ci = dyn_cast<ConstantInt>(v)) {
+    if (!is_contained(values, ci->getValue())) {
+      values.push_back(ci->getValue());
+    }
+    return values.size() <= MaxCollected;
+  } else if (const PHINode *phi = dyn_cast<PHINode>(v)) {
+    for (const Value *in : phi->incoming_values()) {
+      if (!collectIntConstants(in, visited, values)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (const SelectInst *sel = dyn_cast<SelectInst>(v)) {
+    return collectIntConstants(sel->getTrueValue(), visited, values) &&
+           collectIntConstants(sel->getFalseValue(), visited, values);
+  }
+  return false;
+}
+
+// Abstract a non-constant integer to a set of constants or a range
+static InterfaceType abstractNonConstant(const Value *val) {
+  if (!val->getType()->isIntegerTy()) {
+    return InterfaceType::unknown();
+  }
+  unsigned bits = val->getType()->getIntegerBitWidth();
+
+  SmallPtrSet<const Value *, 8> visited;
+  SmallVector<APInt, 8> values;
+  if (MaxIntSetSize > 0 && collectIntConstants(val, visited, values) &&
+      !values.empty()) {
+    if (values.size() == 1) {
+      return InterfaceType::intConstant(values[0]);
+    } else if (values.size() <= MaxIntSetSize) {
+      return InterfaceType::intSet(values);
+    } else if (AbstractIntRanges) {
+      ConstantRange range = ConstantRange::getEmpty(bits);
+      for (const APInt &v : values) {
+        range = range.unionWith(ConstantRange(v));
+      }
+      if (!range.isFullSet()) {
+        return InterfaceType::intRange(range);
+      }
+    }
+    return InterfaceType::unknown();
+  }
+
+  if (AbstractIntRanges) {
+    ConstantRange range = computeConstantRange(val);
+    if (const APInt *v = range.getSingleElement()) {
+      return InterfaceType::intConstant(*v);
+    } else if (!range.isFullSet() && !range.isEmptySet()) {
+      return InterfaceType::intRange(range);
+    }
+  }
+  return InterfaceType::unknown();
 }
 
 InterfaceType InterfaceType::abstract(const llvm::Value *const val) {
   InterfaceType result;
-  result.buffer.set_type(proto::U);
   const Constant *cnst = dyn_cast<const Constant>(val);
   if (cnst == NULL) {
 #if DUMP
     errs() << "??\n";
 #endif
-    return result;
+    return abstractNonConstant(val);
   }
 #if DUMP
 
@@ -183,57 +378,50 @@ InterfaceType InterfaceType::abstract(const llvm::Value *const val) {
   errs() << "\n";
 #endif
   if (const ConstantInt *ci = dyn_cast<const ConstantInt>(val)) {
-    result.buffer.set_type(proto::I);
-    result.buffer.mutable_int_()->set_bits(ci->getBitWidth());
-    result.buffer.mutable_int_()->set_value(ci->getValue().toString(16, true));
-    return result;
+    return intConstant(ci->getValue());
   } else if (cnst->isNullValue()) {
-    result.buffer.set_type(proto::N);
-    return result;
+    return InterfaceType(intern(Data(TypeKind::N)));
   } else if (const ConstantFP *cf = dyn_cast<const ConstantFP>(val)) {
     char dst[128];
     const APFloat &val = cf->getValueAPF();
     val.convertToHexString(dst, 0, false, APFloat::rmNearestTiesToEven);
+    proto::FloatSemantics sem;
     if (&val.getSemantics() == &APFloat::Bogus()) {
-      result.buffer.mutable_float_()->set_sem(proto::Bogus);
+      sem = proto::Bogus;
     } else if (&val.getSemantics() == &APFloat::IEEEhalf()) {
-      result.buffer.mutable_float_()->set_sem(proto::IEEEhalf);
+      sem = proto::IEEEhalf;
     } else if (&val.getSemantics() == &APFloat::IEEEdouble()) {
-      result.buffer.mutable_float_()->set_sem(proto::IEEEdouble);
+      sem = proto::IEEEdouble;
     } else if (&val.getSemantics() == &APFloat::IEEEquad()) {
-      result.buffer.mutable_float_()->set_sem(proto::IEEEquad);
+      sem = proto::IEEEquad;
     } else if (&val.getSemantics() == &APFloat::IEEEsingle()) {
-      result.buffer.mutable_float_()->set_sem(proto::IEEEsingle);
+      sem = proto::IEEEsingle;
     } else if (&val.getSemantics() == &APFloat::PPCDoubleDouble()) {
-      result.buffer.mutable_float_()->set_sem(proto::PPCDoubleDouble);
+      sem = proto::PPCDoubleDouble;
     } else if (&val.getSemantics() == &APFloat::x87DoubleExtended()) {
-      result.buffer.mutable_float_()->set_sem(proto::x87DoubleExtended);
+      sem = proto::x87DoubleExtended;
     } else {
       return result;
     }
-    result.buffer.mutable_float_()->set_data(dst);
-    result.buffer.set_type(proto::F);
-    return result;
+    return InterfaceType(intern(Data(TypeKind::F, sem, false, dst)));
   } else if (const GlobalValue *gv = dyn_cast<const GlobalValue>(cnst)) {
     // gv can be alias, function or variable
     // XXX: pass LLVM -strip pass will get rid of all internal names.
 
     // function
     if (isa<Function>(gv) && gv->getName() != "") {
-      result.buffer.set_type(proto::G);
-      result.buffer.mutable_global()->set_name(gv->getName().data());
-      return result;
+      return InterfaceType(intern(Data(TypeKind::G, 0, false, gv->getName())));
     }
 
     // global alias or variable
     if (gv->getName() != "") {
       if (gv->isExternalLinkage(gv->getLinkage())) {
-        result.buffer.set_type(proto::G);
-        result.buffer.mutable_global()->set_name(gv->getName().data());
+        bool is_const = false;
         if (const GlobalVariable *gvar = dyn_cast<GlobalVariable>(gv)) {
-          result.buffer.mutable_global()->set_is_const(gvar->isConstant());
+          is_const = gvar->isConstant();
         }
-        return result;
+        return InterfaceType(
+            intern(Data(TypeKind::G, 0, is_const, gv->getName())));
       } else {
         return result;
       }
@@ -242,57 +430,70 @@ InterfaceType InterfaceType::abstract(const llvm::Value *const val) {
     StringRef out;
     // See if it's a string constant
     if (StringFromValue(val, out)) {
-      result.buffer.set_type(proto::S);
-      result.buffer.mutable_str()->set_data(out);
-      return result;
+      return InterfaceType(intern(Data(TypeKind::S, 0, true, out)));
     }
   }
   return result;
 }
 
 TypeRefinementKind InterfaceType::refines(const llvm::Value *const val) const {
+  if (isIntSet() || isIntRange()) {
+    return refines(val, abstract(val));
+  }
+  return refines(val, unknown());
+}
+
+TypeRefinementKind InterfaceType::refines(const llvm::Value *const val,
+                                          const InterfaceType &abs) const {
   assert(val != NULL);
+  if (isIntSet() || isIntRange()) {
+    if (isIncludedInInts(abs, *this)) {
+      return TypeRefinementKind::LOOSE_MATCH;
+    } else {
+      return TypeRefinementKind::NO_MATCH;
+    }
+  }
   const Constant *cnst = dyn_cast<const Constant>(val);
   // TODO: Why did I start needing this?
   if (cnst == NULL) {
-    if (this->buffer.type() == proto::U)
+    if (m_data->kind == TypeKind::U)
       return TypeRefinementKind::LOOSE_MATCH;
     else
       return TypeRefinementKind::NO_MATCH;
   }
-  switch (buffer.type()) {
+  switch (m_data->kind) {
   default:
     assert(false);
     break;
-  case proto::U:
+  case TypeKind::U:
     return TypeRefinementKind::LOOSE_MATCH;
-  case proto::N: {
+  case TypeKind::N: {
     if (cnst->isNullValue())
       return TypeRefinementKind::EXACT_MATCH;
     else
       return TypeRefinementKind::NO_MATCH;
   }
-  case proto::S: {
+  case TypeKind::S: {
     StringRef out;
     if (StringFromValue(val, out)) {
-      if (out == buffer.str().data())
+      if (out == m_data->value)
         return TypeRefinementKind::EXACT_MATCH;
       else
         return TypeRefinementKind::NO_MATCH;
     }
     return TypeRefinementKind::NO_MATCH;
   }
-  case proto::I:
+  case TypeKind::I:
     if (const ConstantInt *va = dyn_cast<const ConstantInt>(val)) {
-      if (buffer.int_().bits() == va->getBitWidth() &&
-          buffer.int_().value() == va->getValue().toString(16, true))
+      if (m_data->bits == va->getBitWidth() &&
+          m_data->value == va->getValue().toString(16, true))
         return TypeRefinementKind::EXACT_MATCH;
     }
     return TypeRefinementKind::NO_MATCH;
-  case proto::F:
+  case TypeKind::F:
     if (const ConstantFP *va = dyn_cast<const ConstantFP>(val)) {
       const fltSemantics *sem = NULL;
-      switch (buffer.float_().sem()) {
+      switch ((proto::FloatSemantics)m_data->bits) {
 #define CASE(x)                                                                \
   case proto::x: {                                                             \
     if (&va->getValueAPF().getSemantics() != &APFloat::x())                    \
@@ -309,16 +510,16 @@ TypeRefinementKind InterfaceType::refines(const llvm::Value *const val) const {
         CASE(Bogus)
 #undef CASE
       }
-      APFloat apf(*sem, buffer.float_().data());
+      APFloat apf(*sem, m_data->value);
       if (apf.bitwiseIsEqual(va->getValueAPF())) {
         return TypeRefinementKind::EXACT_MATCH;
       }
     }
     return TypeRefinementKind::NO_MATCH;
-  case proto::G:
+  case TypeKind::G:
     if (const GlobalValue *gv =
             dyn_cast<const GlobalValue>(val->stripPointerCasts())) {
-      if (gv->getName() == buffer.global().name()) {
+      if (gv->getName() == m_data->value) {
         return TypeRefinementKind::EXACT_MATCH;
       }
     }
@@ -330,33 +531,30 @@ TypeRefinementKind InterfaceType::refines(const llvm::Value *const val) const {
 
 llvm::Value *InterfaceType::concretize(Module &M, Type *type) const {
   llvm::Value *concreteValue = NULL;
-  switch (buffer.type()) {
+  const std::string &value = m_data->value;
+  switch (m_data->kind) {
   default:
     break;
-  case proto::N:
+  case TypeKind::N:
     concreteValue = Constant::getNullValue(type);
     break;
-  case proto::I:
-    assert(buffer.int_().IsInitialized());
-    concreteValue = ConstantInt::get(
-        M.getContext(), APInt(buffer.int_().bits(), buffer.int_().value(), 16));
+  case TypeKind::I:
+    concreteValue = ConstantInt::get(M.getContext(),
+                                     APInt(m_data->bits, value, 16));
     break;
-  case proto::F:
-    concreteValue = ConstantFP::get(type, StringRef(buffer.float_().data()));
+  case TypeKind::F:
+    concreteValue = ConstantFP::get(type, StringRef(value));
     break;
-  case proto::S:
-    assert(buffer.str().IsInitialized());
-    if (!buffer.str().cstr())
+  case TypeKind::S:
+    if (!m_data->flag /*cstr*/)
       break;
     { // Scope sc locally
-      GlobalVariable *sc =
-          materializeStringLiteral(M, buffer.str().data().c_str());
+      GlobalVariable *sc = materializeStringLiteral(M, value.c_str());
       concreteValue = charStarFromStringConstant(M, sc);
     }
     break;
-  case proto::G:
-    assert(buffer.global().IsInitialized());
-    concreteValue = M.getGlobalVariable(buffer.global().name(), false);
+  case TypeKind::G:
+    concreteValue = M.getGlobalVariable(value, false);
     if (concreteValue == NULL) {
       // GlobalValues are always pointers and the resulting type
       // will be a pointer to the type in the constructor, so we
@@ -369,16 +567,16 @@ llvm::Value *InterfaceType::concretize(Module &M, Type *type) const {
              "Unexpected concretization of G to non-pointer type");
       Type *elemType = type->getContainedType(0);
       if (elemType->isFunctionTy()) {
-        concreteValue = M.getFunction(buffer.global().name());
+        concreteValue = M.getFunction(value);
         if (concreteValue == NULL) {
           concreteValue = Function::Create(cast<FunctionType>(elemType),
                                            GlobalVariable::ExternalLinkage,
-                                           buffer.global().name(), &M);
+                                           value, &M);
         }
       } else {
         concreteValue = new GlobalVariable(
-            M, elemType, buffer.global().is_const(),
-            GlobalVariable::ExternalLinkage, NULL, buffer.global().name());
+            M, elemType, m_data->flag /*is_const*/,
+            GlobalVariable::ExternalLinkage, NULL, value);
       }
     }
     break;
@@ -391,14 +589,14 @@ llvm::Value *InterfaceType::concretize(Module &M, Type *type) const {
 bool InterfaceType::isConcrete() const {
   // TODO: check which of these work
 
-  return buffer.type() == proto::I || // Integer
-         buffer.type() == proto::G || // Global
-         buffer.type() == proto::N || // Null
-         buffer.type() == proto::S || // String
-         buffer.type() == proto::F;   // float
+  return m_data->kind == TypeKind::I || // Integer
+         m_data->kind == TypeKind::G || // Global
+         m_data->kind == TypeKind::N || // Null
+         m_data->kind == TypeKind::S || // String
+         m_data->kind == TypeKind::F;   // float
 }
 
-bool InterfaceType::isUnknown() const { return buffer.type() == proto::U; }
+bool InterfaceType::isUnknown() const { return m_data->kind == TypeKind::U; }
 
 /// HashString - Hash function for strings.
 ///
@@ -414,25 +612,37 @@ static inline unsigned HashString(StringRef Str, unsigned Result = 0) {
 }
 
 std::string InterfaceType::to_string() const {
-  switch (buffer.type()) {
+  switch (m_data->kind) {
   default:
     return "?";
-  case proto::N:
+  case TypeKind::N:
     return "null";
-  case proto::I:
-    assert(buffer.int_().IsInitialized());
-    return std::string("0x") + buffer.int_().value();
-  case proto::F:
-    return buffer.float_().data();
-  case proto::S: {
-    assert(buffer.str().IsInitialized());
-    if (!buffer.str().cstr())
+  case TypeKind::I:
+    return std::string("0x") + m_data->value;
+  case TypeKind::F:
+    return m_data->value;
+  case TypeKind::S: {
+    if (!m_data->flag /*cstr*/)
       return NULL;
-    return std::string("S:") + utohexstr(HashString(buffer.str().data()));
+    return std::string("S:") + utohexstr(HashString(m_data->value));
+  }
+  case TypeKind::G:
+    return m_data->value;
+  case TypeKind::IS: {
+    std::string result = "{";
+    for (const APInt &v : getIntSet()) {
+      if (result.size() > 1) {
+        result += "|";
+      }
+      result += std::string("0x") + v.toString(16, true);
+    }
+    return result + "}";
+  }
+  case TypeKind::IR: {
+    ConstantRange range = getIntRange();
+    return std::string("[0x") + range.getLower().toString(16, true) + "..0x" +
+           range.getUpper().toString(16, true) + ")";
   }
-  case proto::G:
-    assert(buffer.global().IsInitialized());
-    return buffer.global().name();
   }
 
   return "?";
@@ -520,15 +730,14 @@ static Function *buildStringEquality(PointerType *typ, Module &M) {
 }
 
 Function *InterfaceType::getEqualityFunction(Module *M) const {
-  switch (buffer.type()) {
+  switch (m_data->kind) {
   default:
     return NULL;
-  case proto::N: {
+  case TypeKind::N: {
     return NULL;
   }
-  case proto::I: {
-    assert(buffer.int_().IsInitialized());
-    IntegerType *typ = Type::getIntNTy(M->getContext(), buffer.int_().bits());
+  case TypeKind::I: {
+    IntegerType *typ = Type::getIntNTy(M->getContext(), m_data->bits);
     EqCache::iterator i = InterfaceType::cacheEq.find(typ);
     if (i != InterfaceType::cacheEq.end()) {
       return i->second;
@@ -539,8 +748,7 @@ Function *InterfaceType::getEqualityFunction(Module *M) const {
     M->getFunctionList().push_back(f);
     return f;
   }
-  case proto::S: {
-    assert(buffer.str().IsInitialized());
+  case TypeKind::S: {
     PointerType *typ = Type::getInt8PtrTy(M->getContext());
     EqCache::iterator i = InterfaceType::cacheEq.find(typ);
     if (i != InterfaceType::cacheEq.end()) {
@@ -561,13 +769,106 @@ template <>
 void codeInto<previrt::proto::PrevirtType, InterfaceType>(
     const previrt::proto::PrevirtType &buf, InterfaceType &result) {
   assert(buf.IsInitialized());
-  result.buffer.CopyFrom(buf);
+  switch (buf.type()) {
+  default:
+    // proto::V is not supported
+    result = InterfaceType::unknown();
+    break;
+  case proto::U:
+    result = InterfaceType::unknown();
+    break;
+  case proto::N:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(TypeKind::N));
+    break;
+  case proto::I:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(
+        TypeKind::I, buf.int_().bits(), false, buf.int_().value()));
+    break;
+  case proto::F:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(
+        TypeKind::F, buf.float_().sem(), false, buf.float_().data()));
+    break;
+  case proto::S:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(
+        TypeKind::S, 0, buf.str().cstr(), buf.str().data()));
+    break;
+  case proto::G:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(
+        TypeKind::G, 0, buf.global().is_const(), buf.global().name()));
+    break;
+  case proto::IS: {
+    std::string values;
+    for (int i = 0; i < buf.intset().values_size(); ++i) {
+      if (i > 0) {
+        values += ",";
+      }
+      values += buf.intset().values(i);
+    }
+    result.m_data = InterfaceType::intern(
+        InterfaceType::Data(TypeKind::IS, buf.intset().bits(), false, values));
+    break;
+  }
+  case proto::IR:
+    result.m_data = InterfaceType::intern(InterfaceType::Data(
+        TypeKind::IR, buf.intrange().bits(), false,
+        buf.intrange().lower() + "," + buf.intrange().upper()));
+    break;
+  }
 }
 
 template <>
 void codeInto<InterfaceType, proto::PrevirtType>(const InterfaceType &typ,
                                                  proto::PrevirtType &buf) {
-  assert(typ.buffer.IsInitialized());
-  buf.CopyFrom(typ.buffer);
+  const InterfaceType::Data &d = *typ.m_data;
+  switch (d.kind) {
+  case TypeKind::U:
+    buf.set_type(proto::U);
+    break;
+  case TypeKind::N:
+    buf.set_type(proto::N);
+    break;
+  case TypeKind::I:
+    buf.set_type(proto::I);
+    buf.mutable_int_()->set_bits(d.bits);
+    buf.mutable_int_()->set_value(d.value);
+    break;
+  case TypeKind::F:
+    buf.set_type(proto::F);
+    buf.mutable_float_()->set_sem((proto::FloatSemantics)d.bits);
+    buf.mutable_float_()->set_data(d.value);
+    break;
+  case TypeKind::S:
+    buf.set_type(proto::S);
+    buf.mutable_str()->set_data(d.value);
+    buf.mutable_str()->set_cstr(d.flag);
+    break;
+  case TypeKind::G:
+    buf.set_type(proto::G);
+    buf.mutable_global()->set_name(d.value);
+    buf.mutable_global()->set_is_const(d.flag);
+    break;
+  case TypeKind::IS: {
+    buf.set_type(proto::IS);
+    buf.mutable_intset()->set_bits(d.bits);
+    SmallVector<StringRef, 8> values;
+    StringRef(d.value).split(values, ',');
+    for (StringRef v : values) {
+      buf.mutable_intset()->add_values(v.str());
+    }
+    break;
+  }
+  case TypeKind::IR: {
+    buf.set_type(proto::IR);
+    std::pair<StringRef, StringRef> bounds = StringRef(d.value).split(',');
+    buf.mutable_intrange()->set_bits(d.bits);
+    buf.mutable_intrange()->set_lower(bounds.first.str());
+    buf.mutable_intrange()->set_upper(bounds.second.str());
+    break;
+  }
+  }
+}
+
+InterfaceType::InterfaceType(const proto::PrevirtType &pt) : InterfaceType() {
+  codeInto<proto::PrevirtType, InterfaceType>(pt, *this);
 }
 }
@@ -41,7 +41,9 @@
 #include "llvm/ADT/StringMap.h"
 
 #include "Interfaces.h"
+#include "MappedInterface.h"
 
+#include <algorithm>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -61,15 +63,17 @@ namespace previrt {
    arguments are equal in terms of types.
  */  
   int CallInfo::refines(llvm::User::op_iterator begin,
-			llvm::User::op_iterator end) {
+			llvm::User::op_iterator end,
+			const std::vector<InterfaceType> &abs) const {
   std::vector<InterfaceType>::const_iterator from = this->args.begin(),
                                              to = this->args.end();
   if (std::distance(begin, end) != std::distance(from, to)) {
     return -1;
   }
+  assert(abs.size() == this->args.size());
   int loose_matched = 0;
-  for (; begin != end; ++begin, ++from) {
-    TypeRefinementKind r = from->refines(begin->get());
+  for (auto ab = abs.begin(); begin != end; ++begin, ++from, ++ab) {
+    TypeRefinementKind r = from->refines(begin->get(), *ab);
     if (r == TypeRefinementKind::NO_MATCH) {
       return -1;
     } else if (r == TypeRefinementKind::LOOSE_MATCH) {
@@ -93,6 +97,7 @@ void codeInto<CallInfo, proto::CallInfo>(const CallInfo &ci,
 template <>
 void codeInto<proto::CallInfo, CallInfo>(const proto::CallInfo &buf,
                                          CallInfo &ci) {
+  ci.count = buf.count();
   ci.args.clear();
   ci.args.reserve(buf.args_size());
   for (unsigned i = 0, sz= buf.args_size(); i<sz; i++) {
@@ -138,88 +143,48 @@ ComponentInterface::~ComponentInterface() {
   }
 }
 
+static size_t hashArgs(const std::vector<InterfaceType> &args) {
+  return hash_combine_range(args.begin(), args.end());
+}
+
+CallInfo *ComponentInterface::findCall(StringRef f,
+                                       const std::vector<InterfaceType> &args,
+                                       size_t hash) const {
+  auto it = m_calls_index.find(f);
+  if (it == m_calls_index.end()) {
+    return nullptr;
+  }
+  auto range = it->second.equal_range(hash);
+  for (auto &kv : llvm::make_range(range.first, range.second)) {
+    if (kv.second->get_args() == args) {
+      return kv.second;
+    }
+  }
+  return nullptr;
+}
+
+void ComponentInterface::addCall(StringRef f, CallInfo *CI, size_t hash) {
+  m_calls[f].push_back(CI);
+  m_calls_index[f].insert({hash, CI});
+}
+
 // Add a call f(abstract(args_begin), ..., abstract(args_end)) in the
-// interface if there is no already an entry that it's not equal to.
+// interface if there is no already an entry with exactly the same
+// types. Otherwise, increment the counter of that entry.
 void ComponentInterface::callTo(FunctionHandle f, User::op_iterator args_begin,
 				User::op_iterator args_end) {
   //
   // Each argument in CI.args.begin() ... CI.args.end() contains a
   // type (see InterfaceTypes.h comments for more details)
   //
-
-
-  
-  // Return true if types of arguments of f(args_begin,...,args_end)
-  // are consistent with types of argument of CI **and** there exists
-  // one f's argument "x" for which "x" has a more precise type than
-  // its corresponding argument in CI.
-  // auto refines = [&args_begin, &args_end](CallInfo &CI) {
-  //   if (std::distance(args_begin, args_end) != CI.num_args()) {
-  //     // This is possible for variadic functions
-  //     return false;
-  //   }
-  //   auto cur = args_begin;
-  //   bool is_refined = false;
-  //   for (auto ty: llvm::make_range(CI.args_begin(), CI.args_end())) {
-  //     // ask if type of f's argument  refines type of entry's argument
-  //     TypeRefinementKind res = ty.refines(cur->get());
-  //     if (res == TypeRefinementKind::NO_MATCH) {
-  // 	// inconsistent types
-  // 	return false;
-  //     } else if (res == TypeRefinementKind::LOOSE_MATCH) {
-  // 	// found f's argument which a more precise type than CI's argument
-  // 	is_refined = true;
-  //     } else {
-  // 	// same type: do nothing
-  //     }
-  //     ++cur;
-  //   }
-  //   return is_refined;
-  // };
-
-
-  // Return true if types of arguments of f(args_begin,...,args_end)
-  // are exactly the same than the types of argument of CI.
-  auto is_equal = [](User::op_iterator fargs_begin,
-		     User::op_iterator fargs_end,
-		     CallInfo &CI) {
-    if (std::distance(fargs_begin, fargs_end) != CI.num_args()) {
-      return false;
-    }
-    auto cur = fargs_begin;
-    for (auto ty: llvm::make_range(CI.args_begin(), CI.args_end())) {
-      // ask if type of f's argument  refines type of entry's argument
-      TypeRefinementKind res = ty.refines(cur->get());
-      if (res == TypeRefinementKind::NO_MATCH ||
-	  res == TypeRefinementKind::LOOSE_MATCH) {
-  	return false;
-      } 
-      ++cur;
-    }
-    return false;
-  };
-    
-  
-  if (m_calls.find(f) == m_calls.end()) {
-    std::vector<CallInfo *> calls;
-    calls.push_back(CallInfo::Create(args_begin, args_end, 1));
-    m_calls[f] = calls;
-  } else {
-    std::vector<CallInfo *> &calls = m_calls[f];
-    for (CallInfo *CI: calls) {
-      // if (refines(*CI)) {
-      // 	// CI already subsumes the one we want to add.
-      // 	CI->get_count()++;
-      // 	return;
-      // }
-      if (is_equal(args_begin, args_end, *CI)) { 
-    	// The function f(args_begin,...,args_end) is already  in m_calls
-    	CI->get_count()++;
-    	return;
-      } 
-    }
-    m_calls[f].push_back(CallInfo::Create(args_begin, args_end, 1));
+  std::unique_ptr<CallInfo> CI(CallInfo::Create(args_begin, args_end, 1));
+  size_t hash = hashArgs(CI->get_args());
+  if (CallInfo *old = findCall(f, CI->get_args(), hash)) {
+    // The function f(args_begin,...,args_end) is already in m_calls
+    old->get_count()++;
+    return;
   }
+  addCall(f, CI.release(), hash);
 }
   
 void ComponentInterface::callFrom(const Function *f) {
@@ -256,34 +221,33 @@ void ComponentInterface::reference(StringRef n) {
 CallInfo *
 ComponentInterface::getOrCreateCall(FunctionHandle f,
                                     const std::vector<InterfaceType> &args) {
-  auto it = m_calls.find(f);
-  CallInfo *result;
-  if (it == m_calls.end()) {
-    std::vector<CallInfo *> infos;
-    result = CallInfo::Create(args, 0);
-    infos.push_back(result);
-    m_calls[f] = infos;
+  size_t hash = hashArgs(args);
+  if (CallInfo *result = findCall(f, args, hash)) {
     return result;
-  } else {
-    for (CallIterator c = it->second.begin(), e = it->second.end(); c != e;
-         ++c) {
-      if (args.size() != (*c)->args.size())
-        continue;
-      std::vector<InterfaceType>::const_iterator x = args.begin();
-      for (std::vector<InterfaceType>::const_iterator y = (*c)->args.begin(),
-                                                      z = args.end();
-           x != z; ++x, ++y) {
-        if (*x != *y)
-          break;
-      }
-      if (x == args.end()) {
-        return *c;
+  }
+  CallInfo *result = CallInfo::Create(args, 0);
+  addCall(f, result, hash);
+  return result;
+}
+
+bool ComponentInterface::join(const ComponentInterface &other) {
+  bool change = false;
+  for (auto &kv : other.m_calls) {
+    StringRef f = kv.first();
+    for (CallInfo *call : kv.second) {
+      size_t hash = hashArgs(call->get_args());
+      if (CallInfo *old = findCall(f, call->get_args(), hash)) {
+        old->get_count() += call->get_count();
+      } else {
+        addCall(f, CallInfo::Create(call->get_args(), call->get_count()), hash);
+        change = true;
       }
     }
-    result = CallInfo::Create(args, 0);
-    m_calls[f].push_back(result);
-    return result;
   }
+  for (const std::string &ref : other.m_references) {
+    change |= m_references.insert(ref).second;
+  }
+  return change;
 }
 
 void ComponentInterface::dump() const {
@@ -337,14 +301,13 @@ void codeInto<proto::ComponentInterface, ComponentInterface>(
     StringRef name = info.name();
     CallInfo *res = new CallInfo();
     codeInto(info, *res);
-    llvm::StringMap<std::vector<CallInfo *>>::iterator it =
-        ci.m_calls.find(name);
-    if (it == ci.m_calls.end()) {
-      std::vector<CallInfo *> infos;
-      infos.push_back(res);
-      ci.m_calls[name] = infos;
+    size_t hash = hashArgs(res->get_args());
+    if (CallInfo *old = ci.findCall(name, res->get_args(), hash)) {
+      // the same call can be recorded by several modules
+      old->get_count() += res->get_count();
+      delete res;
     } else {
-      it->second.push_back(res);
+      ci.addCall(name, res, hash);
     }
   }
   for (std::string ref: buf.references()) {
@@ -352,8 +315,26 @@ void codeInto<proto::ComponentInterface, ComponentInterface>(
   }
 }
 
+// Add the calls and references of a mapped file into ci.
+static void readMapped(const MappedInterface &file, ComponentInterface &ci) {
+  for (unsigned i = 0, e = file.getNumFunctions(); i < e; ++i) {
+    StringRef name = file.getFunction(i);
+    for (const MappedInterface::Call &call : file.calls(name)) {
+      CallInfo *res = ci.getOrCreateCall(name, call.getArgs());
+      res->get_count() += call.getCount();
+    }
+  }
+  for (unsigned i = 0, e = file.getNumReferences(); i < e; ++i) {
+    ci.reference(file.getReference(i));
+  }
+}
+
 bool ComponentInterface::readFromFile(const std::string &filename) {
   assert(filename != "");
+  if (auto mapped = MappedInterface::open(filename)) {
+    readMapped(*mapped, *this);
+    return true;
+  }
   std::ifstream input(filename.c_str(), std::ios::binary);
   if (input.fail()) {
     return false;
@@ -483,8 +464,20 @@ void ComponentInterfaceTransform::rewrite(FunctionHandle hndl,
     this->rewrites[hndl] = std::map<const CallInfo *const, const CallRewrite>();
   }
 
-  this->rewrites[hndl].insert(
-      std::pair<const CallInfo *const, const CallRewrite>(from, to));
+  bool inserted =
+      this->rewrites[hndl]
+          .insert(std::pair<const CallInfo *const, const CallRewrite>(from, to))
+          .second;
+  if (!inserted) {
+    return;
+  }
+
+  RuleIndex &rules = this->index[hndl];
+  rules.exact.insert({hashArgs(from->get_args()), from});
+  if (!std::all_of(from->args_begin(), from->args_end(),
+                   [](const InterfaceType &ty) { return ty.isConcrete(); })) {
+    rules.loose.push_back(from);
+  }
 }
 
 void ComponentInterfaceTransform::dump() const {
@@ -515,19 +508,47 @@ CallRewrite const *ComponentInterfaceTransform::lookupRewrite(
     llvm::User::op_iterator op_end) const {
   
   assert(interface);
+  auto it = index.find(name);
+  if (it == index.end()) {
+    return nullptr;
+  }
+  const RuleIndex &rules = it->second;
+
+  // -- fast path: a call with exactly the abstraction of the actual
+  // -- arguments. There is no call more specific than this one.
+  std::vector<InterfaceType> args;
+  args.reserve(std::distance(op_begin, op_end));
+  for (auto op = op_begin; op != op_end; ++op) {
+    InterfaceType ty = InterfaceType::abstract(op->get());
+    if (ty.isUnknown() && op->get()->getType()->isPointerTy()) {
+      // refines looks through pointer casts of globals
+      InterfaceType stripped =
+          InterfaceType::abstract(op->get()->stripPointerCasts());
+      if (stripped.getKind() == InterfaceType::Kind::G) {
+        ty = stripped;
+      }
+    }
+    args.push_back(ty);
+  }
+  auto range = rules.exact.equal_range(hashArgs(args));
+  for (auto &kv : llvm::make_range(range.first, range.second)) {
+    if (kv.second->get_args() == args) {
+      return this->lookupRewrite(name, kv.second);
+    }
+  }
+
+  // -- slow path: the call with fewest loose matches. The abstraction
+  // -- of the actual arguments is reused for every call.
   const CallInfo *search = nullptr;
   int score = -1;
-
-
-  for (CallInfo *CI: llvm::make_range(interface->call_begin(name.c_str()),
-				     interface->call_end(name.c_str()))) {
-    int tscore = CI->refines(op_begin, op_end);
-    if (tscore > score) {
+  for (const CallInfo *CI : rules.loose) {
+    int tscore = CI->refines(op_begin, op_end, args);
+    if (tscore >= 0 && (!search || tscore < score)) {
       score = tscore;
       search = CI;
     }
   }
-    
+
   return (search ? this->lookupRewrite(name, search): nullptr);
 }
 
@@ -550,6 +571,13 @@ ComponentInterfaceTransform::lookupRewrite(FunctionHandle name,
 bool ComponentInterfaceTransform::readInterfaceFromFile(
     const std::string &filename) {
   assert(filename != "");
+  if (auto mapped = MappedInterface::open(filename)) {
+    if (!interface) {
+      interface = std::make_unique<ComponentInterface>();
+    }
+    readMapped(*mapped, *interface);
+    return true;
+  }
   std::ifstream input(filename.c_str(), std::ios::binary);
   if (input.fail()) {
     return false;
@@ -567,6 +595,23 @@ bool ComponentInterfaceTransform::readInterfaceFromFile(
 bool ComponentInterfaceTransform::readTransformFromFile(
     const std::string &filename) {
   assert(filename != "");
+  if (auto mapped = MappedInterface::open(filename)) {
+    if (!interface) {
+      interface = std::make_unique<ComponentInterface>();
+    }
+    for (unsigned i = 0, e = mapped->getNumFunctions(); i < e; ++i) {
+      StringRef name = mapped->getFunction(i);
+      for (const MappedInterface::Call &call : mapped->calls(name)) {
+        if (!call.hasRewrite()) {
+          continue;
+        }
+        CallInfo *res = interface->getOrCreateCall(name, call.getArgs());
+        res->get_count() += call.getCount();
+        rewrite(name, res, call.getRewriteFunction(), call.getRewriteArgs());
+      }
+    }
+    return true;
+  }
   std::ifstream input(filename.c_str(), std::ios::binary);
   if (input.fail()) {
     return false;
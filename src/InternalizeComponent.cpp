@@ -32,8 +32,10 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
@@ -43,8 +45,11 @@
 #include "llvm/Transforms/IPO.h"
 
 #include "Interfaces.h"
+#include "MappedInterface.h"
+#include "SymbolIndex.h"
 
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -54,17 +59,19 @@ static cl::list<std::string> Interfaces(
     "Pinternalize-wrt-interfaces", cl::NotHidden,
     cl::desc("specifies the interface to internalize with respect to"));
 
+static cl::opt<std::string> IndexFile(
+    "Pinternalize-wrt-index", cl::init(""), cl::Hidden,
+    cl::desc("<file> : whole-program symbol index. Symbols that are not "
+             "reachable from main are not considered used by other "
+             "modules"));
+
 static cl::opt<std::string> KeepExternalFile(
     "Pkeep-external",
-    cl::desc("<file> : list of function names to be whitelisted"),
+    cl::desc("<file> : list of function names to be whitelisted (one per "
+             "line) or a mapped interface whose calls and references are "
+             "whitelisted"),
     cl::init(""));
 
-static cl::opt<unsigned>
-    FixpointTreshold("Pinternalize-fixpoint-threshold",
-                     cl::desc("Limit of fixpoint iterations during global dead "
-                              "code elimination refinement"),
-                     cl::init(5));
-
 namespace previrt {
 
 static Value *stripBitCastCE(Constant *C) {
@@ -153,10 +160,131 @@ static bool setInternalLinkage(GlobalValue &GV) {
   return true;
 }
 
+// Mark V and the globals used by V if V is a constant.
+static void markLive(Value *V, SmallPtrSetImpl<GlobalValue *> &live,
+                     SmallPtrSetImpl<Constant *> &visited,
+                     std::vector<GlobalValue *> &worklist) {
+  if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+    if (live.insert(GV).second) {
+      worklist.push_back(GV);
+    }
+  } else if (Constant *C = dyn_cast<Constant>(V)) {
+    if (visited.insert(C).second) {
+      for (Value *op : C->operands()) {
+        markLive(op, live, visited, worklist);
+      }
+    }
+  }
+}
+
+/*
+ * Remove all globals (functions, variables and aliases) that are not
+ * reachable from the definitions that must be kept, i.e., the ones
+ * with non-local linkage or in a comdat.
+ *
+ * Liveness is propagated with a worklist so each global and constant
+ * is visited once. Dead cycles of internal functions are removed
+ * too. This replaces running GlobalDCE repeatedly until no change.
+ */
+static unsigned removeDeadGlobals(Module &M) {
+  SmallPtrSet<GlobalValue *, 32> live;
+  SmallPtrSet<Constant *, 32> visited;
+  std::vector<GlobalValue *> worklist;
+
+  for (GlobalValue &GV : M.global_values()) {
+    if (!GV.isDeclaration() && (!GV.hasLocalLinkage() || GV.hasComdat())) {
+      markLive(&GV, live, visited, worklist);
+    }
+  }
+
+  while (!worklist.empty()) {
+    GlobalValue *GV = worklist.back();
+    worklist.pop_back();
+    // initializer, aliasee, personality, etc.
+    for (Value *op : GV->operands()) {
+      markLive(op, live, visited, worklist);
+    }
+    if (Function *F = dyn_cast<Function>(GV)) {
+      for (Instruction &I : instructions(*F)) {
+        for (Value *op : I.operands()) {
+          if (isa<Constant>(op)) {
+            markLive(op, live, visited, worklist);
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<GlobalValue *> dead;
+  for (GlobalValue &GV : M.global_values()) {
+    if (!live.count(&GV)) {
+      dead.push_back(&GV);
+    }
+  }
+
+  // -- first drop all references between dead globals so they can be
+  // -- erased in any order
+  for (GlobalValue *GV : dead) {
+    if (Function *F = dyn_cast<Function>(GV)) {
+      F->dropAllReferences();
+    } else if (GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV)) {
+      GVar->setInitializer(nullptr);
+    } else if (GlobalAlias *GA = dyn_cast<GlobalAlias>(GV)) {
+      GA->setAliasee(nullptr);
+    } else if (GlobalIFunc *GIF = dyn_cast<GlobalIFunc>(GV)) {
+      GIF->setResolver(nullptr);
+    }
+  }
+  for (GlobalValue *GV : dead) {
+    GV->removeDeadConstantUsers();
+    GV->eraseFromParent();
+  }
+  return dead.size();
+}
+
 class InternalizePass: public ModulePass {
 public:
   // The current module is internalized with respect to m_interfaces
+  // and m_mapped_interfaces. The latter are queried in place.
   ComponentInterface m_interfaces;
+  std::vector<std::unique_ptr<MappedInterface>> m_mapped_interfaces;
+  // Optional whole-program index. The interfaces are conservative
+  // about calls from code that is never executed; the index is not.
+  std::unique_ptr<SymbolIndex> m_index;
+
+  bool isUnreachable(StringRef name) const {
+    return m_index && m_index->hasSymbol(name) && !m_index->isReachable(name);
+  }
+
+  bool hasCall(StringRef name) const {
+    if (isUnreachable(name)) {
+      return false;
+    }
+    if (m_interfaces.hasCall(name)) {
+      return true;
+    }
+    for (auto &mapped : m_mapped_interfaces) {
+      if (mapped->hasCall(name)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool hasReference(StringRef name) const {
+    if (isUnreachable(name)) {
+      return false;
+    }
+    if (m_interfaces.hasReference(name)) {
+      return true;
+    }
+    for (auto &mapped : m_mapped_interfaces) {
+      if (mapped->hasReference(name)) {
+        return true;
+      }
+    }
+    return false;
+  }
   
   static char ID;
 
@@ -172,12 +300,20 @@ public:
     errs() << "InternalizePass\n";
     for (std::string input : Interfaces) {
       errs() << "Reading file '" << input << "'...";
-      if (m_interfaces.readFromFile(input)) {
+      if (auto mapped = MappedInterface::open(input)) {
+        m_mapped_interfaces.push_back(std::move(mapped));
+        errs() << "success\n";
+      } else if (m_interfaces.readFromFile(input)) {
         errs() << "success\n";
       } else {
         errs() << "failed\n";
       }
     }
+    if (IndexFile != "") {
+      errs() << "Reading index '" << IndexFile << "'...";
+      m_index = SymbolIndex::open(IndexFile);
+      errs() << (m_index ? "success\n" : "failed\n");
+    }
     errs() << "Done reading.\n";
     
     return MinimizeComponent(M);
@@ -210,13 +346,17 @@ bool InternalizePass::MinimizeComponent(Module &M) {
   int internalized_functions = 0;
   int internalized_globals = 0;
 
-  std::set<std::string> keep_external;
+  std::set<std::string> keep_external_names;
+  std::unique_ptr<MappedInterface> keep_external_mapped;
   if (KeepExternalFile != "") {
+    keep_external_mapped = MappedInterface::open(KeepExternalFile);
+  }
+  if (KeepExternalFile != "" && !keep_external_mapped) {
     std::ifstream infile(KeepExternalFile);
     if (infile.is_open()) {
       std::string line;
       while (std::getline(infile, line)) {
-        keep_external.insert(line);
+        keep_external_names.insert(line);
       }
       infile.close();
     } else {
@@ -224,12 +364,20 @@ bool InternalizePass::MinimizeComponent(Module &M) {
     }
   }
 
+  auto isWhitelisted = [&](StringRef name) {
+    if (keep_external_mapped) {
+      return keep_external_mapped->hasCall(name) ||
+             keep_external_mapped->hasReference(name);
+    }
+    return keep_external_names.count(name.str()) > 0;
+  };
+
   // If we cannot internalize an alias we shouldn't either its
   // aliasee.
   SmallSet<Value *, 16> keepAliasees;
   std::vector<GlobalAlias *> unusedAliases;
   for (auto &alias : M.aliases()) {
-    if (alias.hasName() && keep_external.count(alias.getName())) {
+    if (alias.hasName() && isWhitelisted(alias.getName())) {
       errs() << "Did not internalize " << alias.getName()
              << " because it is whitelisted.\n";
       // If this alias cannot be remove make sure its aliasee is not
@@ -238,7 +386,7 @@ bool InternalizePass::MinimizeComponent(Module &M) {
       continue;
     }
 
-    if (!m_interfaces.hasReference(alias.getName()) && alias.use_empty()) {
+    if (!hasReference(alias.getName()) && alias.use_empty()) {
       errs() << "Remove unused alias " << alias.getName() << "\n";
       unusedAliases.push_back(&alias);
     } else {
@@ -255,7 +403,7 @@ bool InternalizePass::MinimizeComponent(Module &M) {
 
   // Set all functions that are not in the interface to internal linkage only
   for (auto &f : M) {
-    if (f.hasName() && keep_external.count(f.getName())) {
+    if (f.hasName() && isWhitelisted(f.getName())) {
       errs() << "Did not internalize " << f.getName()
              << " because it is whitelisted.\n";
       continue;
@@ -266,11 +414,11 @@ bool InternalizePass::MinimizeComponent(Module &M) {
         // f is discardable if unused in other compilation units
         isDiscardableIfUnusedExternally(f) &&
         // No other compilation unit calls f
-        !m_interfaces.hasCall(f.getName()) &&
+        !hasCall(f.getName()) &&
 	// The address of f has not been taken
 	!f.hasAddressTaken() &&
 	// No other compilation unit mentions f
-        !m_interfaces.hasReference(f.getName()) &&
+        !hasReference(f.getName()) &&
         // there is no an alias to f that we want to keep
         !keepAliasees.count(&f)) {
 
@@ -284,7 +432,7 @@ bool InternalizePass::MinimizeComponent(Module &M) {
   // Set all initialized global variables that are not referenced in
   // the interface to "localized linkage" only
   for (auto &gv : M.globals()) {
-    if (gv.hasName() && keep_external.count(gv.getName())) {
+    if (gv.hasName() && isWhitelisted(gv.getName())) {
       errs() << "Did not internalize " << gv.getName()
              << " because it is whitelisted.\n";
       continue;
@@ -292,7 +440,7 @@ bool InternalizePass::MinimizeComponent(Module &M) {
 
     if (gv.hasInitializer() &&
         // global is unused 
-        !m_interfaces.hasReference(gv.getName()) &&
+        !hasReference(gv.getName()) &&
 	// global can be removed if unused
         isDiscardableIfUnusedExternally(gv) &&
         // there is no an alias to the global that we want to keep
@@ -322,39 +470,21 @@ bool InternalizePass::MinimizeComponent(Module &M) {
     return false;
   }
 
-  // Perform global dead code elimination until fixpoint or
-  // threshold is reached.
-  legacy::PassManager dceMgr, mcMgr;
-  ModulePass *modulePassDCE = createGlobalDCEPass();
-  ModulePass *constantMergePass = createConstantMergePass();
-  dceMgr.add(modulePassDCE);
-  mcMgr.add(constantMergePass);
-
-  bool moreToDo = true;
-  bool change_dce = false;
-  bool change_mc = false;
-  unsigned int iters = 0;
-
-  while (moreToDo && iters < FixpointTreshold) {
-    change_dce = dceMgr.run(M);
-    change_mc = mcMgr.run(M);
-    moreToDo = (change_dce || change_mc);
-    ++iters;
-  }
-
-  if (change_dce) {
-    errs() << "GlobalDCE still had more to do\n";
-  }
-  if (change_mc) {
-    errs() << "MergeConstants still had more to do\n";
-  }
+  // Remove the globals that are dead after internalization. Merging
+  // constants does not make more globals dead so one round of each
+  // is enough.
+  unsigned removed_globals = removeDeadGlobals(M);
+  legacy::PassManager mcMgr;
+  mcMgr.add(createConstantMergePass());
+  mcMgr.run(M);
 
   /// HACK: do not remove this line. The python code searches for it ...      
   errs() << "...progress...\n";
   
   errs() << "Progress:"
          << " internalized functions = " << internalized_functions
-         << " internalized globals = " << internalized_globals << "\n";
+         << " internalized globals = " << internalized_globals
+         << " removed globals = " << removed_globals << "\n";
   return true;
 }
 
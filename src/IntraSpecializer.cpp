@@ -36,6 +36,7 @@
  * Intra-module specialization.
  **/
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/CallSite.h"
@@ -44,9 +45,12 @@
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
@@ -55,8 +59,14 @@
 /* here specialization policies */
 #include "AggressiveSpecPolicy.h"
 #include "BoundedSpecPolicy.h"
+#include "BudgetedSpecPolicy.h"
+#include "CostBenefitSpecPolicy.h"
 #include "OnlyOnceSpecPolicy.h"
+#include "ProfileGuidedSpecPolicy.h"
 #include "RecursiveGuardSpecPolicy.h"
+#include "utils/Inliner.h"
+
+#include <algorithm>
 
 using namespace llvm;
 using namespace previrt;
@@ -74,7 +84,18 @@ static cl::opt<SpecializationPolicyType> SpecPolicy(
                           "Ppeval-max-spec-copies"),
                clEnumValN(SpecializationPolicyType::NONREC, "nonrec-aggressive",
                           "Specialize always if some constant arg and function "
-                          "is non-recursive")),
+                          "is non-recursive"),
+               clEnumValN(SpecializationPolicyType::COST_BENEFIT,
+                          "cost-benefit",
+                          "Specialize if some constant arg and the estimated "
+                          "benefit pays off the size of the copy"),
+               clEnumValN(SpecializationPolicyType::PROFILE, "profile",
+                          "Specialize if some constant arg and the callsite "
+                          "is hot according to -Ppeval-profile"),
+               clEnumValN(SpecializationPolicyType::BUDGETED, "budgeted",
+                          "Specialize the callsites with the best estimated "
+                          "benefit per added instruction within "
+                          "-Ppeval-max-growth")),
     cl::init(SpecializationPolicyType::NONREC));
 
 static cl::opt<unsigned> MaxSpecCopies(
@@ -82,18 +103,59 @@ static cl::opt<unsigned> MaxSpecCopies(
     cl::desc(
         "Maximum number of copies for a function if -Ppeval-policy=bounded"));
 
+static cl::opt<unsigned> MinSpecBenefit(
+    "Ppeval-min-benefit", cl::init(10),
+    cl::desc("Minimum percentage of the callee that must be folded to copy "
+             "it if -Ppeval-policy=cost-benefit"));
+
+static cl::opt<unsigned> MaxSpecGrowth(
+    "Ppeval-max-growth", cl::init(100),
+    cl::desc("Maximum code growth (in percentage of the module size) if "
+             "-Ppeval-policy=cost-benefit or budgeted"));
+
+static cl::opt<std::string> SpecProfile(
+    "Ppeval-profile", cl::init(""),
+    cl::desc("Callsite-count profile if -Ppeval-policy=profile"));
+
+static cl::opt<unsigned long long> HotCount(
+    "Ppeval-hot-count", cl::init(0),
+    cl::desc("Minimum count for a callsite to be hot if "
+             "-Ppeval-policy=profile (0: 1% of the hottest count)"));
+
 static cl::opt<bool>
     OptSpecialized("Ppeval-opt", cl::init(false),
                    cl::desc("Optimize new specialized functions"));
 
+static cl::opt<bool> LazySpecialization(
+    "Ppeval-lazy", cl::init(false),
+    cl::desc("Simplify callers before building specialized functions and "
+             "drop the callsites that do not survive"));
+
 namespace previrt {
 
 /**
-   Return true if any callsite in f is specialized using policy.
+   A decision of the specialization policy: the callsite ci should be
+   redirected to a copy of callee specialized on scheme.
 **/
-static bool trySpecializeFunction(Function *f, SpecializationTable &table,
-                                  SpecializationPolicy &policy,
-                                  std::vector<Function *> &to_add) {
+struct SpecRequest {
+  // null if the callsite was removed before the request was materialized
+  WeakTrackingVH ci;
+  Function *callee;
+  // scheme[i] = nullptr if the i-th parameter of the callsite
+  //                     cannot be specialized.
+  //             c if the i-th parameter of the callsite is a
+  //               constant c
+  std::vector<Value *> scheme;
+  // the policy considers the callsite hot
+  bool hot;
+};
+
+/**
+   Ask the policy about every callsite in f and record in requests the
+   ones that should be specialized. The IR is not modified.
+**/
+static void collectSpecRequests(Function *f, SpecializationPolicy &policy,
+                                std::vector<SpecRequest> &requests) {
 
   std::vector<Instruction *> worklist;
   for (BasicBlock &bb : *f) {
@@ -127,7 +189,6 @@ static bool trySpecializeFunction(Function *f, SpecializationTable &table,
     }
   }
 
-  bool modified = false;
   while (!worklist.empty()) {
     Instruction *ci = worklist.back();
     worklist.pop_back();
@@ -139,10 +200,6 @@ static bool trySpecializeFunction(Function *f, SpecializationTable &table,
       // We only try to specialize a function if it's internal.
       continue;
     }
-    // specScheme[i] = nullptr if the i-th parameter of the callsite
-    //                         cannot be specialized.
-    //                 c if the i-th parameter of the callsite is a
-    //                   constant c
     std::vector<Value *> specScheme;
     bool specialize = policy.intraSpecializeOn(cs, specScheme);
 
@@ -170,47 +227,114 @@ static bool trySpecializeFunction(Function *f, SpecializationTable &table,
     errs() << "]\n";
 #endif
 
-    // --- build a specialized function if specScheme is more
-    //     refined than all existing specialized versions.
-    Function *specialized_callee = nullptr;
-    std::vector<const SpecializationTable::Specialization *> versions;
-    table.getSpecializations(callee, specScheme, versions);
-    for (std::vector<const SpecializationTable::Specialization *>::iterator
-             i = versions.begin(),
-             e = versions.end();
-         i != e; ++i) {
-      if (SpecializationTable::Specialization::refines(specScheme,
-                                                       (*i)->args)) {
-        specialized_callee = (*i)->handle;
-        break;
-      }
-    }
+    requests.push_back(
+        {ci, callee, std::move(specScheme), policy.isHotCallSite(cs)});
+  }
+}
 
-    if (!specialized_callee) {
-      specialized_callee = specializeFunction(callee, specScheme);
-      if (!specialized_callee) {
-        continue;
-      }
-      table.addSpecialization(callee, specScheme, specialized_callee);
-      to_add.push_back(specialized_callee);
+/**
+   Return true if req still refers to a callsite that exists, is
+   reachable and calls req.callee with the constants of req.scheme.
+**/
+static bool isLiveSpecRequest(const SpecRequest &req) {
+  Instruction *ci = dyn_cast_or_null<Instruction>(req.ci);
+  if (!ci || !ci->getParent()) {
+    return false;
+  }
+  CallSite cs(ci);
+  if (!cs || cs.getCalledFunction() != req.callee) {
+    return false;
+  }
+  BasicBlock *bb = ci->getParent();
+  if (bb != &bb->getParent()->getEntryBlock() && pred_empty(bb)) {
+    return false;
+  }
+  for (unsigned i = 0, e = req.scheme.size(); i < e; ++i) {
+    if (req.scheme[i] && cs.getArgument(i) != req.scheme[i]) {
+      return false;
     }
+  }
+  return true;
+}
 
-    // -- build the specialized callsite
-    const unsigned int specialized_arg_count = specialized_callee->arg_size();
-    std::vector<unsigned> argPerm;
-    argPerm.reserve(specialized_arg_count);
-    for (unsigned from = 0; from < callee->arg_size(); from++) {
-      if (!specScheme[from]) {
-        argPerm.push_back(from);
-      }
+/**
+   Simplify the callers with pending requests and drop the requests
+   whose callsites did not survive.
+
+   The policy has already been asked about the dropped callsites so
+   stateful policies (e.g., bounded) still count them.
+**/
+static void pruneSpecRequests(Module &M, std::vector<SpecRequest> &requests) {
+  SmallPtrSet<Function *, 16> callers;
+  std::vector<Function *> order;
+  for (SpecRequest &req : requests) {
+    Function *caller = cast<Instruction>(req.ci)->getFunction();
+    if (callers.insert(caller).second) {
+      order.push_back(caller);
     }
-    assert(specialized_arg_count == argPerm.size());
-    Instruction *newInst = specializeCallSite(ci, specialized_callee, argPerm);
-    llvm::ReplaceInstWithInst(ci, newInst);
-    modified = true;
   }
 
-  return modified;
+  llvm::legacy::FunctionPassManager simplifier(&M);
+  simplifier.add(createSCCPPass());
+  simplifier.add(createCFGSimplificationPass());
+  simplifier.doInitialization();
+  for (Function *caller : order) {
+    simplifier.run(*caller);
+  }
+  simplifier.doFinalization();
+
+  unsigned num_requests = requests.size();
+  requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                [](const SpecRequest &req) {
+                                  return !isLiveSpecRequest(req);
+                                }),
+                 requests.end());
+  if (num_requests != requests.size()) {
+    errs() << "Dropped " << num_requests - requests.size()
+           << " specialization requests after simplifying callers.\n";
+  }
+}
+
+/**
+   Build (or reuse) the specialized copy for req and redirect its
+   callsite to it. New copies are added to new_funcs.
+
+   Return true if the callsite was specialized.
+**/
+static bool materializeSpecRequest(SpecRequest &req,
+                                   SpecializationTable &table,
+                                   std::vector<Function *> &new_funcs) {
+  Function *callee = req.callee;
+  Instruction *ci = cast<Instruction>(req.ci);
+
+  // --- reuse the specialized function if it was already built for
+  //     the same callee and scheme. Otherwise, build a new one.
+  bool isNew = false;
+  Function *specialized_callee =
+      getOrCreateSpecialization(table, callee, req.scheme, isNew);
+  if (!specialized_callee) {
+    return false;
+  }
+  if (isNew) {
+    new_funcs.push_back(specialized_callee);
+  }
+  if (req.hot) {
+    specialized_callee->addFnAttr(utils::InlineHintAttr);
+  }
+
+  // -- build the specialized callsite
+  const unsigned int specialized_arg_count = specialized_callee->arg_size();
+  std::vector<unsigned> argPerm;
+  argPerm.reserve(specialized_arg_count);
+  for (unsigned from = 0; from < callee->arg_size(); from++) {
+    if (!req.scheme[from]) {
+      argPerm.push_back(from);
+    }
+  }
+  assert(specialized_arg_count == argPerm.size());
+  Instruction *newInst = specializeCallSite(ci, specialized_callee, argPerm);
+  llvm::ReplaceInstWithInst(ci, newInst);
+  return true;
 }
 
 /* Intra-module specialization */
@@ -256,6 +380,28 @@ bool SpecializerPass::runOnModule(Module &M) {
     policy.reset(new RecursiveGuardSpecPolicy(std::move(subpolicy), cg));
     break;
   }
+  case SpecializationPolicyType::COST_BENEFIT: {
+    std::unique_ptr<SpecializationPolicy> subpolicy =
+        std::make_unique<AggressiveSpecPolicy>();
+    policy.reset(new CostBenefitSpecPolicy(M, std::move(subpolicy),
+                                           MinSpecBenefit, MaxSpecGrowth));
+    break;
+  }
+  case SpecializationPolicyType::PROFILE: {
+    std::unique_ptr<SpecializationPolicy> subpolicy =
+        std::make_unique<AggressiveSpecPolicy>();
+    policy.reset(
+        new ProfileGuidedSpecPolicy(M, std::move(subpolicy), SpecProfile,
+                                    HotCount));
+    break;
+  }
+  case SpecializationPolicyType::BUDGETED: {
+    std::unique_ptr<SpecializationPolicy> subpolicy =
+        std::make_unique<AggressiveSpecPolicy>();
+    policy.reset(
+        new BudgetedSpecPolicy(M, std::move(subpolicy), MaxSpecGrowth));
+    break;
+  }
   default:;
     ;
   }
@@ -265,41 +411,54 @@ bool SpecializerPass::runOnModule(Module &M) {
     return false;
   }
 
-  // -- Specialize functions defined in M
-  std::vector<Function *> to_add;
-  SpecializationTable table(&M);
-  bool modified = false;
+  // -- Phase 1: ask the policy about all callsites in M.
+  //
+  // The functions are snapshotted first so that the copies created
+  // below are not visited until the next run of the pass.
+  std::vector<Function *> worklist;
   for (auto &f : M) {
-    if (f.isDeclaration())
-      continue;
-    modified |= trySpecializeFunction(&f, table, *policy, to_add);
+    if (!f.isDeclaration()) {
+      worklist.push_back(&f);
+    }
+  }
+  std::vector<SpecRequest> requests;
+  for (Function *f : worklist) {
+    collectSpecRequests(f, *policy, requests);
   }
 
-  // -- Optimize new function and add it into the module
-  std::unique_ptr<llvm::legacy::FunctionPassManager> optimizer;
-  if (optimize) {
-    optimizer.reset(new llvm::legacy::FunctionPassManager(&M));
-    // PassManagerBuilder builder;
-    // builder.OptLevel = 3;
-    // builder.populateFunctionPassManager(*optimizer);
+  // -- Lazy mode: only keep the requests whose callsites survive the
+  //    simplification of their callers.
+  bool simplified = false;
+  if (LazySpecialization && !requests.empty()) {
+    pruneSpecRequests(M, requests);
+    simplified = true;
   }
 
-  unsigned specialized_functions = 0;
-  while (!to_add.empty()) {
-    Function *f = to_add.back();
-    to_add.pop_back();
-    if (f->getParent() == &M || f->isDeclaration()) {
-      // The function was already in the module, external call or has
-      // already been added in this round of specialization, no need
-      // to add it twice
-      continue;
-    }
-    specialized_functions++;
-    if (optimizer) {
-      optimizer->run(*f);
+  // -- Phase 2: build the specialized copies and rewrite the
+  //    callsites. This is the only phase that adds functions to M.
+  std::vector<Function *> new_funcs;
+  SpecializationTable table(&M);
+  bool modified = false;
+  for (SpecRequest &req : requests) {
+    modified |= materializeSpecRequest(req, table, new_funcs);
+  }
+
+  // -- Phase 3: optimize the new functions. They are all in M so a
+  //    single pass manager is initialized once for all of them. Only
+  //    the passes that exploit the new constants are run: the whole
+  //    -O pipeline is run later by slash on the entire module.
+  if (optimize && !new_funcs.empty()) {
+    llvm::legacy::FunctionPassManager optimizer(&M);
+    optimizer.add(createSCCPPass());
+    optimizer.add(createInstructionCombiningPass());
+    optimizer.add(createCFGSimplificationPass());
+    optimizer.doInitialization();
+    for (Function *f : new_funcs) {
+      optimizer.run(*f);
     }
-    M.getFunctionList().push_back(f);
+    optimizer.doFinalization();
   }
+  unsigned specialized_functions = new_funcs.size();
 
   if (modified) {
     /// HACK: do not remove this line. The python code searches for it ...
@@ -312,7 +471,7 @@ bool SpecializerPass::runOnModule(Module &M) {
   }
 
   errs() << " === End intra-module specialization ===\n";  
-  return modified;
+  return modified || simplified;
 }
 
 void SpecializerPass::getAnalysisUsage(AnalysisUsage &AU) const {
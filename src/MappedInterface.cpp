@@ -0,0 +1,302 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "MappedInterface.h"
+#include "Interfaces.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+namespace previrt {
+
+static const char Magic[8] = {'o', 'c', 'c', 'a', 'm', 'i', 'f', '\0'};
+
+MappedInterface::MappedInterface(std::unique_ptr<MemoryBuffer> buffer)
+    : m_buffer(std::move(buffer)), m_header(nullptr) {}
+
+bool MappedInterface::validate() const {
+  const char *start = m_buffer->getBufferStart();
+  uint64_t size = m_buffer->getBufferSize();
+  if (size < sizeof(Header)) {
+    return false;
+  }
+  const Header *h = reinterpret_cast<const Header *>(start);
+  if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0 ||
+      h->version != Version) {
+    return false;
+  }
+  uint64_t expected = sizeof(Header) +
+                      (uint64_t)h->num_functions * sizeof(FunctionEntry) +
+                      (uint64_t)h->num_calls * sizeof(CallEntry) +
+                      (uint64_t)h->num_args * sizeof(ArgEntry) +
+                      (uint64_t)h->num_perms * sizeof(uint32_t) +
+                      (uint64_t)h->num_references * sizeof(StrEntry) +
+                      h->strings_size;
+  return expected == size;
+}
+
+std::unique_ptr<MappedInterface>
+MappedInterface::open(const std::string &filename) {
+  // Large files are mmap'ed by MemoryBuffer
+  auto bufOrErr = MemoryBuffer::getFile(filename, -1,
+                                        /*RequiresNullTerminator=*/false);
+  if (!bufOrErr) {
+    return nullptr;
+  }
+  std::unique_ptr<MappedInterface> res(
+      new MappedInterface(std::move(bufOrErr.get())));
+  if (!res->validate()) {
+    return nullptr;
+  }
+
+  const char *cur = res->m_buffer->getBufferStart();
+  const Header *h = reinterpret_cast<const Header *>(cur);
+  res->m_header = h;
+  cur += sizeof(Header);
+  res->m_functions = makeArrayRef(
+      reinterpret_cast<const FunctionEntry *>(cur), h->num_functions);
+  cur += h->num_functions * sizeof(FunctionEntry);
+  res->m_calls =
+      makeArrayRef(reinterpret_cast<const CallEntry *>(cur), h->num_calls);
+  cur += h->num_calls * sizeof(CallEntry);
+  res->m_args =
+      makeArrayRef(reinterpret_cast<const ArgEntry *>(cur), h->num_args);
+  cur += h->num_args * sizeof(ArgEntry);
+  res->m_perms =
+      makeArrayRef(reinterpret_cast<const uint32_t *>(cur), h->num_perms);
+  cur += h->num_perms * sizeof(uint32_t);
+  res->m_references =
+      makeArrayRef(reinterpret_cast<const StrEntry *>(cur), h->num_references);
+  cur += h->num_references * sizeof(StrEntry);
+  res->m_strings = StringRef(cur, h->strings_size);
+
+  // Check that all ranges are in bounds so that queries do not need to.
+  auto validString = [h](const StrEntry &e) {
+    return (uint64_t)e.offset + e.length <= h->strings_size;
+  };
+  for (const FunctionEntry &f : res->m_functions) {
+    if (!validString(f.name) ||
+        (uint64_t)f.first_call + f.num_calls > h->num_calls) {
+      return nullptr;
+    }
+  }
+  for (const CallEntry &c : res->m_calls) {
+    if ((uint64_t)c.first_arg + c.num_args > h->num_args ||
+        (uint64_t)c.first_perm + c.num_perms > h->num_perms) {
+      return nullptr;
+    }
+    if (c.rewrite.offset != NoRewrite && !validString(c.rewrite)) {
+      return nullptr;
+    }
+    // The rewritten call passes a subset of the original arguments
+    for (unsigned i = 0; i < c.num_perms; ++i) {
+      if (res->m_perms[c.first_perm + i] >= c.num_args) {
+        return nullptr;
+      }
+    }
+  }
+  for (const ArgEntry &a : res->m_args) {
+    if (a.kind > (uint8_t)InterfaceType::Kind::IR || !validString(a.value)) {
+      return nullptr;
+    }
+  }
+  for (const StrEntry &e : res->m_references) {
+    if (!validString(e)) {
+      return nullptr;
+    }
+  }
+  return res;
+}
+
+const MappedInterface::FunctionEntry *
+MappedInterface::findFunction(StringRef name) const {
+  auto it = std::lower_bound(m_functions.begin(), m_functions.end(), name,
+                             [this](const FunctionEntry &f, StringRef name) {
+                               return getString(f.name) < name;
+                             });
+  if (it == m_functions.end() || getString(it->name) != name) {
+    return nullptr;
+  }
+  return it;
+}
+
+std::vector<MappedInterface::Call>
+MappedInterface::calls(StringRef name) const {
+  std::vector<Call> res;
+  if (const FunctionEntry *f = findFunction(name)) {
+    res.reserve(f->num_calls);
+    for (unsigned i = 0; i < f->num_calls; ++i) {
+      res.emplace_back(this, &m_calls[f->first_call + i]);
+    }
+  }
+  return res;
+}
+
+bool MappedInterface::hasReference(StringRef name) const {
+  auto it = std::lower_bound(m_references.begin(), m_references.end(), name,
+                             [this](const StrEntry &e, StringRef name) {
+                               return getString(e) < name;
+                             });
+  return it != m_references.end() && getString(*it) == name;
+}
+
+InterfaceType MappedInterface::Call::getArg(unsigned i) const {
+  assert(i < m_entry->num_args);
+  const ArgEntry &a = m_file->m_args[m_entry->first_arg + i];
+  return InterfaceType::get((InterfaceType::Kind)a.kind, a.bits, a.flag,
+                            m_file->getString(a.value));
+}
+
+std::vector<InterfaceType> MappedInterface::Call::getArgs() const {
+  std::vector<InterfaceType> res;
+  res.reserve(m_entry->num_args);
+  for (unsigned i = 0; i < m_entry->num_args; ++i) {
+    res.push_back(getArg(i));
+  }
+  return res;
+}
+
+StringRef MappedInterface::Call::getRewriteFunction() const {
+  assert(hasRewrite());
+  return m_file->getString(m_entry->rewrite);
+}
+
+std::vector<unsigned> MappedInterface::Call::getRewriteArgs() const {
+  assert(hasRewrite());
+  auto perms = m_file->m_perms.slice(m_entry->first_perm, m_entry->num_perms);
+  return std::vector<unsigned>(perms.begin(), perms.end());
+}
+
+namespace {
+// String pool where identical strings are stored once.
+class StringPool {
+  StringMap<uint32_t> m_offsets;
+  std::string m_data;
+
+public:
+  MappedInterface::StrEntry add(StringRef s) {
+    auto it = m_offsets.insert({s, (uint32_t)m_data.size()});
+    if (it.second) {
+      m_data.append(s.begin(), s.end());
+    }
+    return {it.first->second, (uint32_t)s.size()};
+  }
+  const std::string &data() const { return m_data; }
+};
+} // end namespace
+
+template <typename T>
+static void writeArray(raw_ostream &o, const std::vector<T> &v) {
+  o.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+void MappedInterface::write(const ComponentInterface &I,
+                            const ComponentInterfaceTransform *T,
+                            raw_ostream &o) {
+  StringPool pool;
+  std::vector<FunctionEntry> functions;
+  std::vector<CallEntry> calls;
+  std::vector<ArgEntry> args;
+  std::vector<uint32_t> perms;
+  std::vector<StrEntry> references;
+
+  std::vector<std::string> names(I.begin(), I.end());
+  std::sort(names.begin(), names.end());
+  for (const std::string &name : names) {
+    FunctionEntry f;
+    f.name = pool.add(name);
+    f.first_call = calls.size();
+    for (const CallInfo *CI :
+         llvm::make_range(I.call_begin(name), I.call_end(name))) {
+      CallEntry c;
+      c.count = CI->get_count();
+      c.first_arg = args.size();
+      c.num_args = CI->num_args();
+      c.rewrite = {NoRewrite, 0};
+      c.first_perm = perms.size();
+      c.num_perms = 0;
+      for (const InterfaceType &ty : CI->get_args()) {
+        ArgEntry a;
+        a.kind = (uint8_t)ty.getKind();
+        a.flag = ty.getFlag();
+        a.reserved = 0;
+        a.bits = ty.getBits();
+        a.value = pool.add(ty.getValue());
+        args.push_back(a);
+      }
+      if (T) {
+        if (const CallRewrite *rw = T->lookupRewrite(name, CI)) {
+          c.rewrite = pool.add(rw->get_function());
+          c.num_perms = rw->get_args().size();
+          perms.insert(perms.end(), rw->get_args().begin(),
+                       rw->get_args().end());
+        }
+      }
+      calls.push_back(c);
+    }
+    f.num_calls = calls.size() - f.first_call;
+    functions.push_back(f);
+  }
+
+  // std::set is already sorted
+  for (const std::string &ref : I.references()) {
+    references.push_back(pool.add(ref));
+  }
+
+  Header h;
+  std::memcpy(h.magic, Magic, sizeof(Magic));
+  h.version = Version;
+  h.num_functions = functions.size();
+  h.num_calls = calls.size();
+  h.num_args = args.size();
+  h.num_perms = perms.size();
+  h.num_references = references.size();
+  h.strings_size = pool.data().size();
+  h.reserved = 0;
+
+  o.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  writeArray(o, functions);
+  writeArray(o, calls);
+  writeArray(o, args);
+  writeArray(o, perms);
+  writeArray(o, references);
+  o << pool.data();
+}
+
+} // end namespace previrt
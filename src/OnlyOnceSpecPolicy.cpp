@@ -98,6 +98,26 @@ bool OnlyOnceSpecPolicy::intraSpecializeOn(CallSite CS,
   return always_spec_policy.intraSpecializeOn(CS, marks);
 }
 
+// Return true if the other modules call calleeF exactly once
+static bool isCalledOnce(const Function &calleeF,
+                         const ComponentInterface &interface) {
+  // The function is not in the interface
+  if (!interface.hasCall(calleeF.getName())) {
+    return false;
+  }
+
+  // interface contains all possible calls to calleeF from *all* the
+  // other modules. Identical calls share the same entry so we need to
+  // look at the counters.
+  unsigned num_calls = 0;
+  for (const CallInfo *call :
+       llvm::make_range(interface.call_begin(calleeF.getName()),
+                        interface.call_end(calleeF.getName()))) {
+    num_calls += call->get_count();
+  }
+  return num_calls <= 1;
+}
+
 bool OnlyOnceSpecPolicy::interSpecializeOn(
     const Function &calleeF, const std::vector<InterfaceType> &args,
     const ComponentInterface &interface, SmallBitVector &marks) {
@@ -107,20 +127,27 @@ bool OnlyOnceSpecPolicy::interSpecializeOn(
     return false;
   }
 
-  // The function is not in the interface
-  if (!interface.hasCall(calleeF.getName())) {
+  if (!isCalledOnce(calleeF, interface)) {
     return false;
   }
-  
-  // interface contains all possible calls to calleeF from *all* the
-  // other modules.
-  if (std::distance(interface.call_begin(calleeF.getName()),
-                    interface.call_end(calleeF.getName())) > 1) {
+
+  AggressiveSpecPolicy always_spec_policy;
+  return always_spec_policy.interSpecializeOn(calleeF, args, interface, marks);
+}
+
+bool OnlyOnceSpecPolicy::interCopyOn(const Function &calleeF,
+                                     const std::vector<InterfaceType> &args,
+                                     const ComponentInterface &interface) {
+  if (calleeF.getName().startswith(OccamSpecStr)) {
+    return false;
+  }
+
+  if (!isCalledOnce(calleeF, interface)) {
     return false;
   }
 
   AggressiveSpecPolicy always_spec_policy;
-  return always_spec_policy.interSpecializeOn(calleeF, args, interface, marks);
+  return always_spec_policy.interCopyOn(calleeF, args, interface);
 }
 
 } // end namespace
@@ -0,0 +1,220 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ProfileGuidedSpecPolicy.h"
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+#include <fstream>
+#include <sstream>
+
+using namespace llvm;
+
+//#define PGSP_LOG(...) __VA_ARGS__
+#define PGSP_LOG(...)
+
+namespace previrt {
+
+static StringRef OccamSpecStr = "__occam_spec.";
+
+// Percentage of the hottest count above which a callsite is hot if no
+// threshold is given.
+static const uint64_t AutoHotPercentage = 1;
+
+StringRef ProfileGuidedSpecPolicy::originalName(StringRef name) {
+  if (!name.startswith(OccamSpecStr)) {
+    return name;
+  }
+  while (name.startswith(OccamSpecStr)) {
+    name = name.drop_front(OccamSpecStr.size());
+  }
+  if (name.contains('(')) {
+    // intra-module copy: <name>(<args>)
+    return name.split('(').first;
+  }
+  if (name.contains('<')) {
+    // inter-module copy: <name>.<kind><<args>>
+    return name.split('<').first.rsplit('.').first;
+  }
+  return name;
+}
+
+ProfileGuidedSpecPolicy::ProfileGuidedSpecPolicy(
+    Module &M, std::unique_ptr<SpecializationPolicy> subpolicy,
+    const std::string &profile, uint64_t threshold)
+    : m_subpolicy(std::move(subpolicy)), m_threshold(threshold) {
+  errs() << "## Running profile-guided specialization policy\n";
+  if (profile != "") {
+    if (!readProfile(profile)) {
+      errs() << "Warning: cannot read profile " << profile << "\n";
+    } else {
+      errs() << "Read " << m_callsite_counts.size() << " callsite counts and "
+             << m_callee_counts.size() << " function counts from " << profile
+             << "\n";
+    }
+  }
+
+  if (m_threshold == 0) {
+    // A callsite is hot if its count is close to the hottest one.
+    uint64_t max_count = 0;
+    for (auto &kv : m_callee_counts) {
+      max_count = std::max(max_count, kv.second);
+    }
+    for (auto &F : M) {
+      Function::ProfileCount entry = F.getEntryCount();
+      if (entry.hasValue()) {
+        max_count = std::max(max_count, entry.getCount());
+      }
+    }
+    m_threshold = std::max<uint64_t>(1, (max_count * AutoHotPercentage) / 100);
+    errs() << "Hot threshold is " << m_threshold << "\n";
+  }
+}
+
+bool ProfileGuidedSpecPolicy::readProfile(const std::string &filename) {
+  std::ifstream file(filename);
+  if (file.fail()) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream tokens(line);
+    std::vector<std::string> fields;
+    std::string field;
+    while (tokens >> field) {
+      fields.push_back(field);
+    }
+    uint64_t count;
+    if (fields.empty() || StringRef(fields.back()).getAsInteger(10, count)) {
+      errs() << "Warning: skipping profile line '" << line << "'\n";
+      continue;
+    }
+    if (fields.size() == 2) {
+      m_callee_counts[fields[0]] += count;
+    } else if (fields.size() == 3) {
+      m_callsite_counts[{fields[0], fields[1]}] += count;
+      m_callee_counts[fields[1]] += count;
+    } else {
+      errs() << "Warning: skipping profile line '" << line << "'\n";
+    }
+  }
+  return true;
+}
+
+uint64_t ProfileGuidedSpecPolicy::getCount(const Function *caller,
+                                           const Function &callee) const {
+  // The profile was collected on the original program so specialized
+  // copies are mapped back to their original function.
+  StringRef calleeName = originalName(callee.getName());
+  if (caller) {
+    auto it = m_callsite_counts.find(
+        {originalName(caller->getName()).str(), calleeName.str()});
+    if (it != m_callsite_counts.end()) {
+      return it->second;
+    }
+  }
+  auto it = m_callee_counts.find(calleeName);
+  if (it != m_callee_counts.end()) {
+    return it->second;
+  }
+  // Fallback to the entry count if the bitcode was compiled with
+  // profile data.
+  Function::ProfileCount entry = callee.getEntryCount();
+  if (entry.hasValue()) {
+    return entry.getCount();
+  }
+  return 0;
+}
+
+bool ProfileGuidedSpecPolicy::isHotCallSite(CallSite CS) const {
+  const Function *calleeF = CS.getCalledFunction();
+  if (!calleeF) {
+    return false;
+  }
+  const Function *callerF = CS.getInstruction()->getParent()->getParent();
+  return getCount(callerF, *calleeF) >= m_threshold;
+}
+
+bool ProfileGuidedSpecPolicy::isHotCall(
+    const Function &calleeF, const std::vector<InterfaceType> &args) const {
+  // The callers are in other modules
+  return getCount(nullptr, calleeF) >= m_threshold;
+}
+
+bool ProfileGuidedSpecPolicy::intraSpecializeOn(CallSite CS,
+                                                std::vector<Value *> &marks) {
+  const Function *calleeF = CS.getCalledFunction();
+  if (!calleeF) {
+    return false;
+  }
+  if (!isHotCallSite(CS)) {
+    PGSP_LOG(errs() << "[ProfileGuidedSpecPolicy] cold call to "
+                    << calleeF->getName() << " in "
+                    << CS.getInstruction()->getParent()->getParent()->getName()
+                    << "\n";);
+    return false;
+  }
+  return m_subpolicy->intraSpecializeOn(CS, marks);
+}
+
+bool ProfileGuidedSpecPolicy::interSpecializeOn(
+    const Function &calleeF, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface, SmallBitVector &marks) {
+  if (!isHotCall(calleeF, args)) {
+    PGSP_LOG(errs() << "[ProfileGuidedSpecPolicy] cold calls to "
+                    << calleeF.getName() << "\n";);
+    return false;
+  }
+  return m_subpolicy->interSpecializeOn(calleeF, args, interface, marks);
+}
+
+bool ProfileGuidedSpecPolicy::interCopyOn(
+    const Function &calleeF, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface) {
+  if (!isHotCall(calleeF, args)) {
+    PGSP_LOG(errs() << "[ProfileGuidedSpecPolicy] cold calls to "
+                    << calleeF.getName() << "\n";);
+    return false;
+  }
+  return m_subpolicy->interCopyOn(calleeF, args, interface);
+}
+
+} // end namespace previrt
@@ -0,0 +1,314 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+/**
+ * Propagate interfaces across a set of modules in a single process.
+ *
+ * This computes the same fixpoint as the python driver
+ * (razor/passes.py:propagate_interfaces) but without running opt and
+ * (de)serializing the interface once per module and iteration. Each
+ * module is parsed once in its own LLVMContext so the interface of
+ * each module can be gathered in parallel. Then, the interfaces are
+ * merged (using the hashed index of ComponentInterface) and the
+ * process is repeated until no new call or reference is added.
+ *
+ * The module on which the pass runs is the first module of the
+ * set. The rest are given by -Ppropagate-interfaces-module.
+ *
+ * Only the LLVM callgraph is supported since the sea-dsa callgraph
+ * needs a pass manager for each module.
+ *
+ * Since all modules are loaded anyway, the pass can also write the
+ * whole-program symbol index (SymbolIndex.h) with
+ * -Ppropagate-interfaces-symbols.
+ **/
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "GatherInterface.h"
+#include "Interfaces.h"
+#include "MappedInterface.h"
+#include "SymbolIndex.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "proto/Previrt.pb.h"
+
+using namespace llvm;
+
+static cl::list<std::string> PropagateModules(
+    "Ppropagate-interfaces-module", cl::Hidden,
+    cl::desc("Bitcode of the other modules of the program"));
+
+static cl::list<std::string> PropagateInputs(
+    "Ppropagate-interfaces-input", cl::Hidden,
+    cl::desc("Initial interfaces (e.g., the interface of main)"));
+
+static cl::opt<std::string> PropagateOutput(
+    "Ppropagate-interfaces-output", cl::init(""), cl::Hidden,
+    cl::desc("Output file for the propagated interface"));
+
+static cl::opt<bool> PropagateOutputMapped(
+    "Ppropagate-interfaces-output-mapped", cl::init(false), cl::Hidden,
+    cl::desc("Write the interface in the mmap-able format instead of "
+             "protobuf"));
+
+static cl::opt<std::string> PropagateSymbols(
+    "Ppropagate-interfaces-symbols", cl::init(""), cl::Hidden,
+    cl::desc("Output file for the symbol reachability index of the "
+             "modules"));
+
+static cl::opt<unsigned> PropagateThreads(
+    "Ppropagate-interfaces-threads", cl::init(0), cl::Hidden,
+    cl::desc("Number of threads used to gather interfaces (0 means one "
+             "per hardware thread)"));
+
+#define PI_LOG(...) __VA_ARGS__
+//#define PI_LOG(...)
+
+namespace previrt {
+
+namespace {
+// A module of the program together with its callgraph.
+struct ModuleInfo {
+  std::string filename;
+  // null if the module is the one the pass runs on
+  std::unique_ptr<LLVMContext> context;
+  std::unique_ptr<Module> owned;
+  Module *module;
+  std::unique_ptr<CallGraph> cg;
+
+  ModuleInfo() : module(nullptr) {}
+};
+} // end namespace
+
+class PropagateInterfacesPass : public ModulePass {
+
+  static std::unique_ptr<ThreadPool> makeThreadPool() {
+    if (PropagateThreads == 0) {
+      return std::unique_ptr<ThreadPool>(new ThreadPool());
+    }
+    return std::unique_ptr<ThreadPool>(new ThreadPool(PropagateThreads));
+  }
+
+  // Parse filename in its own context. Return false on error.
+  static bool loadModule(ModuleInfo &info) {
+    SMDiagnostic err;
+    info.context.reset(new LLVMContext());
+    info.owned = parseIRFile(info.filename, err, *info.context);
+    if (!info.owned) {
+      return false;
+    }
+    info.module = info.owned.get();
+    return true;
+  }
+
+  // Gather the interface of info.module using as entry points the
+  // functions called in iface.
+  static void gather(ModuleInfo &info, const ComponentInterface &iface,
+                     ComponentInterface &out) {
+    std::vector<Function *> entries;
+    for (auto FH : llvm::make_range(iface.begin(), iface.end())) {
+      if (Function *f = info.module->getFunction(FH)) {
+        entries.push_back(f);
+      }
+    }
+    gatherInterface(*info.module, *info.cg, &entries, out, nulls());
+  }
+
+  static void writeInterface(const ComponentInterface &iface) {
+    if (PropagateOutputMapped) {
+      std::error_code EC;
+      raw_fd_ostream output(PropagateOutput, EC, sys::fs::OF_None);
+      if (EC) {
+        report_fatal_error(
+            Twine("[PropagateInterfaces] failed to write out interface: ") +
+            EC.message());
+      }
+      MappedInterface::write(iface, nullptr, output);
+      output.close();
+      if (output.has_error()) {
+        output.clear_error();
+        report_fatal_error(
+            Twine("[PropagateInterfaces] failed to write out interface to ") +
+            PropagateOutput);
+      }
+      return;
+    }
+    proto::ComponentInterface ci;
+    codeInto<ComponentInterface, proto::ComponentInterface>(iface, ci);
+    std::ofstream output(PropagateOutput.c_str(), std::ios::binary);
+    if (!output.good() || !ci.SerializeToOstream(&output)) {
+      report_fatal_error(
+          Twine("[PropagateInterfaces] failed to write out interface to ") +
+          PropagateOutput);
+    }
+  }
+
+  static void writeSymbols(const std::vector<ModuleInfo> &modules,
+                           const ComponentInterface &entries) {
+    std::error_code EC;
+    raw_fd_ostream output(PropagateSymbols, EC, sys::fs::OF_None);
+    if (EC) {
+      report_fatal_error(
+          Twine("[PropagateInterfaces] failed to write out symbol index: ") +
+          EC.message());
+    }
+    std::vector<Module *> ms;
+    for (const ModuleInfo &info : modules) {
+      ms.push_back(info.module);
+    }
+    SymbolIndex::write(ms, &entries, output);
+    output.close();
+    if (output.has_error()) {
+      output.clear_error();
+      report_fatal_error(
+          Twine("[PropagateInterfaces] failed to write out symbol index to ") +
+          PropagateSymbols);
+    }
+  }
+
+public:
+  static char ID;
+
+  PropagateInterfacesPass() : ModulePass(ID) {}
+
+  virtual bool runOnModule(Module &M) override {
+    // the calls and references from the rest of the program
+    ComponentInterface inputs;
+    for (auto &filename : PropagateInputs) {
+      if (!inputs.readFromFile(filename)) {
+        report_fatal_error(
+            Twine("[PropagateInterfaces] failed to read interface from ") +
+            filename);
+      }
+    }
+    ComponentInterface iface;
+    iface.join(inputs);
+
+    std::vector<ModuleInfo> modules(PropagateModules.size() + 1);
+    modules[0].filename = M.getModuleIdentifier();
+    modules[0].module = &M;
+    for (unsigned i = 0, e = PropagateModules.size(); i < e; ++i) {
+      modules[i + 1].filename = PropagateModules[i];
+    }
+
+    std::unique_ptr<ThreadPool> pool = makeThreadPool();
+
+    // -- parse the modules and build their callgraphs
+    std::vector<char> loaded(modules.size(), true);
+    for (unsigned i = 0, e = modules.size(); i < e; ++i) {
+      pool->async([&modules, &loaded, i]() {
+        ModuleInfo &info = modules[i];
+        if (!info.module && !loadModule(info)) {
+          loaded[i] = false;
+          return;
+        }
+        info.cg.reset(new CallGraph(*info.module));
+      });
+    }
+    pool->wait();
+    for (unsigned i = 0, e = modules.size(); i < e; ++i) {
+      if (!loaded[i]) {
+        report_fatal_error(
+            Twine("[PropagateInterfaces] failed to read module ") +
+            modules[i].filename);
+      }
+    }
+
+    // -- refine the interface until no new call or reference is
+    // -- found. The interfaces of the modules only depend on the
+    // -- current interface so they are gathered in parallel.
+    unsigned iterations = 0;
+    bool progress = true;
+    while (progress) {
+      ++iterations;
+      std::vector<std::unique_ptr<ComponentInterface>> gathered(
+          modules.size());
+      for (unsigned i = 0, e = modules.size(); i < e; ++i) {
+        gathered[i].reset(new ComponentInterface());
+        pool->async([&modules, &iface, &gathered, i]() {
+          gather(modules[i], iface, *gathered[i]);
+        });
+      }
+      pool->wait();
+
+      // merge in the order of the modules so the result is
+      // deterministic.
+      progress = false;
+      for (auto &ci : gathered) {
+        progress |= iface.join(*ci);
+      }
+    }
+
+    PI_LOG(errs() << "Propagated interfaces of " << modules.size()
+                  << " modules in " << iterations << " iterations\n";);
+
+    if (PropagateOutput != "") {
+      writeInterface(iface);
+    }
+    if (PropagateSymbols != "") {
+      writeSymbols(modules, inputs);
+    }
+    return false;
+  }
+
+  virtual StringRef getPassName() const override {
+    return "Propagate interfaces across modules";
+  }
+};
+
+char PropagateInterfacesPass::ID = 0;
+
+} // end namespace previrt
+
+static RegisterPass<previrt::PropagateInterfacesPass>
+    X("Ppropagate-interfaces",
+      "Compute the interfaces of a set of modules until stabilization", false,
+      false);
@@ -105,4 +105,14 @@ bool RecursiveGuardSpecPolicy::interSpecializeOn(
   }
 }
 
+bool RecursiveGuardSpecPolicy::interCopyOn(
+    const Function &CalleeF, const std::vector<InterfaceType> &args,
+    const ComponentInterface &interface) {
+  if (allowSpecialization(CalleeF)) {
+    return m_subpolicy->interCopyOn(CalleeF, args, interface);
+  } else {
+    return false;
+  }
+}
+
 } // end namespace previrt
@@ -39,6 +39,7 @@
 
 #include "SpecializationTable.h"
 
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
@@ -52,7 +53,7 @@ namespace previrt {
 typedef SpecializationTable::Specialization Specialization;
 
 /* Return true if l refines r */
-bool Specialization::refines(SpecScheme l, SpecScheme r) {
+bool Specialization::refines(const SpecScheme &l, const SpecScheme &r) {
   assert(l.size() == r.size());
   for (unsigned i = 0, e = l.size(); i < e; i++) {
     if (!r[i])
@@ -137,7 +138,7 @@ SpecializationTable::~SpecializationTable() {
 }
 
 void SpecializationTable::getSpecializations(
-    Function *f, SpecScheme scheme,
+    Function *f, const SpecScheme &scheme,
     std::vector<const Specialization *> &result) const {
   const Specialization *current = this->getSpecialization(f);
   for (std::vector<Specialization *>::const_iterator
@@ -150,7 +151,48 @@ void SpecializationTable::getSpecializations(
   }
 }
 
-bool SpecializationTable::addSpecialization(Function *parent, SpecScheme scheme,
+/*
+ * Intern a specialization argument. Constants are already uniqued by
+ * LLVM so their addresses can be used directly. The only exception
+ * are string literals: two callsites can pass the same string via two
+ * different (private) global variables so strings are interned by
+ * their contents.
+ */
+const void *SpecializationTable::internArg(Value *v) {
+  if (!v) {
+    return nullptr;
+  }
+  if (isa<ConstantExpr>(v)) {
+    StringRef str;
+    if (getConstantStringInfo(v, str, 0, false)) {
+      return strings.insert(str).first->getKey().data();
+    }
+  }
+  return v;
+}
+
+SpecializationTable::SpecKey
+SpecializationTable::makeKey(Function *f, const SpecScheme &scheme) {
+  SpecKey key;
+  key.function = f;
+  key.args.reserve(scheme.size());
+  for (Value *v : scheme) {
+    key.args.push_back(internArg(v));
+  }
+  return key;
+}
+
+Function *SpecializationTable::lookupSpecialization(Function *f,
+                                                    const SpecScheme &scheme) {
+  auto it = index.find(makeKey(f, scheme));
+  if (it == index.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+bool SpecializationTable::addSpecialization(Function *parent,
+                                            const SpecScheme &scheme,
                                             Function *specialization,
                                             bool record) {
   assert(parent != NULL);
@@ -168,6 +210,8 @@ bool SpecializationTable::addSpecialization(Function *parent, SpecScheme scheme,
   spec->parent = parentSpec;
   std::copy(scheme.begin(), scheme.end(), std::back_inserter(spec->args));
   this->specialized[specialization] = spec;
+  this->index.insert(
+      std::make_pair(makeKey(parent, scheme), specialization));
 
   //.GetOrCreateValue(specialization->getName(), spec);
   parentSpec->children.push_back(spec);
@@ -46,8 +46,10 @@
 #include "llvm/Transforms/Utils/Cloning.h"
 
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallBitVector.h"
 
 #include "InterfaceTypes.h"
+#include "SpecializationTable.h"
 #include "Specializer.h"
 
 #include <fstream>
@@ -100,6 +102,81 @@ std::string specializeName(Function *f, std::vector<std::string> &args) {
   }
 }
 
+/*
+ * Build in name the name of the specialization of f where the i-th
+ * argument is knownNames[i] (empty if the argument is not known).
+ * Return false if the name of f cannot be matched with its arguments.
+ */
+static bool specializedName(Function *f,
+                            const std::vector<std::string> &knownNames,
+                            std::string &name) {
+  unsigned int i = 0;
+  unsigned int j = 0;
+  std::vector<std::string> argNames;
+  name = specializeName(f, argNames);
+  for (; i < f->arg_size(); i++) {
+    while (argNames[j] != "?") {
+      j++;
+      if (j >= argNames.size()) {
+	// HOTFIX: running out-of-bounds is possible here. Not sure if
+	// we can do something better than giving up.
+	return false;
+      }
+    }
+
+    if (!knownNames[i].empty()) {
+      argNames[j] = knownNames[i];
+    }
+    j++;
+  }
+
+  name += "(";
+  for (auto it=argNames.begin(), et=argNames.end();it!=et;) {
+    name += *it;
+    ++it;
+    if (it!=et) {
+      name += ",";
+    }
+  }
+  name += ")";
+  return true;
+}
+
+static bool specializedName(Function *f, const std::vector<Value *> &args,
+                            std::string &name) {
+  std::vector<std::string> knownNames(f->arg_size());
+  for (unsigned i = 0, e = f->arg_size(); i < e; ++i) {
+    if (args[i]) {
+      knownNames[i] = InterfaceType::abstract(args[i]).to_string();
+    }
+  }
+  return specializedName(f, knownNames, name);
+}
+
+Function *findSpecialization(Function *f, const std::vector<Value *> &args) {
+  std::string name;
+  if (!f->hasName() || !specializedName(f, args, name)) {
+    return nullptr;
+  }
+  return f->getParent()->getFunction(name);
+}
+
+Function *findSpecialization(Function *f,
+                             const std::vector<InterfaceType> &args,
+                             const SmallBitVector &marks) {
+  std::vector<std::string> knownNames(f->arg_size());
+  for (unsigned i = 0, e = f->arg_size(); i < e; ++i) {
+    if (i < marks.size() && marks.test(i)) {
+      knownNames[i] = args[i].to_string();
+    }
+  }
+  std::string name;
+  if (!f->hasName() || !specializedName(f, knownNames, name)) {
+    return nullptr;
+  }
+  return f->getParent()->getFunction(name);
+}
+
 /*
  * f is the original function
  * 
@@ -107,8 +184,11 @@ std::string specializeName(Function *f, std::vector<std::string> &args) {
  * args[i] is not null then the i-th argument of the new function
  * will be replaced with args[i].
 */  
-Function *specializeFunction(Function *f, const std::vector<Value *> &args) {
+static Function *specializeFunction(Function *f,
+                                    const std::vector<Value *> &args,
+                                    bool &isNew) {
   assert(!f->isDeclaration());
+  isNew = false;
 
   if (!f->hasName()) {
     // XXX: this is a unnecessary restriction but it should never
@@ -117,50 +197,30 @@ Function *specializeFunction(Function *f, const std::vector<Value *> &args) {
     return nullptr;
   }
 
+  std::string baseName;
+  if (!specializedName(f, args, baseName)) {
+    return nullptr;
+  }
+
   ValueToValueMapTy vmap;
   unsigned int i = 0;
-  unsigned int j = 0;
-  std::vector<std::string> argNames;
-  std::string baseName = specializeName(f, argNames);
   for (Function::arg_iterator it = f->arg_begin(); it != f->arg_end();
        it++, i++) {
-    while (argNames[j] != "?") {
-      j++;
-      if (j >= argNames.size()) {
-	// HOTFIX: running out-of-bounds is possible here. Not sure if
-	// we can do something better than giving up.
-	return nullptr;
-      }
-    }
-
     if (args[i]) {
       Value *arg = (Value *)&(*it);
       assert(arg->getType() == args[i]->getType() &&
              "Specializing argument with concrete value of wrong type!");
       vmap.insert(typename ValueToValueMapTy::value_type(arg, args[i]));
-      InterfaceType pt = InterfaceType::abstract(args[i]);
-      argNames[j] = pt.to_string();
     }
-    j++;
   }
   assert(i == f->arg_size());
 
-  baseName += "(";
-  for (auto it=argNames.begin(), et=argNames.end();it!=et;) {
-    baseName += *it;
-    ++it;
-    if (it!=et) {
-      baseName += ",";
-    }
-  }
-  baseName += ")";
-
-  
   Function *result = f->getParent()->getFunction(baseName);
   if (!result) {
     ClonedCodeInfo info;
     result = llvm::CloneFunction(f, vmap, &info);
     result->setName(baseName);
+    isNew = true;
   } else {
     // If specialized function already exists, no reason
     // to create another one. In fact, can cause the process
@@ -185,6 +245,30 @@ Function *specializeFunction(Function *f, const std::vector<Value *> &args) {
   return result;
 }
 
+Function *specializeFunction(Function *f, const std::vector<Value *> &args) {
+  bool isNew;
+  return specializeFunction(f, args, isNew);
+}
+
+Function *getOrCreateSpecialization(SpecializationTable &table, Function *f,
+                                    const std::vector<Value *> &args,
+                                    bool &isNew) {
+  isNew = false;
+  if (Function *result = table.lookupSpecialization(f, args)) {
+    return result;
+  }
+
+  // Slow path: the name of the specialized function is only built
+  // here. specializeFunction can still return an existing function if
+  // the module was already specialized by a previous run.
+  Function *result = specializeFunction(f, args, isNew);
+  if (!result) {
+    return nullptr;
+  }
+  table.addSpecialization(f, args, result);
+  return result;
+}
+
 /*
  * Specialize a call site and return the new instruction.
  */
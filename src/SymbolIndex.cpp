@@ -0,0 +1,412 @@
+//
+// OCCAM
+//
+// Copyright (c) 2020, SRI International
+//
+//  All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// * Neither the name of SRI International nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "SymbolIndex.h"
+#include "Interfaces.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace llvm;
+
+namespace previrt {
+
+static const char Magic[8] = {'o', 'c', 'c', 'a', 'm', 's', 'y', '\0'};
+
+SymbolIndex::SymbolIndex(std::unique_ptr<MemoryBuffer> buffer)
+    : m_buffer(std::move(buffer)), m_header(nullptr) {}
+
+bool SymbolIndex::validate() const {
+  const char *start = m_buffer->getBufferStart();
+  uint64_t size = m_buffer->getBufferSize();
+  if (size < sizeof(Header)) {
+    return false;
+  }
+  const Header *h = reinterpret_cast<const Header *>(start);
+  if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0 ||
+      h->version != Version || h->words != (h->num_modules + 63) / 64) {
+    return false;
+  }
+  uint64_t expected = sizeof(Header) +
+                      (uint64_t)h->num_modules * sizeof(StrEntry) +
+                      (uint64_t)h->num_symbols * sizeof(SymbolEntry) +
+                      2 * (uint64_t)h->num_symbols * h->words * sizeof(uint64_t) +
+                      h->strings_size;
+  return expected == size;
+}
+
+std::unique_ptr<SymbolIndex> SymbolIndex::open(const std::string &filename) {
+  // Large files are mmap'ed by MemoryBuffer
+  auto bufOrErr = MemoryBuffer::getFile(filename, -1,
+                                        /*RequiresNullTerminator=*/false);
+  if (!bufOrErr) {
+    return nullptr;
+  }
+  std::unique_ptr<SymbolIndex> res(new SymbolIndex(std::move(bufOrErr.get())));
+  if (!res->validate()) {
+    return nullptr;
+  }
+
+  const char *cur = res->m_buffer->getBufferStart();
+  const Header *h = reinterpret_cast<const Header *>(cur);
+  res->m_header = h;
+  cur += sizeof(Header);
+  res->m_modules =
+      makeArrayRef(reinterpret_cast<const StrEntry *>(cur), h->num_modules);
+  cur += h->num_modules * sizeof(StrEntry);
+  res->m_symbols =
+      makeArrayRef(reinterpret_cast<const SymbolEntry *>(cur), h->num_symbols);
+  cur += h->num_symbols * sizeof(SymbolEntry);
+  uint64_t bitsets = (uint64_t)h->num_symbols * h->words;
+  res->m_defs = makeArrayRef(reinterpret_cast<const uint64_t *>(cur), bitsets);
+  cur += bitsets * sizeof(uint64_t);
+  res->m_refs = makeArrayRef(reinterpret_cast<const uint64_t *>(cur), bitsets);
+  cur += bitsets * sizeof(uint64_t);
+  res->m_strings = StringRef(cur, h->strings_size);
+
+  // Check that all strings are in bounds so that queries do not need to.
+  auto inBounds = [h](const StrEntry &e) {
+    return (uint64_t)e.offset + e.length <= h->strings_size;
+  };
+  if (!std::all_of(res->m_modules.begin(), res->m_modules.end(), inBounds) ||
+      !std::all_of(res->m_symbols.begin(), res->m_symbols.end(),
+                   [&inBounds](const SymbolEntry &s) {
+                     return inBounds(s.name);
+                   })) {
+    return nullptr;
+  }
+  return res;
+}
+
+int SymbolIndex::findSymbol(StringRef name) const {
+  auto it = std::lower_bound(m_symbols.begin(), m_symbols.end(), name,
+                             [this](const SymbolEntry &s, StringRef name) {
+                               return getString(s.name) < name;
+                             });
+  if (it == m_symbols.end() || getString(it->name) != name) {
+    return -1;
+  }
+  return it - m_symbols.begin();
+}
+
+unsigned SymbolIndex::countModules(ArrayRef<uint64_t> bits, int sym) const {
+  unsigned count = 0;
+  for (uint64_t w : bits.slice(sym * m_header->words, m_header->words)) {
+    count += countPopulation(w);
+  }
+  return count;
+}
+
+bool SymbolIndex::isReachable(StringRef name) const {
+  int sym = findSymbol(name);
+  return sym < 0 || (m_symbols[sym].flags & Reachable);
+}
+
+bool SymbolIndex::isAddressTaken(StringRef name) const {
+  int sym = findSymbol(name);
+  return sym < 0 || (m_symbols[sym].flags & AddressTaken);
+}
+
+bool SymbolIndex::mayBeUsedOutside(StringRef name) const {
+  int sym = findSymbol(name);
+  if (sym < 0 || countModules(m_defs, sym) != 1) {
+    return true;
+  }
+  ArrayRef<uint64_t> defs = m_defs.slice(sym * m_header->words, m_header->words);
+  ArrayRef<uint64_t> refs = m_refs.slice(sym * m_header->words, m_header->words);
+  for (unsigned i = 0, e = m_header->words; i < e; ++i) {
+    if (refs[i] & ~defs[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+namespace {
+// Symbol of the whole program while the index is built
+struct Symbol {
+  std::string name;
+  BitVector defs;
+  BitVector refs;
+  bool address_taken;
+  // node in the reference graph
+  unsigned node;
+};
+
+// Reference graph of the whole program. Globals with non-local
+// linkage are resolved by name so there is one node per symbol and
+// one node per local global.
+class ReferenceGraph {
+  unsigned m_num_modules;
+  StringMap<unsigned> m_symbol_ids;
+  DenseMap<const GlobalValue *, unsigned> m_local_nodes;
+  std::vector<std::vector<unsigned>> m_succs;
+
+  unsigned newNode() {
+    m_succs.emplace_back();
+    return m_succs.size() - 1;
+  }
+
+  // Add an edge from n to every global used by V.
+  void addUses(unsigned n, const Value *V,
+               SmallPtrSetImpl<const Constant *> &visited) {
+    if (const GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+      m_succs[n].push_back(getNode(*GV));
+    } else if (const Constant *C = dyn_cast<Constant>(V)) {
+      if (visited.insert(C).second) {
+        for (const Value *op : C->operands()) {
+          addUses(n, op, visited);
+        }
+      }
+    }
+  }
+
+public:
+  std::vector<Symbol> symbols;
+
+  ReferenceGraph(unsigned num_modules) : m_num_modules(num_modules) {}
+
+  Symbol *getSymbol(const GlobalValue &GV) {
+    if (GV.hasLocalLinkage() || !GV.hasName()) {
+      return nullptr;
+    }
+    auto it = m_symbol_ids.find(GV.getName());
+    if (it != m_symbol_ids.end()) {
+      return &symbols[it->second];
+    }
+    m_symbol_ids[GV.getName()] = symbols.size();
+    symbols.push_back({GV.getName().str(), BitVector(m_num_modules),
+                       BitVector(m_num_modules), false, newNode()});
+    return &symbols.back();
+  }
+
+  // Return -1 if no module defines or references name
+  int findNode(StringRef name) const {
+    auto it = m_symbol_ids.find(name);
+    return it != m_symbol_ids.end() ? (int)symbols[it->second].node : -1;
+  }
+
+  unsigned getNode(const GlobalValue &GV) {
+    if (Symbol *sym = getSymbol(GV)) {
+      return sym->node;
+    }
+    auto it = m_local_nodes.find(&GV);
+    if (it != m_local_nodes.end()) {
+      return it->second;
+    }
+    unsigned n = newNode();
+    m_local_nodes[&GV] = n;
+    return n;
+  }
+
+  void addModule(unsigned i, const Module &M) {
+    for (const GlobalValue &GV : M.global_values()) {
+      if (Symbol *sym = getSymbol(GV)) {
+        if (!GV.isDeclaration()) {
+          sym->defs.set(i);
+        } else if (!isa<Function>(GV) || !cast<Function>(GV).isIntrinsic()) {
+          sym->refs.set(i);
+        }
+        if (const Function *F = dyn_cast<Function>(&GV)) {
+          sym->address_taken |= F->hasAddressTaken();
+        }
+      }
+      if (GV.isDeclaration()) {
+        continue;
+      }
+      unsigned n = getNode(GV);
+      SmallPtrSet<const Constant *, 32> visited;
+      // initializer, aliasee, personality, etc.
+      for (const Value *op : GV.operands()) {
+        addUses(n, op, visited);
+      }
+      if (const Function *F = dyn_cast<Function>(&GV)) {
+        for (const Instruction &I : instructions(*F)) {
+          for (const Value *op : I.operands()) {
+            addUses(n, op, visited);
+          }
+        }
+      }
+    }
+  }
+
+  // Mark the nodes reachable from roots
+  BitVector reachable(ArrayRef<unsigned> roots) const {
+    BitVector visited(m_succs.size());
+    std::vector<unsigned> worklist(roots.begin(), roots.end());
+    while (!worklist.empty()) {
+      unsigned n = worklist.back();
+      worklist.pop_back();
+      if (visited.test(n)) {
+        continue;
+      }
+      visited.set(n);
+      for (unsigned succ : m_succs[n]) {
+        if (!visited.test(succ)) {
+          worklist.push_back(succ);
+        }
+      }
+    }
+    return visited;
+  }
+};
+
+// String pool where identical strings are stored once.
+class StringPool {
+  StringMap<uint32_t> m_offsets;
+  std::string m_data;
+
+public:
+  SymbolIndex::StrEntry add(StringRef s) {
+    auto it = m_offsets.insert({s, (uint32_t)m_data.size()});
+    if (it.second) {
+      m_data.append(s.begin(), s.end());
+    }
+    return {it.first->second, (uint32_t)s.size()};
+  }
+  const std::string &data() const { return m_data; }
+};
+} // end namespace
+
+template <typename T>
+static void writeArray(raw_ostream &o, const std::vector<T> &v) {
+  o.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+static void appendWords(const BitVector &bv, unsigned words,
+                        std::vector<uint64_t> &out) {
+  size_t first = out.size();
+  out.resize(first + words, 0);
+  for (unsigned i : bv.set_bits()) {
+    out[first + i / 64] |= (uint64_t)1 << (i % 64);
+  }
+}
+
+void SymbolIndex::write(ArrayRef<Module *> modules,
+                        const ComponentInterface *entries, raw_ostream &o) {
+  ReferenceGraph graph(modules.size());
+  for (unsigned i = 0, e = modules.size(); i < e; ++i) {
+    graph.addModule(i, *modules[i]);
+  }
+
+  // -- roots of the reference graph
+  std::vector<unsigned> roots;
+  bool hasMain = false;
+  for (Module *M : modules) {
+    if (Function *main = M->getFunction("main")) {
+      hasMain |= !main->isDeclaration();
+    }
+  }
+  for (Module *M : modules) {
+    for (GlobalValue &GV : M->global_values()) {
+      if (GV.isDeclaration()) {
+        continue;
+      }
+      if (GV.hasAppendingLinkage() || (GV.getName() == "main") ||
+          (!hasMain && !GV.hasLocalLinkage())) {
+        roots.push_back(graph.getNode(GV));
+      }
+    }
+  }
+  // the symbols called or referenced from outside the modules
+  if (entries) {
+    auto addRoot = [&graph, &roots](StringRef name) {
+      int n = graph.findNode(name);
+      if (n >= 0) {
+        roots.push_back(n);
+      }
+    };
+    for (auto FH : make_range(entries->begin(), entries->end())) {
+      addRoot(FH);
+    }
+    for (const std::string &ref : entries->references()) {
+      addRoot(ref);
+    }
+  }
+  BitVector reachable = graph.reachable(roots);
+
+  // -- write the symbols sorted by name
+  std::vector<Symbol> &symbols = graph.symbols;
+  std::sort(symbols.begin(), symbols.end(),
+            [](const Symbol &a, const Symbol &b) { return a.name < b.name; });
+
+  const unsigned words = (modules.size() + 63) / 64;
+  StringPool pool;
+  std::vector<StrEntry> moduleEntries;
+  for (Module *M : modules) {
+    moduleEntries.push_back(pool.add(M->getModuleIdentifier()));
+  }
+  std::vector<SymbolEntry> symbolEntries;
+  std::vector<uint64_t> defs, refs;
+  symbolEntries.reserve(symbols.size());
+  for (const Symbol &sym : symbols) {
+    SymbolEntry s;
+    s.name = pool.add(sym.name);
+    s.flags = (reachable.test(sym.node) ? Reachable : 0) |
+              (sym.address_taken ? AddressTaken : 0);
+    s.reserved = 0;
+    symbolEntries.push_back(s);
+    appendWords(sym.defs, words, defs);
+    appendWords(sym.refs, words, refs);
+  }
+
+  Header h;
+  std::memcpy(h.magic, Magic, sizeof(Magic));
+  h.version = Version;
+  h.num_modules = moduleEntries.size();
+  h.num_symbols = symbolEntries.size();
+  h.words = words;
+  h.strings_size = pool.data().size();
+  h.reserved = 0;
+
+  o.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  writeArray(o, moduleEntries);
+  writeArray(o, symbolEntries);
+  writeArray(o, defs);
+  writeArray(o, refs);
+  o << pool.data();
+}
+
+} // end namespace previrt
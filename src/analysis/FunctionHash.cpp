@@ -0,0 +1,216 @@
+#include "analysis/FunctionHash.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MD5.h"
+
+namespace previrt {
+namespace analysis {
+
+using namespace llvm;
+
+namespace {
+class FunctionHasher {
+  MD5 Hasher;
+  DenseMap<const Value *, uint64_t> Numbers;
+
+  void add(uint64_t N) {
+    Hasher.update(
+        ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&N), sizeof(N)));
+  }
+
+  void add(StringRef S) {
+    add(S.size());
+    Hasher.update(S);
+  }
+
+  void add(const APInt &V) {
+    add(V.getBitWidth());
+    for (unsigned i = 0, e = V.getNumWords(); i != e; ++i)
+      add(V.getRawData()[i]);
+  }
+
+  void addType(Type *Ty) {
+    add(Ty->getTypeID());
+    if (auto *ITy = dyn_cast<IntegerType>(Ty)) {
+      add(ITy->getBitWidth());
+    } else if (auto *STy = dyn_cast<StructType>(Ty)) {
+      if (STy->hasName()) {
+        add(STy->getName());
+        return;
+      }
+      add(STy->getNumElements());
+      for (Type *ETy : STy->elements())
+        addType(ETy);
+    } else {
+      add(Ty->getNumContainedTypes());
+      for (Type *ETy : Ty->subtypes())
+        addType(ETy);
+    }
+  }
+
+  void addValue(const Value *V) {
+    auto It = Numbers.find(V);
+    if (It != Numbers.end()) {
+      add(0);
+      add(It->second);
+    } else if (auto *GV = dyn_cast<GlobalValue>(V)) {
+      add(1);
+      add(GV->getName());
+    } else if (auto *CI = dyn_cast<ConstantInt>(V)) {
+      add(2);
+      add(CI->getValue());
+    } else if (auto *CFP = dyn_cast<ConstantFP>(V)) {
+      add(3);
+      add(CFP->getValueAPF().bitcastToAPInt());
+    } else if (auto *CDS = dyn_cast<ConstantDataSequential>(V)) {
+      add(4);
+      add(CDS->getRawDataValues());
+    } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+      add(5);
+      add(CE->getOpcode());
+      addType(CE->getType());
+      for (const Value *Op : CE->operand_values())
+        addValue(Op);
+    } else if (auto *CA = dyn_cast<ConstantAggregate>(V)) {
+      add(6);
+      addType(CA->getType());
+      for (const Value *Op : CA->operand_values())
+        addValue(Op);
+    } else {
+      add(7);
+      add(V->getValueID());
+      addType(V->getType());
+    }
+  }
+
+public:
+  uint64_t hash(const Function &F) {
+    uint64_t N = 0;
+    for (const Argument &A : F.args())
+      Numbers[&A] = N++;
+    for (const BasicBlock &BB : F) {
+      Numbers[&BB] = N++;
+      for (const Instruction &I : BB)
+        Numbers[&I] = N++;
+    }
+
+    addType(F.getFunctionType());
+    add(F.getLinkage());
+    for (const BasicBlock &BB : F) {
+      add(BB.size());
+      for (const Instruction &I : BB) {
+        add(I.getOpcode());
+        addType(I.getType());
+        if (auto *CI = dyn_cast<CmpInst>(&I))
+          add(CI->getPredicate());
+        else if (auto *AI = dyn_cast<AllocaInst>(&I))
+          addType(AI->getAllocatedType());
+        else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I))
+          addType(GEP->getSourceElementType());
+        else if (auto *LI = dyn_cast<LoadInst>(&I))
+          add(LI->isVolatile());
+        else if (auto *SI = dyn_cast<StoreInst>(&I))
+          add(SI->isVolatile());
+        add(I.getNumOperands());
+        for (const Value *Op : I.operand_values())
+          addValue(Op);
+      }
+    }
+
+    MD5::MD5Result Result;
+    Hasher.final(Result);
+    return Result.low();
+  }
+
+  uint64_t hash(const GlobalVariable &GV) {
+    addType(GV.getValueType());
+    add(GV.getLinkage());
+    add(GV.isConstant());
+    add(GV.hasInitializer());
+    if (GV.hasInitializer())
+      addValue(GV.getInitializer());
+    // IPDSE marks the initializers that are never read and IPSCCP
+    // relies on it so this metadata is part of the hash.
+    add(GV.getMetadata("ipdse.useless_initializer") != nullptr);
+
+    MD5::MD5Result Result;
+    Hasher.final(Result);
+    return Result.low();
+  }
+};
+} // end anonymous namespace
+
+uint64_t hashFunction(const Function &F) { return FunctionHasher().hash(F); }
+
+uint64_t hashModule(const Module &M) {
+  MD5 Hasher;
+  auto update = [&Hasher](StringRef Name, uint64_t Hash) {
+    Hasher.update(Name);
+    Hasher.update(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&Hash),
+                                    sizeof(Hash)));
+  };
+  for (const GlobalVariable &GV : M.globals())
+    update(GV.getName(), FunctionHasher().hash(GV));
+  for (const Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    update(F.getName(), hashFunction(F));
+  }
+  MD5::MD5Result Result;
+  Hasher.final(Result);
+  return Result.low();
+}
+
+static Optional<uint64_t> getHash(const MDNode *N) {
+  if (N && N->getNumOperands() == 1)
+    if (auto *C = mdconst::dyn_extract<ConstantInt>(N->getOperand(0)))
+      return C->getZExtValue();
+  return None;
+}
+
+static MDNode *makeHash(LLVMContext &Ctx, uint64_t Hash) {
+  Metadata *Op =
+      ConstantAsMetadata::get(ConstantInt::get(Type::getInt64Ty(Ctx), Hash));
+  return MDNode::get(Ctx, Op);
+}
+
+Optional<uint64_t> getRecordedHash(const Function &F, StringRef Kind) {
+  return getHash(F.getMetadata(Kind));
+}
+
+void recordHash(Function &F, StringRef Kind, uint64_t Hash) {
+  F.setMetadata(Kind, makeHash(F.getContext(), Hash));
+}
+
+Optional<uint64_t> getRecordedHash(const Module &M, StringRef Kind) {
+  if (NamedMDNode *NMD = M.getNamedMetadata(Kind))
+    if (NMD->getNumOperands() == 1)
+      return getHash(NMD->getOperand(0));
+  return None;
+}
+
+void recordHash(Module &M, StringRef Kind, uint64_t Hash) {
+  NamedMDNode *NMD = M.getOrInsertNamedMetadata(Kind);
+  NMD->clearOperands();
+  NMD->addOperand(makeHash(M.getContext(), Hash));
+}
+
+bool ModuleHashPass::runOnModule(Module &M) {
+  m_hash = hashModule(M);
+  return false;
+}
+
+char ModuleHashPass::ID = 0;
+
+} // end namespace analysis
+} // end namespace previrt
+
+static llvm::RegisterPass<previrt::analysis::ModuleHashPass>
+    X("Pmodule-hash", "Compute the content hash of the module", false, true);
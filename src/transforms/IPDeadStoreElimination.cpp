@@ -8,12 +8,31 @@
       no use. If yes, the store is dead and it can be safely
       removed. We also identify useless global initializers.
 
+      Whether the memory defined by a shadow.mem instruction reaches
+      a use is memoized. It is computed with Tarjan's algorithm on
+      the def-use graph so that the nodes of a cycle (e.g., PHI nodes
+      of a loop or recursive functions) share the same answer. Thus,
+      the whole step is linear in the size of the def-use graph.
+
+      If -ipdse-only-singleton=false, stores to regions that are not
+      singletons are also considered. A store to such a region is a
+      weak update so the def-use chain continues through it. The
+      store is only a candidate if the stored object (an alloca, a
+      malloc-like allocation or an internal global) never escapes to
+      code without shadow.mem instructions.
+
    3. Remove shadow.mem function calls.
 
 */
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -23,9 +42,9 @@
 #include "seadsa/InitializePasses.hh"
 #include "seadsa/ShadowMem.hh"
 
-#include <boost/functional/hash.hpp>
-#include <boost/unordered_set.hpp>
+#include <algorithm>
 
+#include "analysis/FunctionHash.h"
 #include "analysis/MemorySSA.h"
 
 static llvm::cl::opt<bool>
@@ -35,10 +54,12 @@ OnlySingleton(
         "IP DSE: remove store only if operand is a singleton global var"),
     llvm::cl::Hidden, llvm::cl::init(true));
 
-static llvm::cl::opt<unsigned>
-MaxLenDefUse("ipdse-max-def-use",
-    llvm::cl::desc("IP DSE: maximum length of the def-use chain"),
-    llvm::cl::Hidden, llvm::cl::init(UINT_MAX));
+static llvm::cl::opt<bool>
+SkipUnchanged(
+    "ipdse-skip-unchanged",
+    llvm::cl::desc(
+        "IP DSE: do nothing if no function changed since the last run"),
+    llvm::cl::Hidden, llvm::cl::init(false));
 
 //#define DSE_LOG(...) __VA_ARGS__
 #define DSE_LOG(...)
@@ -49,6 +70,10 @@ namespace transforms {
 using namespace llvm;
 using namespace analysis;
 
+// Hash of the module as left by the last run of the pass (see
+// analysis/FunctionHash.h)
+static const char *IPDSEHashMD = "occam.ipdse.hash";
+
 static bool hasFunctionPtrParam(Function *F) {
   FunctionType *FTy = F->getFunctionType();
   for (unsigned i = 0, e = FTy->getNumParams(); i < e; ++i) {
@@ -63,50 +88,10 @@ static bool hasFunctionPtrParam(Function *F) {
 
 class IPDeadStoreElimination : public ModulePass {
 
-  struct QueueElem {
-    // Last shadow mem instruction related to storeInstOrGvInit
-    const Instruction *shadowMemInst;
-    // The original instruction that we want to remove if we can prove
-    // it is redundant.
-    Value *storeInstOrGvInit;
-    // Number of steps (i.e., shadow mem instructions connect them)
-    // between storeInstOrGvInit and shadowMemInst
-    unsigned length;
-
-    QueueElem(const Instruction *I, Value *V, unsigned Len)
-        : shadowMemInst(I), storeInstOrGvInit(V), length(Len) {}
-
-    size_t hash() const {
-      size_t val = 0;
-      boost::hash_combine(val, shadowMemInst);
-      boost::hash_combine(val, storeInstOrGvInit);
-      return val;
-    }
-
-    bool operator==(const QueueElem &o) const {
-      return (shadowMemInst == o.shadowMemInst &&
-              storeInstOrGvInit == o.storeInstOrGvInit);
-    }
-
-    void write(raw_ostream &o) const {
-      o << "(" << *shadowMemInst << ", " << *storeInstOrGvInit << ")";
-    }
-
-    friend raw_ostream &operator<<(raw_ostream &o, const QueueElem &e) {
-      e.write(o);
-      return o;
-    }
-  };
-
-  struct QueueElemHasher {
-    size_t operator()(const QueueElem &e) const { return e.hash(); }
-  };
-
-
-  template <class Q, class QE> inline void enqueue(Q &queue, QE e) {
-    DSE_LOG(errs() << "\tEnqueued " << e << "\n");
-    queue.push_back(e);
-  }
+  // A shadow.mem instruction from which we start to look for uses
+  // together with the store or global initializer that we want to
+  // remove.
+  typedef std::pair<const Instruction *, Value *> Root;
 
   // Map a store instruction into a boolean. If true then the
   // instruction cannot be deleted.
@@ -147,7 +132,375 @@ class IPDeadStoreElimination : public ModulePass {
     }
     return nullptr;
   }
-  
+
+  // Compute the successors of the shadow.mem instruction N in the
+  // def-use graph, i.e., the shadow.mem instructions whose uses must
+  // be also checked. Return true if the memory defined by N may be
+  // read, in which case Succs is not filled.
+  bool getSuccessors(const Instruction *N, MemorySSACallsManager &MMan,
+                     SmallVectorImpl<const Instruction *> &Succs) {
+    if (hasMemSSALoadUser(N, OnlySingleton)) {
+      DSE_LOG(errs() << "\thas a load user: CANNOT be removed.\n");
+      return true;
+    }
+
+    for (auto &U : N->uses()) {
+      Instruction *I = dyn_cast<Instruction>(U.getUser());
+      if (!I)
+        continue;
+      DSE_LOG(errs() << "\tChecking user " << *I << "\n");
+
+      if (PHINode *PHI = dyn_cast<PHINode>(I)) {
+        DSE_LOG(errs() << "\tPHI node: adding lhs\n");
+        Succs.push_back(PHI);
+      } else if (isa<CallInst>(I)) {
+        ImmutableCallSite CS(I);
+        if (!CS.getCalledFunction())
+          continue;
+        if (isMemSSAStore(CS, OnlySingleton)) {
+          if (isMemSSAStore(CS, true)) {
+            // A singleton region is a scalar so the store overwrites
+            // it completely.
+            DSE_LOG(errs() << "\tstore: skipped\n");
+          } else {
+            // The store may write a different location of the region
+            // so the old content can still be read through the new
+            // version.
+            DSE_LOG(errs() << "\tweak store: adding lhs\n");
+            Succs.push_back(I);
+          }
+          continue;
+        } else if (isMemSSAArgRef(CS, OnlySingleton)) {
+          DSE_LOG(errs() << "\targ ref: CANNOT be removed\n");
+          return true;
+        } else if (isMemSSAArgMod(CS, OnlySingleton) ||
+                   isMemSSAArgRefMod(CS, OnlySingleton)) {
+          DSE_LOG(errs() << "\tRecurse inter-procedurally in the callee\n");
+          // Inter-procedural step: we recurse on the uses of
+          // the corresponding formal (non-primed) variable in
+          // the callee.
+
+          int64_t idx = getMemSSAParamIdx(CS);
+          if (idx < 0) {
+            report_fatal_error(
+                "[IPDSE] cannot find index in shadow.mem function");
+          }
+          // HACK: find the actual callsite associated with
+          // shadow.mem.arg.ref_mod(...)
+          const Function *calleeF = findCalledFunction(CS);
+          if (!calleeF) {
+            report_fatal_error(
+                "[IPDSE] cannot find callee with shadow.mem.XXX function");
+          }
+          const MemorySSAFunction *MemSsaFun = MMan.getFunction(calleeF);
+          if (!MemSsaFun) {
+            report_fatal_error("[IPDSE] cannot find MemorySSAFunction");
+          }
+
+          if (MemSsaFun->getNumInFormals() == 0) {
+            // Probably the function has only shadow.mem.arg.init
+            errs() << "TODO: unexpected case function without "
+                      "shadow.mem.in.\n";
+            return true;
+          }
+
+          const Value *calleeInitArgV = MemSsaFun->getInFormal(idx);
+          if (!calleeInitArgV) {
+            report_fatal_error("[IPDSE] getInFormal returned nullptr");
+          }
+
+          if (const Instruction *calleeInitArg =
+                  dyn_cast<const Instruction>(calleeInitArgV)) {
+            Succs.push_back(calleeInitArg);
+          } else {
+            report_fatal_error("[IPDSE] expected to enqueue from callee");
+          }
+
+        } else if (isMemSSAFunIn(CS, OnlySingleton)) {
+          DSE_LOG(errs() << "\tin: skipped\n");
+          // do nothing
+        } else if (isMemSSAFunOut(CS, OnlySingleton)) {
+          DSE_LOG(errs() << "\tRecurse inter-procedurally in the caller\n");
+          // Inter-procedural step: we recurse on the uses of
+          // the corresponding actual (primed) variable in the
+          // caller.
+
+          int64_t idx = getMemSSAParamIdx(CS);
+          if (idx < 0) {
+            report_fatal_error(
+                "[IPDSE] cannot find index in shadow.mem function");
+          }
+
+          // Find callers
+          Function *F = I->getParent()->getParent();
+          for (auto &U : F->uses()) {
+            if (CallInst *CI = dyn_cast<CallInst>(U.getUser())) {
+              const MemorySSACallSite *MemSsaCS = MMan.getCallSite(CI);
+              if (!MemSsaCS) {
+                report_fatal_error("[IPDSE] cannot find MemorySSACallSite");
+              }
+
+              // make things easier ...
+              CallSite CS(CI);
+              assert(CS.getCalledFunction());
+              if (hasFunctionPtrParam(CS.getCalledFunction())) {
+                return true;
+              }
+
+              if (idx >= MemSsaCS->numParams()) {
+                // It's possible that the function has formal
+                // parameters but the call site does not have actual
+                // parameters. E.g., llvm can remove the return
+                // parameter from the callsite if it's not used.
+                errs() << "TODO: unexpected case of callsite with no "
+                          "actual parameters.\n";
+                return true;
+              }
+
+              if (OnlySingleton) {
+                if ((!MemSsaCS->isRefMod(idx)) && (!MemSsaCS->isMod(idx)) &&
+                    (!MemSsaCS->isNew(idx))) {
+                  // XXX: if OnlySingleton then isRefMod, isMod, and
+                  // isNew can only return true if the corresponding
+                  // memory region is a singleton. We saw cases
+                  // (e.g., curl) where we start from store to a
+                  // singleton region but after following its
+                  // def-use chain we end up having other shadow.mem
+                  // instructions that do not correspond to a
+                  // singleton region. This is a sea-dsa issue. For
+                  // now, we play conservative and give up by
+                  // keeping the store.
+                  return true;
+                }
+              }
+
+              assert(OnlySingleton || MemSsaCS->isRefMod(idx) ||
+                     MemSsaCS->isMod(idx) || MemSsaCS->isNew(idx));
+              if (const Instruction *caller_primed =
+                      dyn_cast<const Instruction>(MemSsaCS->getPrimed(idx))) {
+                Succs.push_back(caller_primed);
+              } else {
+                report_fatal_error("[IPDSE] expected to enqueue from caller");
+              }
+            }
+          }
+        } else {
+          errs() << "Warning: unexpected case during worklist processing "
+                 << *I << "\n";
+        }
+      }
+    }
+    return false;
+  }
+
+  // Memoized answer of isOnlyAccessedByInstrumentedCode.
+  DenseMap<const Value *, bool> m_instrumentedOnly;
+
+  // Return true if Obj is a stack, heap or internal global object
+  // whose address never leaves the code instrumented by ShadowMem:
+  // it is not stored in memory, converted to an integer, or passed to
+  // external functions. Then, all the reads of Obj are
+  // shadow.mem.load's of its regions, even if the sea-dsa nodes of
+  // these regions are not singletons.
+  bool isOnlyAccessedByInstrumentedCode(const Value *Obj) {
+    auto it = m_instrumentedOnly.find(Obj);
+    if (it != m_instrumentedOnly.end()) {
+      return it->second;
+    }
+    bool res = false;
+    if (isa<AllocaInst>(Obj) || isNoAliasCall(Obj)) {
+      res = !mayEscape(Obj);
+    } else if (const GlobalVariable *GV = dyn_cast<GlobalVariable>(Obj)) {
+      res = GV->hasLocalLinkage() && !mayEscape(GV);
+    }
+    m_instrumentedOnly[Obj] = res;
+    return res;
+  }
+
+  // Return true if the declaration callee can receive a pointer
+  // without accessing or capturing it.
+  static bool isHarmlessLibCall(const CallInst &CI, const Function &callee) {
+    if (callee.getName() == "free") {
+      return true;
+    }
+    // a readnone function cannot access the pointer and it cannot
+    // return it either
+    return callee.doesNotAccessMemory() && !CI.getType()->isPointerTy();
+  }
+
+  // Return true if the pointers derived from Obj (also through
+  // arguments and return values of internal functions) may be
+  // accessed by code without shadow.mem.
+  static bool mayEscape(const Value *Obj) {
+    SmallVector<const Value *, 16> worklist;
+    SmallPtrSet<const Value *, 16> visited;
+    auto push = [&](const Value *V) {
+      if (visited.insert(V).second) {
+        worklist.push_back(V);
+      }
+    };
+
+    push(Obj);
+    while (!worklist.empty()) {
+      const Value *V = worklist.pop_back_val();
+      for (const Use &U : V->uses()) {
+        const User *user = U.getUser();
+        if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(user)) {
+          if (CE->getOpcode() != Instruction::GetElementPtr &&
+              CE->getOpcode() != Instruction::BitCast) {
+            return true;
+          }
+          push(CE);
+        } else if (isa<GetElementPtrInst>(user) || isa<BitCastInst>(user) ||
+                   isa<PHINode>(user) || isa<SelectInst>(user)) {
+          push(user);
+        } else if (isa<LoadInst>(user) || isa<ICmpInst>(user)) {
+          continue;
+        } else if (const StoreInst *SI = dyn_cast<StoreInst>(user)) {
+          if (SI->getValueOperand() == V) {
+            return true; // the address is stored in memory
+          }
+        } else if (const ReturnInst *RI = dyn_cast<ReturnInst>(user)) {
+          const Function *F = RI->getFunction();
+          if (!F->hasLocalLinkage()) {
+            return true; // F can be called from other modules
+          }
+          for (const Use &FU : F->uses()) {
+            ImmutableCallSite CS(FU.getUser());
+            if (!CS || !CS.isCallee(&FU)) {
+              return true;
+            }
+            push(CS.getInstruction());
+          }
+        } else if (const CallInst *CI = dyn_cast<CallInst>(user)) {
+          ImmutableCallSite CS(CI);
+          const Function *callee = CS.getCalledFunction();
+          if (!callee || CS.isCallee(&U)) {
+            return true;
+          }
+          if (callee->getName().startswith("shadow.mem") ||
+              isa<DbgInfoIntrinsic>(CI) ||
+              callee->getIntrinsicID() == Intrinsic::lifetime_start ||
+              callee->getIntrinsicID() == Intrinsic::lifetime_end) {
+            continue;
+          }
+          if (const MemIntrinsic *MI = dyn_cast<MemIntrinsic>(CI)) {
+            // Only writes through memset/memcpy/memmove destinations
+            // are allowed.
+            if (MI->getRawDest() == V && (isa<MemSetInst>(MI) ||
+                                          MI->getOperand(1) != V)) {
+              continue;
+            }
+            return true;
+          }
+          if (!CI->isArgOperand(&U)) {
+            return true;
+          }
+          if (callee->isDeclaration()) {
+            if (isHarmlessLibCall(*CI, *callee)) {
+              continue;
+            }
+            return true;
+          }
+          if (callee->isVarArg() || !callee->hasLocalLinkage()) {
+            // a non-local definition can be replaced at link time
+            return true;
+          }
+          push(callee->arg_begin() + CI->getArgOperandNo(&U));
+        } else {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Memoized answer for each shadow.mem instruction: true if the
+  // memory it defines may reach a use.
+  DenseMap<const Instruction *, bool> m_reachesUse;
+
+  // State of Tarjan's algorithm, shared by all the calls to reachesUse
+  // so that each node is visited once.
+  struct TarjanFrame {
+    const Instruction *node;
+    SmallVector<const Instruction *, 4> succs;
+    unsigned next;
+  };
+  struct TarjanInfo {
+    unsigned index;
+    unsigned lowLink;
+    // Whether the node or any of its successors visited so far
+    // reaches a use.
+    bool reachesUse;
+  };
+  DenseMap<const Instruction *, TarjanInfo> m_tarjanInfo;
+  std::vector<const Instruction *> m_tarjanStack;
+
+  // Return true if the memory defined by the shadow.mem instruction
+  // Start may reach a use.
+  bool reachesUse(const Instruction *Start, MemorySSACallsManager &MMan) {
+    auto it = m_reachesUse.find(Start);
+    if (it != m_reachesUse.end()) {
+      return it->second;
+    }
+
+    std::vector<TarjanFrame> callStack;
+    auto visit = [&](const Instruction *N) {
+      DSE_LOG(errs() << "[IPDSE] Processing " << *N << "\n");
+      unsigned index = m_tarjanInfo.size();
+      TarjanFrame frame;
+      frame.node = N;
+      frame.next = 0;
+      bool local = getSuccessors(N, MMan, frame.succs);
+      m_tarjanInfo[N] = {index, index, local};
+      m_tarjanStack.push_back(N);
+      callStack.push_back(std::move(frame));
+    };
+
+    visit(Start);
+    while (!callStack.empty()) {
+      TarjanFrame &frame = callStack.back();
+      const Instruction *N = frame.node;
+      if (frame.next < frame.succs.size()) {
+        const Instruction *S = frame.succs[frame.next++];
+        auto done = m_reachesUse.find(S);
+        if (done != m_reachesUse.end()) {
+          m_tarjanInfo[N].reachesUse |= done->second;
+        } else if (!m_tarjanInfo.count(S)) {
+          visit(S); // invalidates frame
+        } else {
+          // S is in the stack so it is in the same SCC as N
+          TarjanInfo &info = m_tarjanInfo[N];
+          info.lowLink = std::min(info.lowLink, m_tarjanInfo[S].index);
+        }
+        continue;
+      }
+
+      callStack.pop_back();
+      TarjanInfo info = m_tarjanInfo[N];
+      if (info.lowLink == info.index) {
+        // N is the root of an SCC: all its nodes share the answer.
+        size_t first = m_tarjanStack.size();
+        bool res = false;
+        do {
+          --first;
+          res |= m_tarjanInfo[m_tarjanStack[first]].reachesUse;
+        } while (m_tarjanStack[first] != N);
+        for (size_t i = first, e = m_tarjanStack.size(); i < e; ++i) {
+          m_reachesUse[m_tarjanStack[i]] = res;
+        }
+        m_tarjanStack.resize(first);
+        info.reachesUse = res;
+      }
+      if (!callStack.empty()) {
+        TarjanInfo &parent = m_tarjanInfo[callStack.back().node];
+        parent.lowLink = std::min(parent.lowLink, info.lowLink);
+        parent.reachesUse |= info.reachesUse;
+      }
+    }
+    return m_reachesUse[Start];
+  }
+
 public:
   static char ID;
 
@@ -163,19 +516,42 @@ public:
       return false;
     }
 
+    // The stores that survived the last run are still needed if no
+    // function changed since then: removing dead stores cannot make
+    // other stores dead. The code is already instrumented by
+    // ShadowMemPass so the hash of the input is computed before it.
+    if (SkipUnchanged) {
+      uint64_t Hash = getAnalysis<ModuleHashPass>().getHash();
+      Optional<uint64_t> Recorded = getRecordedHash(M, IPDSEHashMD);
+      if (Recorded && *Recorded == Hash) {
+        errs() << "Skipped interprocedural dead store elimination: "
+               << "no function changed since the last run\n";
+        seadsa::StripShadowMemPass SSMP;
+        SSMP.runOnModule(M);
+        return false;
+      }
+    }
+
     errs() << "Started interprocedural dead store elimination...\n";
     
     // Populate worklist
     
     // --- collect all shadow.mem store instructions
-    std::vector<QueueElem> queue;
+    std::vector<Root> queue;
     for (auto &F : M) {
       for (auto &I : instructions(&F)) {
         if (isMemSSAStore(&I, OnlySingleton)) {
           auto it = I.getIterator();
           ++it;
           if (StoreInst *SI = dyn_cast<StoreInst>(&*it)) {
-            queue.push_back(QueueElem(&I, SI, 0));
+            if (!isMemSSAStore(&I, true) &&
+                !isOnlyAccessedByInstrumentedCode(GetUnderlyingObject(
+                    SI->getPointerOperand(), M.getDataLayout()))) {
+              // The region is not a singleton and the stored object
+              // might be read by code without shadow.mem.
+              continue;
+            }
+            queue.push_back(Root(&I, SI));
             // All the store instructions will be removed unless the
             // opposite is proven.
             markToRemove(SI);
@@ -197,7 +573,7 @@ public:
 	      (dyn_cast<const GlobalVariable>
 	       (getMemSSASingleton(CS, MemSSAOp::MEM_SSA_ARG_INIT)))) {
 	    if (GV->hasInitializer()) {
-	      queue.push_back(QueueElem(&I, GV, 0));
+	      queue.push_back(Root(&I, GV));
 	      // All the global initializers will be removed unless the
 	      // opposite is proven.
 	      markToRemove(GV);
@@ -209,205 +585,25 @@ public:
 
     // Process worklist
 
-    // TODO: we need to improve performance by caching intermediate
-    // queries. In particular, we need to remember PHI nodes and
-    // function parameters.
-    
     unsigned numUselessStores = 0;
     unsigned numUselessGvInit = 0;    
-    unsigned skippedChains = 0;    
     if (!queue.empty()) {
       errs() << "Number of stores: " << queue.size() << "\n";
       MemorySSACallsManager MMan(M, *this, OnlySingleton);
 
-      DSE_LOG(errs() << "[IPDSE] BEGIN initial queue: \n"; for (auto &e
-                                                                 : queue) {
-        errs() << e << "\n";
-      } errs() << "[IPDSE] END initial queue\n";);
-
       // A store is not useless if there is a def-use chain between a
       // store and a load instruction and there is not any other store
       // in between.
-      boost::unordered_set<QueueElem, QueueElemHasher> visited;
-      while (!queue.empty()) {
-        QueueElem w = queue.back();
-        DSE_LOG(errs() << "[IPDSE] Processing " << *(w.shadowMemInst)
-                       << "\n");
-        queue.pop_back();
-
-        if (!visited.insert(w).second) {
-	  // this is not necessarily a cycle
-	  DSE_LOG(errs() << "\tAlready processed: skipped\n";);
-          continue;
-        }
-
-        if (hasMemSSALoadUser(w.shadowMemInst, OnlySingleton)) {
-          DSE_LOG(errs() << "\thas a load user: CANNOT be removed.\n");
-          markToKeep(w.storeInstOrGvInit);
-          continue;
-        }
-	
-        if (w.length == MaxLenDefUse) {
-          skippedChains++;
-          markToKeep(w.storeInstOrGvInit);
-          continue;
-        }
-
-	// w.storeInstOrGvInit is not useless if any of its direct or
-	// indirect uses say it is not useless.
-        for (auto &U : w.shadowMemInst->uses()) {
-	  
-	  if (m_valueMap[w.storeInstOrGvInit]) {
-	    // Do not bother with the rest of uses if one already said
-	    // that the store or global initializer is not useless.
-	    break;
-	  }
-	  
-          Instruction *I = dyn_cast<Instruction>(U.getUser());
-          if (!I)
-            continue;
-          DSE_LOG(errs() << "\tChecking user " << *I << "\n");
-
-          if (PHINode *PHI = dyn_cast<PHINode>(I)) {
-            DSE_LOG(errs() << "\tPHI node: enqueuing lhs\n");
-            enqueue(queue, QueueElem(PHI, w.storeInstOrGvInit, w.length + 1));
-          } else if (isa<CallInst>(I)) {
-            ImmutableCallSite CS(I);
-            if (!CS.getCalledFunction())
-              continue;
-            if (isMemSSAStore(CS, OnlySingleton)) {
-              DSE_LOG(errs() << "\tstore: skipped\n");
-              continue;
-            } else if (isMemSSAArgRef(CS, OnlySingleton)) {
-              DSE_LOG(errs() << "\targ ref: CANNOT be removed\n");
-              markToKeep(w.storeInstOrGvInit);
-            } else if (isMemSSAArgMod(CS, OnlySingleton) || 
-		       isMemSSAArgRefMod(CS, OnlySingleton)) {
-              DSE_LOG(errs() << "\tRecurse inter-procedurally in the callee\n");
-              // Inter-procedural step: we recurse on the uses of
-              // the corresponding formal (non-primed) variable in
-              // the callee.
-
-              int64_t idx = getMemSSAParamIdx(CS);
-              if (idx < 0) {
-                report_fatal_error(
-                    "[IPDSE] cannot find index in shadow.mem function");
-              }
-              // HACK: find the actual callsite associated with
-              // shadow.mem.arg.ref_mod(...)
-              const Function *calleeF = findCalledFunction(CS);
-              if (!calleeF) {
-                report_fatal_error(
-                    "[IPDSE] cannot find callee with shadow.mem.XXX function");
-              }
-              const MemorySSAFunction *MemSsaFun = MMan.getFunction(calleeF);
-              if (!MemSsaFun) {
-                report_fatal_error("[IPDSE] cannot find MemorySSAFunction");
-              }
-
-              if (MemSsaFun->getNumInFormals() == 0) {
-                // Probably the function has only shadow.mem.arg.init
-                errs() << "TODO: unexpected case function without "
-                          "shadow.mem.in.\n";
-                markToKeep(w.storeInstOrGvInit);
-                continue;
-              }
-
-              const Value *calleeInitArgV = MemSsaFun->getInFormal(idx);
-              if (!calleeInitArgV) {
-                report_fatal_error("[IPDSE] getInFormal returned nullptr");
-              }
-
-              if (const Instruction *calleeInitArg =
-                      dyn_cast<const Instruction>(calleeInitArgV)) {
-                enqueue(queue,
-                        QueueElem(calleeInitArg, w.storeInstOrGvInit, w.length + 1));
-              } else {
-                report_fatal_error("[IPDSE] expected to enqueue from callee");
-              }
-
-            } else if (isMemSSAFunIn(CS, OnlySingleton)) {
-              DSE_LOG(errs() << "\tin: skipped\n");
-              // do nothing
-            } else if (isMemSSAFunOut(CS, OnlySingleton)) {
-              DSE_LOG(errs() << "\tRecurse inter-procedurally in the caller\n");
-              // Inter-procedural step: we recurse on the uses of
-              // the corresponding actual (primed) variable in the
-              // caller.
-
-              int64_t idx = getMemSSAParamIdx(CS);
-              if (idx < 0) {
-                report_fatal_error(
-                    "[IPDSE] cannot find index in shadow.mem function");
-              }
-
-              // Find callers
-              Function *F = I->getParent()->getParent();
-              for (auto &U : F->uses()) {
-                if (CallInst *CI = dyn_cast<CallInst>(U.getUser())) {
-                  const MemorySSACallSite *MemSsaCS = MMan.getCallSite(CI);
-                  if (!MemSsaCS) {
-                    report_fatal_error(
-                        "[IPDSE] cannot find MemorySSACallSite");
-                  }
-
-                  // make things easier ...
-                  CallSite CS(CI);
-                  assert(CS.getCalledFunction());
-                  if (hasFunctionPtrParam(CS.getCalledFunction())) {
-                    markToKeep(w.storeInstOrGvInit);
-                    continue;
-                  }
-
-                  if (idx >= MemSsaCS->numParams()) {
-                    // It's possible that the function has formal
-                    // parameters but the call site does not have actual
-                    // parameters. E.g., llvm can remove the return
-                    // parameter from the callsite if it's not used.
-                    errs() << "TODO: unexpected case of callsite with no "
-                              "actual parameters.\n";
-                    markToKeep(w.storeInstOrGvInit);
-                    break;
-                  }
-
-                  if (OnlySingleton) {
-                    if ((!MemSsaCS->isRefMod(idx)) && (!MemSsaCS->isMod(idx)) &&
-                        (!MemSsaCS->isNew(idx))) {
-                      // XXX: if OnlySingleton then isRefMod, isMod, and
-                      // isNew can only return true if the corresponding
-                      // memory region is a singleton. We saw cases
-                      // (e.g., curl) where we start from store to a
-                      // singleton region but after following its
-                      // def-use chain we end up having other shadow.mem
-                      // instructions that do not correspond to a
-                      // singleton region. This is a sea-dsa issue. For
-                      // now, we play conservative and give up by
-                      // keeping the store.
-                      markToKeep(w.storeInstOrGvInit);
-                      break;
-                    }
-                  }
-
-                  assert(OnlySingleton || MemSsaCS->isRefMod(idx) ||
-                         MemSsaCS->isMod(idx) || MemSsaCS->isNew(idx));
-                  if (const Instruction *caller_primed =
-                          dyn_cast<const Instruction>(
-                              MemSsaCS->getPrimed(idx))) {
-                    enqueue(queue, QueueElem(caller_primed, w.storeInstOrGvInit,
-                                             w.length + 1));
-                  } else {
-                    report_fatal_error(
-                        "[IPDSE] expected to enqueue from caller");
-                  }
-                }
-              }
-            } else {
-              errs() << "Warning: unexpected case during worklist processing "
-                     << *I << "\n";
-            }
-          }
+      for (auto &w : queue) {
+        if (reachesUse(w.first, MMan)) {
+          markToKeep(w.second);
         }
       }
+      errs() << "\tVisited " << m_tarjanInfo.size()
+             << " shadow.mem instructions\n";
+      m_reachesUse.clear();
+      m_tarjanInfo.clear();
+      m_instrumentedOnly.clear();
 
       // Finally, we remove dead instructions and useless global
       // initializers
@@ -434,8 +630,6 @@ public:
 
       errs() << "\tNumber of deleted stores " << numUselessStores << "\n";
       errs() << "\tNumber of useless global initializers " << numUselessGvInit << "\n";
-      errs() << "\tSkipped " << skippedChains
-             << " def-use chains because they were too long\n";
       errs() << "Finished ip-dse\n";
     }
 
@@ -444,11 +638,19 @@ public:
     seadsa::StripShadowMemPass SSMP;
     SSMP.runOnModule(M);
 
+    if (SkipUnchanged) {
+      recordHash(M, IPDSEHashMD, hashModule(M));
+    }
+
     return (numUselessStores > 0 || numUselessGvInit > 0);
   }
 
   virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesAll();
+    if (SkipUnchanged) {
+      // Must run before the code is instrumented
+      AU.addRequired<ModuleHashPass>();
+    }
     // Required to place shadow.mem.in and shadow.mem.out
     AU.addRequired<llvm::UnifyFunctionExitNodes>();    
     // This pass will instrument the code with shadow.mem calls
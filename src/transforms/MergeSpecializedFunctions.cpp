@@ -0,0 +1,204 @@
+/**
+ * Merge structurally identical functions created by OCCAM.
+ *
+ * Specialization (intra and inter-module) and devirtualization can
+ * produce many copies of the same function. After optimization, some
+ * of these copies become identical (e.g., the specialized constant
+ * only fed dead code). This pass hashes the body of each function
+ * created by OCCAM and merges the identical ones:
+ *
+ * - if the duplicate has local linkage and its address is not
+ *   significant (unnamed_addr or only called directly) then all its
+ *   uses are redirected to the canonical copy and the duplicate is
+ *   removed.
+ *
+ * - otherwise, the duplicate might be called from other modules or
+ *   its address might be compared so its body is replaced with a
+ *   thunk that calls the canonical copy.
+ *
+ * Only functions that are identical modulo the checks done by LLVM's
+ * FunctionComparator are merged.
+ **/
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+
+#include <vector>
+
+static llvm::cl::opt<bool> MergeAllFunctions(
+    "Pmerge-specialized-all", llvm::cl::Hidden, llvm::cl::init(false),
+    llvm::cl::desc("Consider all defined functions for merging, not only "
+                   "those created by OCCAM"));
+
+namespace previrt {
+namespace transforms {
+
+using namespace llvm;
+
+static const StringRef bounce_prefix = "__occam.bounce";
+static const StringRef spec_prefix = "__occam_spec.";
+
+class MergeSpecializedFunctions : public ModulePass {
+
+  static bool isCandidate(const Function &F) {
+    // Variadic functions cannot be forwarded by a thunk.
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage() ||
+        F.isInterposable() || F.isVarArg()) {
+      return false;
+    }
+    if (MergeAllFunctions) {
+      return true;
+    }
+    return F.getName().startswith(spec_prefix) ||
+           F.getName().startswith(bounce_prefix);
+  }
+
+  unsigned m_merged;
+  unsigned m_thunks;
+
+  // Replace the body of F with a call to G.
+  static void writeThunk(Function &F, Function &G) {
+    F.dropAllReferences();
+    while (!F.empty()) {
+      F.begin()->eraseFromParent();
+    }
+    BasicBlock *BB = BasicBlock::Create(F.getContext(), "entry", &F);
+    IRBuilder<> Builder(BB);
+    SmallVector<Value *, 8> Args;
+    for (Argument &A : F.args()) {
+      Args.push_back(&A);
+    }
+    CallInst *CI = Builder.CreateCall(&G, Args);
+    CI->setTailCall();
+    CI->setCallingConv(G.getCallingConv());
+    // Keep byval/sret/inreg and the other ABI attributes
+    CI->setAttributes(G.getAttributes());
+    ReturnInst *RI = nullptr;
+    if (F.getReturnType()->isVoidTy()) {
+      RI = Builder.CreateRetVoid();
+    } else {
+      RI = Builder.CreateRet(CI);
+    }
+    // The verifier rejects a call without location in a function
+    // with debug info.
+    if (DISubprogram *SP = F.getSubprogram()) {
+      DebugLoc DL =
+          DILocation::get(SP->getContext(), SP->getScopeLine(), 0, SP);
+      CI->setDebugLoc(DL);
+      RI->setDebugLoc(DL);
+    }
+  }
+
+  // Return true if the address of F cannot be observed.
+  static bool hasInsignificantAddress(const Function &F) {
+    return F.hasGlobalUnnamedAddr() || !F.hasAddressTaken();
+  }
+
+  // Merge Dup into Canonical. Return true if Dup was removed.
+  bool merge(Function &Canonical, Function &Dup) {
+    if (Dup.hasLocalLinkage() && hasInsignificantAddress(Dup)) {
+      errs() << "\tmerged " << Dup.getName() << " into "
+             << Canonical.getName() << "\n";
+      Dup.replaceAllUsesWith(&Canonical);
+      m_merged++;
+      return true;
+    } else {
+      errs() << "\t" << Dup.getName() << " is now a thunk to "
+             << Canonical.getName() << "\n";
+      writeThunk(Dup, Canonical);
+      m_thunks++;
+      return false;
+    }
+  }
+
+public:
+  static char ID;
+
+  MergeSpecializedFunctions() : ModulePass(ID), m_merged(0), m_thunks(0) {}
+
+  virtual bool runOnModule(Module &M) override {
+    // -- bucket candidates by the hash of their bodies
+    DenseMap<FunctionComparator::FunctionHash, std::vector<Function *>>
+        Buckets;
+    std::vector<FunctionComparator::FunctionHash> Order;
+    for (Function &F : M) {
+      if (!isCandidate(F)) {
+        continue;
+      }
+      FunctionComparator::FunctionHash H = FunctionComparator::functionHash(F);
+      auto &Bucket = Buckets[H];
+      if (Bucket.empty()) {
+        Order.push_back(H);
+      }
+      Bucket.push_back(&F);
+    }
+
+    // -- within each bucket, merge functions that are really identical
+    GlobalNumberState GlobalNumbers;
+    std::vector<Function *> ToErase;
+    for (FunctionComparator::FunctionHash H : Order) {
+      std::vector<Function *> &Bucket = Buckets[H];
+      if (Bucket.size() < 2) {
+        continue;
+      }
+      // Canonical representatives of the bucket. Since the hash is
+      // not perfect a bucket can have several classes.
+      std::vector<Function *> Classes;
+      for (Function *F : Bucket) {
+        Function *Canonical = nullptr;
+        for (Function *C : Classes) {
+          FunctionComparator FCmp(C, F, &GlobalNumbers);
+          if (FCmp.compare() == 0) {
+            Canonical = C;
+            break;
+          }
+        }
+        if (!Canonical) {
+          Classes.push_back(F);
+        } else if (merge(*Canonical, *F)) {
+          ToErase.push_back(F);
+        }
+      }
+    }
+
+    for (Function *F : ToErase) {
+      F->eraseFromParent();
+    }
+
+    bool Change = m_merged > 0 || m_thunks > 0;
+    if (Change) {
+      errs() << "Merged " << m_merged << " functions and created " << m_thunks
+             << " thunks.\n";
+      /// HACK: do not remove this line. The python code searches for it ...
+      errs() << "...progress...\n";
+    } else {
+      /// HACK: do not remove this line. The python code searches for it ...
+      errs() << "...no progress...\n";
+    }
+    return Change;
+  }
+
+  virtual StringRef getPassName() const override {
+    return "Merge identical specialized functions";
+  }
+};
+
+char MergeSpecializedFunctions::ID = 0;
+
+static RegisterPass<previrt::transforms::MergeSpecializedFunctions>
+    X("Pmerge-specialized",
+      "Merge identical functions created by specialization and devirtualization",
+      false, false);
+} // namespace transforms
+} // namespace previrt
@@ -21,12 +21,32 @@
 //   communicated to SCCP via metadata. The IPDSE (inter-procedural
 //   dead store elimination) pass detects when some global
 //   initializers are useless.
+// - Optionally (-Pipsccp-track-ranges), integer values that can take
+//   more than one constant are tracked as a ConstantRange instead of
+//   going to overdefined. Comparisons decided by the ranges are
+//   folded and infeasible switch cases are removed. To ensure
+//   termination, a value whose range has been extended more than
+//   -Pipsccp-range-widening-steps times goes to overdefined.
+// - Optionally (-Pipsccp-track-fields), the fields of aggregate or
+//   address-taken internal globals are tracked if sea-dsa shows that
+//   all the instructions that can write them are known.
+// - The solver visits the work lists in call graph SCC order (callees
+//   first) and in reverse post-order within each function, and keeps
+//   the state of arguments and instructions in per-function arrays.
+// - Optionally (-Pipsccp-incremental), only the functions that changed
+//   since the last run, their callers and their transitive callees,
+//   are solved.
+// - The transformation is split into a read-only planning phase that
+//   can run in parallel (-Pipsccp-threads) and a serial phase that
+//   modifies the IR.
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
-#include "llvm/ADT/DenseSet.h"
-#include "llvm/ADT/PointerIntPair.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
@@ -34,16 +54,23 @@
 #include "llvm/Analysis/ConstantFolding.h"
 #include "llvm/Analysis/GlobalsModRef.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/IR/ConstantRange.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/OptBisect.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/SCCP.h"
@@ -51,7 +78,17 @@
 #include "llvm/Transforms/Scalar/SCCP.h"
 #include "llvm/Transforms/Utils/Local.h"
 
+#include "analysis/FunctionHash.h"
+
+#include "seadsa/DsaAnalysis.hh"
+#include "seadsa/Global.hh"
+#include "seadsa/Graph.hh"
+#include "seadsa/InitializePasses.hh"
+
 #include <algorithm>
+#include <functional>
+#include <map>
+#include <queue>
 
 using namespace llvm;
 
@@ -61,6 +98,34 @@ STATISTIC(IPNumDeadBlocks, "Number of basic blocks unreachable by IPSCCP");
 STATISTIC(IPNumInstRemoved, "Number of instructions removed by IPSCCP");
 STATISTIC(IPNumArgsElimed, "Number of arguments constant propagated by IPSCCP");
 STATISTIC(IPNumGlobalConst, "Number of globals found to be constant by IPSCCP");
+STATISTIC(IPNumCasesRemoved,
+          "Number of infeasible switch cases removed by IPSCCP");
+STATISTIC(IPNumFieldsTracked,
+          "Number of fields of globals tracked by IPSCCP");
+
+static llvm::cl::opt<bool>
+    TrackRanges("Pipsccp-track-ranges", llvm::cl::init(false),
+                llvm::cl::desc("Track ranges of integer values in IPSCCP"));
+
+static llvm::cl::opt<unsigned> MaxWidenSteps(
+    "Pipsccp-range-widening-steps", llvm::cl::init(8), llvm::cl::Hidden,
+    llvm::cl::desc("Number of times the range of a value can be extended "
+                   "before it goes to overdefined"));
+
+static llvm::cl::opt<bool> Incremental(
+    "Pipsccp-incremental", llvm::cl::init(false),
+    llvm::cl::desc("Only solve the functions that changed since the last run "
+                   "of IPSCCP, their callers and their transitive callees"));
+
+static llvm::cl::opt<unsigned> Threads(
+    "Pipsccp-threads", llvm::cl::init(1), llvm::cl::Hidden,
+    llvm::cl::desc("Number of threads used to plan the IPSCCP transformation "
+                   "of the functions (0 means one per hardware thread)"));
+
+static llvm::cl::opt<bool> TrackFields(
+    "Pipsccp-track-fields", llvm::cl::init(false),
+    llvm::cl::desc("Track the fields of aggregate and address-taken globals "
+                   "in IPSCCP (requires sea-dsa)"));
 
 #define SCCP_LOG(...) LLVM_DEBUG(__VA_ARGS__)
 //#define SCCP_LOG(...) __VA_ARGS__
@@ -85,37 +150,63 @@ class LatticeVal {
     /// asserting.
     forcedconstant,
 
+    /// constantrange - This LLVM Value is an integer in a specific range
+    /// (only if -Pipsccp-track-ranges). The range is never a single
+    /// element nor the full set.
+    constantrange,
+
     /// overdefined - This instruction is not known to be constant, and we know
     /// it has a value.
     overdefined
   };
 
-  /// Val: This stores the current lattice value along with the Constant* for
-  /// the constant if this is a 'constant' or 'forcedconstant' value.
-  PointerIntPair<Constant *, 2, LatticeValueTy> Val;
+  LatticeValueTy Tag;
+  /// Const: the constant if this is a 'constant' or 'forcedconstant' value.
+  Constant *Const;
+  /// Range: the range if this is a 'constantrange' value.
+  ConstantRange Range;
+  /// Number of times the range has been extended (for widening).
+  unsigned NumRangeExtensions;
 
-  LatticeValueTy getLatticeValue() const { return Val.getInt(); }
+  LatticeValueTy getLatticeValue() const { return Tag; }
 
 public:
-  LatticeVal() : Val(nullptr, unknown) {}
+  LatticeVal()
+      : Tag(unknown), Const(nullptr), Range(1, /*isFullSet=*/true),
+        NumRangeExtensions(0) {}
 
   bool isUnknown() const { return getLatticeValue() == unknown; }
   bool isConstant() const {
     return getLatticeValue() == constant || getLatticeValue() == forcedconstant;
   }
+  bool isForcedConstant() const { return getLatticeValue() == forcedconstant; }
+  bool isConstantRange() const { return getLatticeValue() == constantrange; }
   bool isOverdefined() const { return getLatticeValue() == overdefined; }
 
   Constant *getConstant() const {
     assert(isConstant() && "Cannot get the constant of a non-constant!");
-    return Val.getPointer();
+    return Const;
+  }
+
+  const ConstantRange &getConstantRange() const {
+    assert(isConstantRange() && "Cannot get the range of a non-range!");
+    return Range;
   }
 
+  unsigned getNumRangeExtensions() const { return NumRangeExtensions; }
+
+  bool operator==(const LatticeVal &Other) const {
+    return Tag == Other.Tag && Const == Other.Const &&
+           (Tag != constantrange || Range == Other.Range);
+  }
+  bool operator!=(const LatticeVal &Other) const { return !(*this == Other); }
+
   /// markOverdefined - Return true if this is a change in status.
   bool markOverdefined() {
     if (isOverdefined())
       return false;
 
-    Val.setInt(overdefined);
+    Tag = overdefined;
     return true;
   }
 
@@ -127,9 +218,9 @@ public:
     }
 
     if (isUnknown()) {
-      Val.setInt(constant);
+      Tag = constant;
       assert(V && "Marking constant with NULL");
-      Val.setPointer(V);
+      Const = V;
     } else {
       assert(getLatticeValue() == forcedconstant &&
              "Cannot move from overdefined to constant!");
@@ -140,8 +231,25 @@ public:
       // Otherwise, we go to overdefined.  Assumptions made based on the
       // forced value are possibly wrong.  Assuming this is another constant
       // could expose a contradiction.
-      Val.setInt(overdefined);
+      Tag = overdefined;
+    }
+    return true;
+  }
+
+  /// markConstantRange - Return true if this is a change in status.
+  /// The caller ensures that R includes the current value.
+  bool markConstantRange(const ConstantRange &R) {
+    assert((isUnknown() || getLatticeValue() == constant ||
+            isConstantRange()) &&
+           "Cannot move to a range!");
+    if (isConstantRange()) {
+      if (Range == R)
+        return false;
+      ++NumRangeExtensions;
     }
+    Tag = constantrange;
+    Const = nullptr;
+    Range = R;
     return true;
   }
 
@@ -161,10 +269,20 @@ public:
     return nullptr;
   }
 
+  /// getIntRange - If this is a ConstantInt or a range, return it as a
+  /// range. Otherwise return None.
+  Optional<ConstantRange> getIntRange() const {
+    if (isConstantRange())
+      return Range;
+    if (ConstantInt *CI = getConstantInt())
+      return ConstantRange(CI->getValue());
+    return None;
+  }
+
   void markForcedConstant(Constant *V) {
     assert(isUnknown() && "Can't force a defined value!");
-    Val.setInt(forcedconstant);
-    Val.setPointer(V);
+    Tag = forcedconstant;
+    Const = V;
   }
 };
 
@@ -179,6 +297,8 @@ inline raw_ostream &operator<<(raw_ostream &o, LatticeVal v) {
       o << *(v.getConstant());
     }
     o << ")";
+  } else if (v.isConstantRange()) {
+    o << "Range(" << v.getConstantRange() << ")";
   } else if (v.isOverdefined()) {
     o << "Top";
   } else {
@@ -198,6 +318,24 @@ class SCCPSolver : public InstVisitor<SCCPSolver> {
   SmallPtrSet<BasicBlock *, 8> BBExecutable; // The BBs that are executable.
   DenseMap<Value *, LatticeVal> ValueState;  // The state each value is in.
 
+  /// FunctionState - The state of the arguments and instructions of a
+  /// function. Values are numbered by NumberValues before solving: first
+  /// the arguments and then the instructions, with the blocks in
+  /// reverse post-order. The functions are numbered (ranked) in call
+  /// graph SCC order, callees first. The rank and number of a value
+  /// give the order in which the work lists are processed.
+  struct FunctionState {
+    Function *F;
+    std::vector<Value *> Values;
+    std::vector<LatticeVal> States;
+  };
+  std::vector<FunctionState> FunctionStates;
+  /// ValueNumbers - Maps an argument or instruction to its function
+  /// rank (high 32 bits) and its number within the function (low 32
+  /// bits). Values not in the map (constants, globals, ...) are kept in
+  /// ValueState.
+  DenseMap<const Value *, uint64_t> ValueNumbers;
+
   /// StructValueState - This maintains ValueState for values that have
   /// StructType, for example for formal arguments, calls, insertelement, etc.
   ///
@@ -209,6 +347,18 @@ class SCCPSolver : public InstVisitor<SCCPSolver> {
   /// overdefined, it's entry is simply removed from this map.
   DenseMap<GlobalVariable *, LatticeVal> TrackedGlobals;
 
+  /// TrackedFields - Same as TrackedGlobals but for the fields (byte
+  /// offsets) of aggregate or address-taken globals. FieldAccesses
+  /// maps each load of a field to the field and each store to the
+  /// fields that it may write. Unlike TrackedGlobals, loads of a field
+  /// are not necessarily users of the global so FieldLoads records
+  /// them to be revisited when the field changes.
+  typedef std::pair<GlobalVariable *, uint64_t> Field;
+  DenseMap<Field, LatticeVal> TrackedFields;
+  DenseMap<Instruction *, SmallVector<Field, 1>> FieldAccesses;
+  DenseMap<Field, SmallVector<LoadInst *, 4>> FieldLoads;
+  SmallVector<LoadInst *, 64> FieldLoadWorkList;
+
   /// TrackedRetVals - If we are tracking arguments into and the return
   /// value out of a function, it will have an entry in this map, indicating
   /// what the known return value for the function is.
@@ -234,10 +384,36 @@ class SCCPSolver : public InstVisitor<SCCPSolver> {
   /// By having a separate worklist, we accomplish this because everything
   /// possibly overdefined will become overdefined at the soonest possible
   /// point.
-  SmallVector<Value *, 64> OverdefinedInstWorkList;
-  SmallVector<Value *, 64> InstWorkList;
+  ///
+  /// The work lists are ordered by the number of the values so that
+  /// callees converge before their callers and, within a function,
+  /// definitions are usually visited before their uses.
+  template <typename T> class OrderedWorkList {
+    typedef std::pair<uint64_t, T *> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> Heap;
+    Entry Last = {0, nullptr};
+
+  public:
+    bool empty() const { return Heap.empty(); }
+    void push(uint64_t Order, T *V) {
+      Heap.push(Entry(Order, V));
+      Last = Entry(0, nullptr);
+    }
+    // Return the next element or null if it is a duplicate of the
+    // element that was just returned (and nothing was pushed since).
+    T *pop() {
+      Entry E = Heap.top();
+      Heap.pop();
+      if (E == Last)
+        return nullptr;
+      Last = E;
+      return E.second;
+    }
+  };
+  OrderedWorkList<Value> OverdefinedInstWorkList;
+  OrderedWorkList<Value> InstWorkList;
 
-  SmallVector<BasicBlock *, 64> BBWorkList; // The BasicBlock work list
+  OrderedWorkList<BasicBlock> BBWorkList; // The BasicBlock work list
 
   /// KnownFeasibleEdges - Entries in this set are edges which have already had
   /// PHI nodes retriggered.
@@ -256,10 +432,50 @@ public:
     if (!BBExecutable.insert(BB).second)
       return false;
     SCCP_LOG(errs() << "Marking Block Executable: " << BB->getName() << '\n');
-    BBWorkList.push_back(BB); // Add the block to the work list!
+    // Add the block to the work list!
+    BBWorkList.push(getOrder(&BB->front()), BB);
     return true;
   }
 
+  /// NumberValues - Number the arguments and instructions of the defined
+  /// functions of M. Must be called before solving.
+  void NumberValues(Module &M, CallGraph &CG) {
+    auto addFunction = [this](Function *F) {
+      if (!F || F->isDeclaration() || ValueNumbers.count(&F->front().front()))
+        return;
+      uint64_t Rank = FunctionStates.size();
+      FunctionStates.push_back(FunctionState());
+      FunctionState &FS = FunctionStates.back();
+      FS.F = F;
+      auto addValue = [&](Value *V) {
+        ValueNumbers[V] = (Rank << 32) | FS.Values.size();
+        FS.Values.push_back(V);
+      };
+      for (Argument &A : F->args())
+        addValue(&A);
+      SmallPtrSet<BasicBlock *, 32> Numbered;
+      ReversePostOrderTraversal<Function *> RPOT(F);
+      for (BasicBlock *BB : RPOT) {
+        Numbered.insert(BB);
+        for (Instruction &I : *BB)
+          addValue(&I);
+      }
+      // Blocks unreachable from the entry go last.
+      for (BasicBlock &BB : *F)
+        if (!Numbered.count(&BB))
+          for (Instruction &I : BB)
+            addValue(&I);
+      FS.States.resize(FS.Values.size());
+    };
+
+    for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I)
+      for (CallGraphNode *N : *I)
+        addFunction(N->getFunction());
+    // In case the call graph is not up-to-date.
+    for (Function &F : M)
+      addFunction(&F);
+  }
+
   /// TrackValueOfGlobalVariable - inform the SCCPSolver that it
   /// should track loads and stores to the specified global variable
   /// if it can.  This is only legal to call if performing
@@ -278,6 +494,28 @@ public:
     }
   }
 
+  /// TrackFieldOfGlobalVariable - inform the SCCPSolver that it should
+  /// track the field of GV at byte Offset. Init is the value of the
+  /// field in the initializer of GV (null if unknown). The caller
+  /// must ensure that all the instructions that may write the field
+  /// are added with AddFieldAccess.
+  void TrackFieldOfGlobalVariable(GlobalVariable *GV, uint64_t Offset,
+                                  Constant *Init) {
+    LatticeVal &IV = TrackedFields[Field(GV, Offset)];
+    if (GV->getMetadata("ipdse.useless_initializer"))
+      return;
+    if (!Init)
+      IV.markOverdefined();
+    else if (!isa<UndefValue>(Init))
+      IV.markConstant(Init);
+  }
+
+  void AddFieldAccess(Instruction *I, GlobalVariable *GV, uint64_t Offset) {
+    FieldAccesses[I].push_back(Field(GV, Offset));
+    if (auto *LI = dyn_cast<LoadInst>(I))
+      FieldLoads[Field(GV, Offset)].push_back(LI);
+  }
+
   /// AddTrackedFunction - If the SCCP solver is supposed to track calls into
   /// and out of the specified function (which cannot have its address taken),
   /// this method must be called.
@@ -311,6 +549,10 @@ public:
     return BBExecutable.count(BB);
   }
 
+  bool isEdgeKnownFeasible(BasicBlock *From, BasicBlock *To) const {
+    return KnownFeasibleEdges.count(Edge(From, To));
+  }
+
   std::vector<LatticeVal> getStructLatticeValueFor(Value *V) const {
     std::vector<LatticeVal> StructValues;
     auto *STy = dyn_cast<StructType>(V->getType());
@@ -324,6 +566,8 @@ public:
   }
 
   LatticeVal getLatticeValueFor(Value *V) const {
+    if (const LatticeVal *LV = getNumberedState(V))
+      return *LV;
     DenseMap<Value *, LatticeVal>::const_iterator I = ValueState.find(V);
     assert(I != ValueState.end() && "V is not in valuemap!");
     return I->second;
@@ -354,7 +598,7 @@ public:
       for (unsigned i = 0, e = STy->getNumElements(); i != e; ++i)
         markOverdefined(getStructValueState(V, i), V);
     else
-      markOverdefined(ValueState[V], V);
+      markOverdefined(getValueState(V), V);
   }
 
   // isStructLatticeConstant - Return true if all the lattice values
@@ -365,7 +609,7 @@ public:
       const auto &It = TrackedMultipleRetVals.find(std::make_pair(F, i));
       assert(It != TrackedMultipleRetVals.end());
       LatticeVal LV = It->second;
-      if (LV.isOverdefined())
+      if (LV.isOverdefined() || LV.isConstantRange())
         return false;
     }
     return true;
@@ -373,6 +617,15 @@ public:
 
   void printValueState(raw_ostream &o) {
     o << "ValueState\n";
+    for (auto &FS : FunctionStates) {
+      for (unsigned i = 0, e = FS.Values.size(); i != e; ++i) {
+        if (!FS.Values[i]->hasName() || !FS.States[i].isConstant()) {
+          continue;
+        }
+        o << "\t" << FS.Values[i]->getName() << " --> " << FS.States[i]
+          << "\n";
+      }
+    }
     for (auto &kv : ValueState) {
       if (!kv.first->hasName() || !kv.second.isConstant()) {
         continue;
@@ -409,8 +662,27 @@ private:
   // pushToWorkList - Helper for markConstant/markForcedConstant/markOverdefined
   void pushToWorkList(LatticeVal &IV, Value *V) {
     if (IV.isOverdefined())
-      return OverdefinedInstWorkList.push_back(V);
-    InstWorkList.push_back(V);
+      return OverdefinedInstWorkList.push(getOrder(V), V);
+    InstWorkList.push(getOrder(V), V);
+  }
+
+  // getOrder - Return the position of V in the work lists. Values
+  // that are not numbered (e.g., functions whose return value
+  // changed) go first since their users can be anywhere.
+  uint64_t getOrder(const Value *V) const {
+    auto It = ValueNumbers.find(V);
+    return It == ValueNumbers.end() ? 0 : It->second;
+  }
+
+  // getNumberedState - Return the state of V if it is numbered.
+  LatticeVal *getNumberedState(const Value *V) {
+    auto It = ValueNumbers.find(V);
+    if (It == ValueNumbers.end())
+      return nullptr;
+    return &FunctionStates[It->second >> 32].States[(uint32_t)It->second];
+  }
+  const LatticeVal *getNumberedState(const Value *V) const {
+    return const_cast<SCCPSolver *>(this)->getNumberedState(V);
   }
 
   // markConstant - Make a value be marked as "constant".  If the value
@@ -427,13 +699,13 @@ private:
 
   void markConstant(Value *V, Constant *C) {
     assert(!V->getType()->isStructTy() && "structs should use mergeInValue");
-    markConstant(ValueState[V], V, C);
+    markConstant(getValueState(V), V, C);
   }
 
   void markForcedConstant(Value *V, Constant *C) {
     assert(!V->getType()->isStructTy() && "structs should use mergeInValue");
 
-    LatticeVal &IV = ValueState[V];
+    LatticeVal &IV = getValueState(V);
     IV.markForcedConstant(C);
     SCCP_LOG(errs() << "markForcedConstant: " << *C << ": " << *V << '\n');
     pushToWorkList(IV, V);
@@ -454,22 +726,52 @@ private:
     pushToWorkList(IV, V);
   }
 
+  // mergeInRange - Join the range R into IV. If IV cannot be a range
+  // (e.g., it is not an integer) or it has been extended too many
+  // times then it goes to overdefined.
+  void mergeInRange(LatticeVal &IV, Value *V, const ConstantRange &R) {
+    if (IV.isOverdefined())
+      return;
+    if (IV.isForcedConstant())
+      return markOverdefined(IV, V);
+    Optional<ConstantRange> Old = IV.getIntRange();
+    if (!IV.isUnknown() && !Old)
+      return markOverdefined(IV, V);
+    ConstantRange New = Old ? Old->unionWith(R) : R;
+    if (Old && *Old == New)
+      return; // Noop.
+    if (const APInt *C = New.getSingleElement())
+      return markConstant(IV, V, ConstantInt::get(V->getContext(), *C));
+    if (New.isFullSet() || IV.getNumRangeExtensions() >= MaxWidenSteps)
+      return markOverdefined(IV, V);
+    if (IV.markConstantRange(New)) {
+      SCCP_LOG(errs() << "markConstantRange: " << New << ": " << *V << '\n');
+      pushToWorkList(IV, V);
+    }
+  }
+
   void mergeInValue(LatticeVal &IV, Value *V, LatticeVal MergeWithV) {
     if (IV.isOverdefined() || MergeWithV.isUnknown())
       return; // Noop.
     if (MergeWithV.isOverdefined())
       return markOverdefined(IV, V);
-    if (IV.isUnknown())
+    if (IV.isUnknown() && MergeWithV.isConstant())
       return markConstant(IV, V, MergeWithV.getConstant());
-    if (IV.getConstant() != MergeWithV.getConstant()) {
-      return markOverdefined(IV, V);
+    if (IV.isConstant() && MergeWithV.isConstant() &&
+        IV.getConstant() == MergeWithV.getConstant())
+      return; // Noop.
+    // Two different constants or a range
+    if (TrackRanges) {
+      if (Optional<ConstantRange> R = MergeWithV.getIntRange())
+        return mergeInRange(IV, V, *R);
     }
+    return markOverdefined(IV, V);
   }
 
   void mergeInValue(Value *V, LatticeVal MergeWithV) {
     assert(!V->getType()->isStructTy() &&
            "non-structs should use markConstant");
-    mergeInValue(ValueState[V], V, MergeWithV);
+    mergeInValue(getValueState(V), V, MergeWithV);
   }
 
   /// getValueState - Return the LatticeVal object that corresponds to the
@@ -478,6 +780,9 @@ private:
   LatticeVal &getValueState(Value *V) {
     assert(!V->getType()->isStructTy() && "Should use getStructValueState");
 
+    if (LatticeVal *NLV = getNumberedState(V))
+      return *NLV;
+
     std::pair<DenseMap<Value *, LatticeVal>::iterator, bool> I =
         ValueState.insert(std::make_pair(V, LatticeVal()));
     LatticeVal &LV = I.first->second;
@@ -574,6 +879,7 @@ private:
   // operand made a transition, or the instruction is newly executable.  Change
   // the value type of I to reflect these changes if appropriate.
   void visitPHINode(PHINode &I);
+  void visitIntPHINode(PHINode &I);
 
   // Terminators
   void visitReturnInst(ReturnInst &I);
@@ -655,6 +961,24 @@ void SCCPSolver::getFeasibleSuccessors(Instruction &TI,
     LatticeVal SCValue = getValueState(SI->getCondition());
     ConstantInt *CI = SCValue.getConstantInt();
 
+    if (SCValue.isConstantRange()) {
+      // Only the cases in the range are executable. The default is
+      // executable unless all the values of the range are cases.
+      const ConstantRange &R = SCValue.getConstantRange();
+      uint64_t InRange = 0;
+      for (auto Case : SI->cases()) {
+        if (R.contains(Case.getCaseValue()->getValue())) {
+          Succs[Case.getSuccessorIndex()] = true;
+          ++InRange;
+        }
+      }
+      // R is neither empty nor full so its size is upper - lower
+      // (modulo 2^n)
+      if ((R.getUpper() - R.getLower()).ugt(InRange))
+        Succs[SI->case_default()->getSuccessorIndex()] = true;
+      return;
+    }
+
     if (!CI) { // Overdefined or unknown condition?
       // All destinations are executable!
       if (!SCValue.isUnknown())
@@ -738,6 +1062,15 @@ bool SCCPSolver::isEdgeFeasible(BasicBlock *From, BasicBlock *To) {
     LatticeVal SCValue = getValueState(SI->getCondition());
     ConstantInt *CI = SCValue.getConstantInt();
 
+    if (SCValue.isConstantRange()) {
+      SmallVector<bool, 16> Succs;
+      getFeasibleSuccessors(*TI, Succs);
+      for (unsigned i = 0, e = Succs.size(); i != e; ++i)
+        if (Succs[i] && TI->getSuccessor(i) == To)
+          return true;
+      return false;
+    }
+
     if (!CI)
       return !SCValue.isUnknown();
 
@@ -793,6 +1126,9 @@ void SCCPSolver::visitPHINode(PHINode &PN) {
   if (PN.getNumIncomingValues() > 64)
     return markOverdefined(&PN);
 
+  if (TrackRanges && PN.getType()->isIntegerTy())
+    return visitIntPHINode(PN);
+
   // Look at all of the executable operands of the PHI node.  If any of them
   // are overdefined, the PHI becomes overdefined as well.  If they are all
   // constant, and they agree with each other, the PHI becomes the identical
@@ -835,6 +1171,45 @@ void SCCPSolver::visitPHINode(PHINode &PN) {
     markConstant(&PN, OperandVal); // Acquire operand value
 }
 
+// Same as visitPHINode but the incoming values are joined as ranges
+// if they are not all the same constant.
+void SCCPSolver::visitIntPHINode(PHINode &PN) {
+  Constant *OperandVal = nullptr;
+  bool SameConstant = true;
+  Optional<ConstantRange> Range;
+  bool IsRange = true;
+  for (unsigned i = 0, e = PN.getNumIncomingValues(); i != e; ++i) {
+    LatticeVal IV = getValueState(PN.getIncomingValue(i));
+    if (IV.isUnknown())
+      continue; // Doesn't influence PHI node.
+
+    if (!isEdgeFeasible(PN.getIncomingBlock(i), PN.getParent()))
+      continue;
+
+    if (IV.isOverdefined()) // PHI node becomes overdefined!
+      return markOverdefined(&PN);
+
+    if (!IV.isConstant() || (OperandVal && IV.getConstant() != OperandVal))
+      SameConstant = false;
+    else if (!OperandVal)
+      OperandVal = IV.getConstant();
+
+    if (Optional<ConstantRange> R = IV.getIntRange())
+      Range = Range ? Range->unionWith(*R) : *R;
+    else
+      IsRange = false;
+  }
+
+  if (SameConstant) {
+    if (OperandVal)
+      markConstant(&PN, OperandVal); // Acquire operand value
+    return;
+  }
+  if (!IsRange)
+    return markOverdefined(&PN);
+  mergeInRange(getValueState(&PN), &PN, *Range);
+}
+
 void SCCPSolver::visitReturnInst(ReturnInst &I) {
   if (I.getNumOperands() == 0)
     return; // ret void
@@ -877,7 +1252,18 @@ void SCCPSolver::visitCastInst(CastInst &I) {
   LatticeVal OpSt = getValueState(I.getOperand(0));
   if (OpSt.isOverdefined()) // Inherit overdefinedness of operand
     markOverdefined(&I);
-  else if (OpSt.isConstant()) {
+  else if (OpSt.isConstantRange()) {
+    switch (I.getOpcode()) {
+    case Instruction::Trunc:
+    case Instruction::ZExt:
+    case Instruction::SExt:
+      return mergeInRange(getValueState(&I), &I,
+                          OpSt.getConstantRange().castOp(
+                              I.getOpcode(), I.getType()->getIntegerBitWidth()));
+    default:
+      return markOverdefined(&I);
+    }
+  } else if (OpSt.isConstant()) {
     // Fold the constant as we build.
     Constant *C = ConstantFoldCastOperand(I.getOpcode(), OpSt.getConstant(),
                                           I.getType(), DL);
@@ -973,6 +1359,11 @@ void SCCPSolver::visitSelectInst(SelectInst &I) {
     return mergeInValue(&I, FVal);
   if (FVal.isUnknown()) // select ?, X, undef -> X.
     return mergeInValue(&I, TVal);
+  if (TrackRanges && I.getType()->isIntegerTy()) {
+    // select ?, X, Y -> join of X and Y
+    mergeInValue(&I, TVal);
+    return mergeInValue(&I, FVal);
+  }
   markOverdefined(&I);
 }
 
@@ -981,7 +1372,7 @@ void SCCPSolver::visitBinaryOperator(Instruction &I) {
   LatticeVal V1State = getValueState(I.getOperand(0));
   LatticeVal V2State = getValueState(I.getOperand(1));
 
-  LatticeVal &IV = ValueState[&I];
+  LatticeVal &IV = getValueState(&I);
   if (IV.isOverdefined())
     return;
 
@@ -995,8 +1386,18 @@ void SCCPSolver::visitBinaryOperator(Instruction &I) {
   }
 
   // If something is undef, wait for it to resolve.
-  if (!V1State.isOverdefined() && !V2State.isOverdefined())
-    return;
+  if (!V1State.isOverdefined() && !V2State.isOverdefined()) {
+    if (V1State.isUnknown() || V2State.isUnknown())
+      return;
+    // One of the operands is a range
+    Optional<ConstantRange> R1 = V1State.getIntRange();
+    Optional<ConstantRange> R2 = V2State.getIntRange();
+    if (R1 && R2 && I.getType()->isIntegerTy())
+      return mergeInRange(
+          IV, &I,
+          R1->binaryOp(static_cast<Instruction::BinaryOps>(I.getOpcode()), *R2));
+    return markOverdefined(IV, &I);
+  }
 
   // Otherwise, one of our operands is overdefined.  Try to produce something
   // better than overdefined with some tricks.
@@ -1018,7 +1419,7 @@ void SCCPSolver::visitBinaryOperator(Instruction &I) {
     else if (!V2State.isOverdefined())
       NonOverdefVal = &V2State;
 
-    if (NonOverdefVal) {
+    if (NonOverdefVal && !NonOverdefVal->isConstantRange()) {
       if (NonOverdefVal->isUnknown())
         return;
 
@@ -1045,7 +1446,7 @@ void SCCPSolver::visitCmpInst(CmpInst &I) {
   LatticeVal V1State = getValueState(I.getOperand(0));
   LatticeVal V2State = getValueState(I.getOperand(1));
 
-  LatticeVal &IV = ValueState[&I];
+  LatticeVal &IV = getValueState(&I);
   if (IV.isOverdefined())
     return;
 
@@ -1058,17 +1459,32 @@ void SCCPSolver::visitCmpInst(CmpInst &I) {
   }
 
   // If operands are still unknown, wait for it to resolve.
-  if (!V1State.isOverdefined() && !V2State.isOverdefined())
-    return;
+  if (!V1State.isOverdefined() && !V2State.isOverdefined()) {
+    if (V1State.isUnknown() || V2State.isUnknown())
+      return;
+    // One of the operands is a range: fold the comparison if it has
+    // the same result for all the values of the ranges.
+    Optional<ConstantRange> R1 = V1State.getIntRange();
+    Optional<ConstantRange> R2 = V2State.getIntRange();
+    if (R1 && R2 && isa<ICmpInst>(I)) {
+      CmpInst::Predicate Pred = I.getPredicate();
+      if (ConstantRange::makeSatisfyingICmpRegion(Pred, *R2).contains(*R1))
+        return markConstant(IV, &I, ConstantInt::getTrue(I.getType()));
+      if (ConstantRange::makeSatisfyingICmpRegion(
+              CmpInst::getInversePredicate(Pred), *R2)
+              .contains(*R1))
+        return markConstant(IV, &I, ConstantInt::getFalse(I.getType()));
+    }
+  }
 
-  markOverdefined(&I);
+  markOverdefined(IV, &I);
 }
 
 // Handle getelementptr instructions.  If all operands are constants then we
 // can turn this into a getelementptr ConstantExpr.
 //
 void SCCPSolver::visitGetElementPtrInst(GetElementPtrInst &I) {
-  if (ValueState[&I].isOverdefined())
+  if (getValueState(&I).isOverdefined())
     return;
 
   SmallVector<Constant *, 8> Operands;
@@ -1079,7 +1495,7 @@ void SCCPSolver::visitGetElementPtrInst(GetElementPtrInst &I) {
     if (State.isUnknown())
       return; // Operands are not resolved yet.
 
-    if (State.isOverdefined())
+    if (State.isOverdefined() || State.isConstantRange())
       return markOverdefined(&I);
 
     assert(State.isConstant() && "Unknown state!");
@@ -1102,6 +1518,20 @@ void SCCPSolver::visitStoreInst(StoreInst &SI) {
   if (SI.getValueOperand()->getType()->isStructTy())
     return;
 
+  auto FA = FieldAccesses.find(&SI);
+  if (FA != FieldAccesses.end()) {
+    // Merge the stored value into all the fields that SI may write.
+    LatticeVal StoredVal = getValueState(SI.getValueOperand());
+    for (const Field &Fld : FA->second) {
+      LatticeVal &IV = TrackedFields[Fld];
+      LatticeVal OldVal = IV;
+      mergeInValue(IV, &SI, StoredVal);
+      if (IV != OldVal)
+        FieldLoadWorkList.append(FieldLoads[Fld].begin(), FieldLoads[Fld].end());
+    }
+    return;
+  }
+
   if (GlobalVariable *GV = dyn_cast<GlobalVariable>(SI.getPointerOperand())) {
     DenseMap<GlobalVariable *, LatticeVal>::iterator I =
         TrackedGlobals.find(GV);
@@ -1132,11 +1562,18 @@ void SCCPSolver::visitLoadInst(LoadInst &I) {
     return; // The pointer is not resolved yet!
   }
 
-  LatticeVal &IV = ValueState[&I];
+  LatticeVal &IV = getValueState(&I);
   if (IV.isOverdefined()) {
     return;
   }
 
+  // If this load reads a tracked field, merge in its known value.
+  auto FA = FieldAccesses.find(&I);
+  if (FA != FieldAccesses.end()) {
+    mergeInValue(IV, &I, TrackedFields[FA->second.front()]);
+    return;
+  }
+
   if (!PtrVal.isConstant() || I.isVolatile()) {
     return markOverdefined(IV, &I);
   }
@@ -1197,7 +1634,7 @@ void SCCPSolver::visitCallSite(CallSite CS) {
 
         if (State.isUnknown())
           return; // Operands are not resolved yet.
-        if (State.isOverdefined())
+        if (State.isOverdefined() || State.isConstantRange())
           return markOverdefined(I);
         assert(State.isConstant() && "Unknown state!");
         Operands.push_back(State.getConstant());
@@ -1273,11 +1710,13 @@ void SCCPSolver::visitCallSite(CallSite CS) {
 void SCCPSolver::Solve() {
   // Process the work lists until they are empty!
   while (!BBWorkList.empty() || !InstWorkList.empty() ||
-         !OverdefinedInstWorkList.empty()) {
+         !OverdefinedInstWorkList.empty() || !FieldLoadWorkList.empty()) {
     // Process the overdefined instruction's work list first, which drives other
     // things to overdefined more quickly.
     while (!OverdefinedInstWorkList.empty()) {
-      Value *I = OverdefinedInstWorkList.pop_back_val();
+      Value *I = OverdefinedInstWorkList.pop();
+      if (!I)
+        continue;
 
       SCCP_LOG(errs() << "\nPopped off OI-WL: " << *I << '\n');
       // "I" got into the work list because it either made the transition from
@@ -1294,7 +1733,9 @@ void SCCPSolver::Solve() {
 
     // Process the instruction work list.
     while (!InstWorkList.empty()) {
-      Value *I = InstWorkList.pop_back_val();
+      Value *I = InstWorkList.pop();
+      if (!I)
+        continue;
 
       SCCP_LOG(errs() << "\nPopped off I-WL: " << *I << '\n');
 
@@ -1311,10 +1752,17 @@ void SCCPSolver::Solve() {
             OperandChangedState(UI);
     }
 
+    // Process the loads of the fields that changed.
+    while (!FieldLoadWorkList.empty()) {
+      LoadInst *LI = FieldLoadWorkList.pop_back_val();
+      OperandChangedState(LI);
+    }
+
     // Process the basic block work list.
     while (!BBWorkList.empty()) {
-      BasicBlock *BB = BBWorkList.back();
-      BBWorkList.pop_back();
+      BasicBlock *BB = BBWorkList.pop();
+      if (!BB)
+        continue;
 
       SCCP_LOG(errs() << "\nPopped off BBWL: " << *BB << '\n');
 
@@ -1650,7 +2098,9 @@ static bool tryToReplaceWithConstant(SCCPSolver &Solver, Value *V) {
   Constant *Const = nullptr;
   if (V->getType()->isStructTy()) {
     std::vector<LatticeVal> IVs = Solver.getStructLatticeValueFor(V);
-    if (any_of(IVs, [](const LatticeVal &LV) { return LV.isOverdefined(); }))
+    if (any_of(IVs, [](const LatticeVal &LV) {
+          return LV.isOverdefined() || LV.isConstantRange();
+        }))
       return false;
     std::vector<Constant *> ConstVals;
     auto *ST = dyn_cast<StructType>(V->getType());
@@ -1663,7 +2113,7 @@ static bool tryToReplaceWithConstant(SCCPSolver &Solver, Value *V) {
     Const = ConstantStruct::get(ST, ConstVals);
   } else {
     LatticeVal IV = Solver.getLatticeValueFor(V);
-    if (IV.isOverdefined()) {
+    if (IV.isOverdefined() || IV.isConstantRange()) {
       return false;
     }
     Const = IV.isConstant() ? IV.getConstant() : UndefValue::get(V->getType());
@@ -1680,6 +2130,171 @@ static bool tryToReplaceWithConstant(SCCPSolver &Solver, Value *V) {
   return true;
 }
 
+// Remove the cases of SI whose edges the solver found infeasible,
+// e.g., because the condition is in a range that does not include
+// them. If the default destination is infeasible then the last case
+// becomes the default.
+static bool removeInfeasibleCases(SCCPSolver &Solver, SwitchInst &SI) {
+  BasicBlock *BB = SI.getParent();
+  bool Changed = false;
+  for (auto It = SI.case_begin(); It != SI.case_end();) {
+    BasicBlock *Succ = It->getCaseSuccessor();
+    if (Solver.isEdgeKnownFeasible(BB, Succ)) {
+      ++It;
+      continue;
+    }
+    Succ->removePredecessor(BB);
+    It = SI.removeCase(It);
+    ++IPNumCasesRemoved;
+    Changed = true;
+  }
+  BasicBlock *Default = SI.getDefaultDest();
+  if (SI.getNumCases() > 0 && !Solver.isEdgeKnownFeasible(BB, Default)) {
+    auto Last = std::prev(SI.case_end());
+    Default->removePredecessor(BB);
+    SI.setDefaultDest(Last->getCaseSuccessor());
+    SI.removeCase(Last);
+    ++IPNumCasesRemoved;
+    Changed = true;
+  }
+  return Changed;
+}
+
+// isReplaceableWithConstant - Return true if tryToReplaceWithConstant
+// would replace V. Unlike tryToReplaceWithConstant, this does not
+// create constants so it can be called from several threads.
+static bool isReplaceableWithConstant(const SCCPSolver &Solver, Value *V) {
+  if (V->getType()->isStructTy()) {
+    std::vector<LatticeVal> IVs = Solver.getStructLatticeValueFor(V);
+    return none_of(IVs, [](const LatticeVal &LV) {
+      return LV.isOverdefined() || LV.isConstantRange();
+    });
+  }
+  LatticeVal IV = Solver.getLatticeValueFor(V);
+  return !IV.isOverdefined() && !IV.isConstantRange();
+}
+
+namespace {
+// FunctionRewrite - The changes that the transformation phase makes to
+// a function. It is computed by planRewrite without modifying the IR
+// or the LLVMContext so that functions can be planned in parallel
+// (-Pipsccp-threads). The IR is then modified serially by
+// applyRewrite.
+struct FunctionRewrite {
+  // Arguments and instructions that are replaced with constants.
+  std::vector<Value *> Replaced;
+  std::vector<BasicBlock *> DeadBlocks;
+  // Switches with infeasible cases.
+  std::vector<SwitchInst *> Switches;
+};
+} // end anonymous namespace
+
+static void planRewrite(const SCCPSolver &Solver, Function &F,
+                        FunctionRewrite &R) {
+  if (Solver.isBlockExecutable(&F.front())) {
+    for (Argument &A : F.args())
+      if (!A.use_empty() && isReplaceableWithConstant(Solver, &A))
+        R.Replaced.push_back(&A);
+  }
+
+  for (BasicBlock &BB : F) {
+    if (!Solver.isBlockExecutable(&BB)) {
+      R.DeadBlocks.push_back(&BB);
+      continue;
+    }
+
+    for (Instruction &I : BB) {
+      if (!I.getType()->isVoidTy() && isReplaceableWithConstant(Solver, &I))
+        R.Replaced.push_back(&I);
+    }
+
+    // A switch whose condition is not a constant can still have
+    // infeasible cases if the condition is a range.
+    if (auto *SI = dyn_cast<SwitchInst>(BB.getTerminator())) {
+      if (!isa<Constant>(SI->getCondition()) &&
+          any_of(successors(&BB), [&](BasicBlock *Succ) {
+            return !Solver.isEdgeKnownFeasible(&BB, Succ);
+          }))
+        R.Switches.push_back(SI);
+    }
+  }
+}
+
+static bool applyRewrite(SCCPSolver &Solver, Function &F,
+                         const FunctionRewrite &R) {
+  bool MadeChanges = false;
+
+  // Replace values first: making a block unreachable can fold the PHI
+  // nodes of its successors.
+  for (Value *V : R.Replaced) {
+    if (tryToReplaceWithConstant(Solver, V)) {
+      if (isa<Argument>(V)) {
+        ++IPNumArgsElimed;
+        MadeChanges = true;
+        continue;
+      }
+      auto *Inst = cast<Instruction>(V);
+      if (isInstructionTriviallyDead(Inst)) {
+        Inst->eraseFromParent();
+      }
+      // Hey, we just changed something!
+      MadeChanges = true;
+      ++IPNumInstRemoved;
+    }
+  }
+
+  SmallVector<BasicBlock *, 16> BlocksToErase;
+  for (BasicBlock *BB : R.DeadBlocks) {
+    LLVM_DEBUG(dbgs() << "  BasicBlock Dead:" << *BB);
+
+    ++IPNumDeadBlocks;
+    IPNumInstRemoved +=
+        changeToUnreachable(BB->getFirstNonPHI(), /*UseLLVMTrap=*/false);
+
+    MadeChanges = true;
+
+    if (BB != &F.front())
+      BlocksToErase.push_back(BB);
+  }
+
+  for (SwitchInst *SI : R.Switches) {
+    if (!isa<Constant>(SI->getCondition()))
+      MadeChanges |= removeInfeasibleCases(Solver, *SI);
+  }
+
+  // Now that all instructions in the function are constant folded, erase dead
+  // blocks, because we can now use ConstantFoldTerminator to get rid of
+  // in-edges.
+  for (unsigned i = 0, e = BlocksToErase.size(); i != e; ++i) {
+    // If there are any PHI nodes in this successor, drop entries for BB now.
+    BasicBlock *DeadBB = BlocksToErase[i];
+    for (Value::user_iterator UI = DeadBB->user_begin(),
+                              UE = DeadBB->user_end();
+         UI != UE;) {
+      // Grab the user and then increment the iterator early, as the user
+      // will be deleted. Step past all adjacent uses from the same user.
+      auto *I = dyn_cast<Instruction>(*UI);
+      do {
+        ++UI;
+      } while (UI != UE && *UI == I);
+
+      // Ignore blockaddress users; BasicBlock's dtor will handle them.
+      if (!I)
+        continue;
+
+      bool Folded = ConstantFoldTerminator(I->getParent());
+      assert(Folded &&
+             "Expect TermInst on constantint or blockaddress to be folded");
+      (void)Folded;
+    }
+
+    // Finally, delete the basic block.
+    F.getBasicBlockList().erase(DeadBB);
+  }
+
+  return MadeChanges;
+}
+
 static bool AddressIsTaken(const GlobalValue *GV) {
   // Delete any dead constantexpr klingons.
   GV->removeDeadConstantUsers();
@@ -1707,6 +2322,259 @@ static bool AddressIsTaken(const GlobalValue *GV) {
   return false;
 }
 
+// getInitializerAt - Return the value of type Ty stored at byte Offset
+// of the initializer Init, or null if it cannot be determined.
+static Constant *getInitializerAt(Constant *Init, uint64_t Offset, Type *Ty,
+                                  const DataLayout &DL) {
+  if (isa<UndefValue>(Init))
+    return UndefValue::get(Ty);
+  if (Init->isNullValue())
+    return Constant::getNullValue(Ty);
+  if (Offset == 0 && Init->getType() == Ty)
+    return Init;
+
+  Type *InitTy = Init->getType();
+  if (auto *STy = dyn_cast<StructType>(InitTy)) {
+    const StructLayout *SL = DL.getStructLayout(STy);
+    if (Offset >= SL->getSizeInBytes())
+      return nullptr;
+    unsigned Idx = SL->getElementContainingOffset(Offset);
+    Constant *Elt = Init->getAggregateElement(Idx);
+    if (!Elt)
+      return nullptr;
+    return getInitializerAt(Elt, Offset - SL->getElementOffset(Idx), Ty, DL);
+  }
+  if (auto *ATy = dyn_cast<ArrayType>(InitTy)) {
+    uint64_t EltSize = DL.getTypeAllocSize(ATy->getElementType());
+    if (EltSize == 0 || Offset / EltSize >= ATy->getNumElements())
+      return nullptr;
+    Constant *Elt = Init->getAggregateElement(Offset / EltSize);
+    if (!Elt)
+      return nullptr;
+    return getInitializerAt(Elt, Offset % EltSize, Ty, DL);
+  }
+  return nullptr;
+}
+
+// trackFieldsOfGlobals - Inform the solver about the fields of the
+// internal globals that cannot be tracked as a whole (aggregates or
+// globals whose address is taken) provided that all the instructions
+// that may write them are known.
+//
+// sea-dsa is used to resolve the pointers that are not a constant
+// offset from a global. A global is given up if its node is collapsed,
+// an array or external, if its fields overlap or are accessed with
+// different types, or if a pointer to it is passed to an external
+// function that may write memory. Note that only direct pointers are
+// checked: memory reachable from the global through other pointers is
+// not tracked anyway.
+static void trackFieldsOfGlobals(Module &M, seadsa::GlobalAnalysis &DSA,
+                                 const SmallPtrSetImpl<Function *> &Skipped,
+                                 SCCPSolver &Solver) {
+  const DataLayout &DL = M.getDataLayout();
+
+  SetVector<GlobalVariable *> Candidates;
+  for (GlobalVariable &G : M.globals()) {
+    if (!G.isConstant() && G.hasLocalLinkage() &&
+        G.hasDefinitiveInitializer() && AddressIsTaken(&G)) {
+      Candidates.insert(&G);
+    }
+  }
+  if (Candidates.empty())
+    return;
+
+  for (Function &F : M) {
+    if (!F.isDeclaration() && !DSA.hasGraph(F)) {
+      SCCP_LOG(errs() << "[Sccp]: no sea-dsa graph for " << F.getName()
+                      << ". Fields of globals are not tracked.\n");
+      return;
+    }
+  }
+
+  struct Access {
+    Instruction *I;
+    GlobalVariable *GV;
+    uint64_t Offset;
+    Type *Ty;
+  };
+  std::vector<Access> Accesses;
+  SmallPtrSet<GlobalVariable *, 16> Rejected;
+  bool RejectAll = false;
+
+  auto reject = [&](GlobalVariable *GV, const char *Why) {
+    if (Rejected.insert(GV).second) {
+      SCCP_LOG(errs() << "[Sccp]: fields of " << GV->getName()
+                      << " NOT TRACKABLE because " << Why << "\n");
+    }
+  };
+
+  // Return the node pointed by Ptr or null if unknown.
+  auto getNode = [&](seadsa::Graph &G, Value *Ptr,
+                     unsigned &CellOffset) -> const seadsa::Node * {
+    if (!G.hasCell(*Ptr))
+      return nullptr;
+    const seadsa::Cell &C = G.getCell(*Ptr);
+    CellOffset = C.getOffset();
+    return C.getNode();
+  };
+
+  // The candidates that may be pointed by N.
+  auto getCandidates = [&](const seadsa::Node &N,
+                           SmallVectorImpl<GlobalVariable *> &Out) {
+    bool OnlyCandidates = true;
+    for (const Value *V : N.getAllocSites()) {
+      auto *GV = dyn_cast<GlobalVariable>(const_cast<Value *>(V));
+      if (GV && Candidates.count(GV))
+        Out.push_back(GV);
+      else
+        OnlyCandidates = false;
+    }
+    if (!Out.empty() &&
+        (N.isOffsetCollapsed() || N.isArray() || N.isExternal())) {
+      for (GlobalVariable *GV : Out)
+        reject(GV, "its sea-dsa node is collapsed, an array or external");
+      Out.clear();
+    }
+    return OnlyCandidates;
+  };
+
+  // Record that Ptr may be written by I in an unknown way.
+  auto clobber = [&](seadsa::Graph &G, Value *Ptr) {
+    Value *Base = Ptr->stripPointerCasts();
+    if (auto *GV = dyn_cast<GlobalVariable>(Base)) {
+      if (Candidates.count(GV))
+        reject(GV, "it is written by an unknown instruction");
+      return;
+    }
+    unsigned CellOffset;
+    const seadsa::Node *N = getNode(G, Ptr, CellOffset);
+    if (!N) {
+      RejectAll = true;
+      return;
+    }
+    SmallVector<GlobalVariable *, 4> GVs;
+    getCandidates(*N, GVs);
+    for (GlobalVariable *GV : GVs)
+      reject(GV, "it is written by an unknown instruction");
+  };
+
+  // Record a load or a store of type Ty through Ptr.
+  auto access = [&](seadsa::Graph &G, Instruction &I, Value *Ptr, Type *Ty,
+                    bool IsLoad) {
+    int64_t Offset = 0;
+    Value *Base = GetPointerBaseWithConstantOffset(Ptr, Offset, DL);
+    if (auto *GV = dyn_cast<GlobalVariable>(Base)) {
+      if (!Candidates.count(GV))
+        return;
+      if (Offset < 0)
+        reject(GV, "it is accessed at a negative offset");
+      else
+        Accesses.push_back({&I, GV, (uint64_t)Offset, Ty});
+      return;
+    }
+    unsigned CellOffset;
+    const seadsa::Node *N = getNode(G, Ptr, CellOffset);
+    if (!N) {
+      if (!IsLoad)
+        RejectAll = true;
+      return;
+    }
+    SmallVector<GlobalVariable *, 4> GVs;
+    bool OnlyCandidates = getCandidates(*N, GVs);
+    if (IsLoad && (!OnlyCandidates || GVs.size() != 1))
+      return;
+    for (GlobalVariable *GV : GVs)
+      Accesses.push_back({&I, GV, CellOffset, Ty});
+  };
+
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    seadsa::Graph &G = DSA.getGraph(F);
+    // The stores of a skipped function are not visited by the solver.
+    bool IsSkipped = Skipped.count(&F);
+    for (Instruction &I : instructions(F)) {
+      if (auto *LI = dyn_cast<LoadInst>(&I)) {
+        if (LI->isSimple())
+          access(G, I, LI->getPointerOperand(), LI->getType(), true);
+      } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+        Type *Ty = SI->getValueOperand()->getType();
+        if (SI->isSimple() && !Ty->isStructTy() && !IsSkipped)
+          access(G, I, SI->getPointerOperand(), Ty, false);
+        else
+          clobber(G, SI->getPointerOperand());
+      } else if (auto *MI = dyn_cast<MemIntrinsic>(&I)) {
+        clobber(G, MI->getDest());
+      } else if (auto *CB = dyn_cast<CallBase>(&I)) {
+        if (isa<DbgInfoIntrinsic>(CB) || CB->onlyReadsMemory())
+          continue;
+        Function *Callee = CB->getCalledFunction();
+        if (Callee && !Callee->isDeclaration())
+          continue; // its body is visited
+        for (Value *Arg : CB->args())
+          if (Arg->getType()->isPointerTy())
+            clobber(G, Arg);
+      } else if (I.mayWriteToMemory()) {
+        for (Value *Op : I.operands())
+          if (Op->getType()->isPointerTy())
+            clobber(G, Op);
+      }
+      if (RejectAll) {
+        SCCP_LOG(errs() << "[Sccp]: " << I << " may write unknown memory. "
+                        << "Fields of globals are not tracked.\n");
+        return;
+      }
+    }
+  }
+
+  // Check that the fields of each candidate are accessed consistently.
+  DenseMap<GlobalVariable *, std::map<uint64_t, Type *>> Fields;
+  for (const Access &A : Accesses) {
+    if (Rejected.count(A.GV))
+      continue;
+    if (!A.Ty->isIntOrPtrTy() && !A.Ty->isFloatingPointTy()) {
+      reject(A.GV, "one of its fields is not a scalar");
+      continue;
+    }
+    Type *&Ty = Fields[A.GV][A.Offset];
+    if (Ty && Ty != A.Ty)
+      reject(A.GV, "one of its fields is accessed with different types");
+    Ty = A.Ty;
+  }
+  for (GlobalVariable *GV : Candidates) {
+    if (Rejected.count(GV))
+      continue;
+    uint64_t Size = DL.getTypeAllocSize(GV->getValueType());
+    uint64_t End = 0;
+    for (auto &KV : Fields[GV]) {
+      if (KV.first < End) {
+        reject(GV, "its fields overlap");
+        break;
+      }
+      End = KV.first + DL.getTypeStoreSize(KV.second);
+    }
+    if (End > Size)
+      reject(GV, "it is accessed out of bounds");
+  }
+
+  for (GlobalVariable *GV : Candidates) {
+    if (Rejected.count(GV))
+      continue;
+    for (auto &KV : Fields[GV]) {
+      Constant *Init =
+          getInitializerAt(GV->getInitializer(), KV.first, KV.second, DL);
+      Solver.TrackFieldOfGlobalVariable(GV, KV.first, Init);
+      ++IPNumFieldsTracked;
+    }
+    SCCP_LOG(errs() << "[Sccp]: " << Fields[GV].size() << " fields of "
+                    << GV->getName() << " are tracked\n");
+  }
+  for (const Access &A : Accesses) {
+    if (!Rejected.count(A.GV))
+      Solver.AddFieldAccess(A.I, A.GV, A.Offset);
+  }
+}
+
 static void findReturnsToZap(Function &F,
                              SmallPtrSet<Function *, 32> &AddressTakenFunctions,
                              SmallVector<ReturnInst *, 8> &ReturnsToZap) {
@@ -1720,11 +2588,131 @@ static void findReturnsToZap(Function &F,
         ReturnsToZap.push_back(RI);
 }
 
+// Incremental IPSCCP
+//
+// With -Pipsccp-incremental, each run records in every defined
+// function the hash of its body (metadata occam.ipsccp.hash). The
+// next run only solves the functions whose hash changed, their
+// direct callers and their transitive callees (a changed function
+// can pass new constants down the call chain). The constants found
+// by the previous run are already folded in the code so the other
+// functions are skipped: they are neither visited nor transformed,
+// and the solver makes no assumption about them:
+//  - the functions called from a skipped function are treated as
+//    entry points (their arguments are overdefined and their returns
+//    are not zapped),
+//  - calls to skipped functions return overdefined values,
+//  - globals used or fields written by skipped functions are not
+//    tracked.
+// Therefore, the hash (see analysis/FunctionHash.h) only needs to be
+// a good change detector: a collision can only make IPSCCP less
+// precise.
+
+static const char *IPSCCPHashMD = "occam.ipsccp.hash";
+
+// computeSkippedFunctions - Add to Skipped the defined functions that
+// did not change since the last run and that neither call nor are
+// (transitively) called by a function that changed. Hashes is filled
+// with the current hash of each defined function.
+static void computeSkippedFunctions(Module &M, CallGraph &CG,
+                                    DenseMap<Function *, uint64_t> &Hashes,
+                                    SmallPtrSetImpl<Function *> &Skipped) {
+  SmallPtrSet<Function *, 32> Changed;
+  bool HasRecord = false;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    uint64_t Hash = analysis::hashFunction(F);
+    Hashes[&F] = Hash;
+    Optional<uint64_t> Recorded = analysis::getRecordedHash(F, IPSCCPHashMD);
+    HasRecord |= Recorded.hasValue();
+    if (!Recorded || *Recorded != Hash)
+      Changed.insert(&F);
+  }
+  // First run: solve everything.
+  if (!HasRecord)
+    return;
+
+  SmallPtrSet<Function *, 32> Affected(Changed.begin(), Changed.end());
+  // callers of a changed function
+  for (Function &F : M) {
+    if (F.isDeclaration() || Changed.count(&F))
+      continue;
+    for (auto &CR : *CG[&F]) {
+      Function *Callee = CR.second->getFunction();
+      if (Callee && Changed.count(Callee)) {
+        Affected.insert(&F);
+        break;
+      }
+    }
+  }
+  // transitive callees of a changed function
+  SmallPtrSet<Function *, 32> Visited(Changed.begin(), Changed.end());
+  SmallVector<Function *, 32> Worklist(Changed.begin(), Changed.end());
+  while (!Worklist.empty()) {
+    Function *F = Worklist.pop_back_val();
+    for (auto &CR : *CG[F]) {
+      Function *Callee = CR.second->getFunction();
+      if (!Callee || Callee->isDeclaration())
+        continue;
+      if (Visited.insert(Callee).second) {
+        Affected.insert(Callee);
+        Worklist.push_back(Callee);
+      }
+    }
+  }
+
+  unsigned NumDefined = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    ++NumDefined;
+    if (!Affected.count(&F))
+      Skipped.insert(&F);
+  }
+  errs() << "IPSCCP: " << Changed.size() << " functions changed since the "
+         << "last run. Solving " << NumDefined - Skipped.size() << " of "
+         << NumDefined << " functions.\n";
+}
+
+// hasSkippedCaller - Return true if F is called from a skipped function.
+static bool hasSkippedCaller(Function &F,
+                             const SmallPtrSetImpl<Function *> &Skipped) {
+  if (Skipped.empty())
+    return false;
+  for (User *U : F.users())
+    if (auto *CB = dyn_cast<CallBase>(U))
+      if (Skipped.count(CB->getFunction()))
+        return true;
+  return false;
+}
+
+// isUsedInSkippedFunction - Return true if V is used by an instruction
+// of a skipped function.
+static bool isUsedInSkippedFunction(Value *V,
+                                    const SmallPtrSetImpl<Function *> &Skipped) {
+  if (Skipped.empty())
+    return false;
+  for (User *U : V->users())
+    if (auto *I = dyn_cast<Instruction>(U))
+      if (Skipped.count(I->getFunction()))
+        return true;
+  return false;
+}
+
 // runIPSCCP() - Run the interprocedural Sparse Conditional Constant
 // Propagation algorithm, and return true if the function was
 // modified.
 //
-static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
+static bool runIPSCCP(Module &M, SCCPSolver &Solver, CallGraph &CG,
+                      seadsa::GlobalAnalysis *DSA) {
+  // Skipped - The functions that are not solved nor transformed by an
+  // incremental run. Hashes - The hash of each defined function.
+  SmallPtrSet<Function *, 32> Skipped;
+  DenseMap<Function *, uint64_t> Hashes;
+  if (Incremental)
+    computeSkippedFunctions(M, CG, Hashes, Skipped);
+
   // AddressTakenFunctions - This set keeps track of the address-taken functions
   // that are in the input.  As IPSCCP runs through and simplifies code,
   // functions that were address taken can end up losing their
@@ -1734,11 +2722,13 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
 
   errs() << "IPSCCP analysis started ... \n";
 
+  Solver.NumberValues(M, CG);
+
   // Loop over all functions, marking arguments to those with their addresses
   // taken or that are external as overdefined.
   //
   for (Function &F : M) {
-    if (F.isDeclaration())
+    if (F.isDeclaration() || Skipped.count(&F))
       continue;
 
     // If this is an exact definition of this function, then we can propagate
@@ -1753,7 +2743,7 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
     // arguments and return value aggressively, and can assume it is not called
     // unless we see evidence to the contrary.
     if (F.hasLocalLinkage()) {
-      if (F.hasAddressTaken()) {
+      if (F.hasAddressTaken() || hasSkippedCaller(F, Skipped)) {
         AddressTakenFunctions.insert(&F);
       } else {
         Solver.AddArgumentTrackedFunction(&F);
@@ -1775,7 +2765,8 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
   // propagate constants through them.
   for (GlobalVariable &G : M.globals()) {
     if (!G.isConstant() && G.hasLocalLinkage() &&
-        G.hasDefinitiveInitializer() && !AddressIsTaken(&G)) {
+        G.hasDefinitiveInitializer() && !AddressIsTaken(&G) &&
+        !isUsedInSkippedFunction(&G, Skipped)) {
       Solver.TrackValueOfGlobalVariable(&G);
       SCCP_LOG(errs() << "[Sccp]: " << G.getName() << " is tracked\n");
     } else {
@@ -1790,10 +2781,16 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
                  errs() << "\t it does not have definite initializer\n";
                } if (AddressIsTaken(&G)) {
                  errs() << "\t its address may be taken\n";
+               } if (isUsedInSkippedFunction(&G, Skipped)) {
+                 errs() << "\t it is used by a skipped function\n";
                });
     }
   }
 
+  // Nothing to track if all the functions are skipped.
+  if (DSA && (Skipped.empty() || Skipped.size() < Hashes.size()))
+    trackFieldsOfGlobals(M, *DSA, Skipped, Solver);
+
   errs() << "IPSCCP resolution of undefs started.\n";
   // Solve for constants.
   bool ResolvedUndefs = true;
@@ -1821,80 +2818,40 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
   // Iterate over all of the instructions in the module, replacing them with
   // constants if we have found them to be of constant values.
   //
-  SmallVector<BasicBlock *, 512> BlocksToErase;
-
+  std::vector<Function *> Functions;
   for (Function &F : M) {
-    if (F.isDeclaration())
-      continue;
-
-    if (Solver.isBlockExecutable(&F.front())) {
-      for (Function::arg_iterator AI = F.arg_begin(), E = F.arg_end(); AI != E;
-           ++AI)
-        if (!AI->use_empty() && tryToReplaceWithConstant(Solver, &*AI)) {
-          ++IPNumArgsElimed;
-        }
-    }
-
-    for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
-      if (!Solver.isBlockExecutable(&*BB)) {
-        LLVM_DEBUG(dbgs() << "  BasicBlock Dead:" << *BB);
-
-        ++IPNumDeadBlocks;
-        IPNumInstRemoved +=
-            changeToUnreachable(BB->getFirstNonPHI(), /*UseLLVMTrap=*/false);
-
-        MadeChanges = true;
-
-        if (&*BB != &F.front())
-          BlocksToErase.push_back(&*BB);
-        continue;
-      }
-
-      for (BasicBlock::iterator BI = BB->begin(), E = BB->end(); BI != E;) {
-        Instruction *Inst = &*BI++;
-        if (Inst->getType()->isVoidTy())
-          continue;
-        if (tryToReplaceWithConstant(Solver, Inst)) {
-          if (isInstructionTriviallyDead(Inst)) {
-            Inst->eraseFromParent();
-          }
-          // Hey, we just changed something!
-          MadeChanges = true;
-          ++IPNumInstRemoved;
-        }
-      }
-    }
-
-    // Now that all instructions in the function are constant folded, erase dead
-    // blocks, because we can now use ConstantFoldTerminator to get rid of
-    // in-edges.
-    for (unsigned i = 0, e = BlocksToErase.size(); i != e; ++i) {
-      // If there are any PHI nodes in this successor, drop entries for BB now.
-      BasicBlock *DeadBB = BlocksToErase[i];
-      for (Value::user_iterator UI = DeadBB->user_begin(),
-                                UE = DeadBB->user_end();
-           UI != UE;) {
-        // Grab the user and then increment the iterator early, as the user
-        // will be deleted. Step past all adjacent uses from the same user.
-        auto *I = dyn_cast<Instruction>(*UI);
-        do {
-          ++UI;
-        } while (UI != UE && *UI == I);
-
-        // Ignore blockaddress users; BasicBlock's dtor will handle them.
-        if (!I)
-          continue;
-
-        bool Folded = ConstantFoldTerminator(I->getParent());
-        assert(Folded &&
-               "Expect TermInst on constantint or blockaddress to be folded");
-        (void)Folded;
-      }
+    if (!F.isDeclaration() && !Skipped.count(&F))
+      Functions.push_back(&F);
+  }
+
+  // Plan the changes of each function, possibly in parallel, and then
+  // apply them.
+  std::vector<FunctionRewrite> Rewrites(Functions.size());
+  const unsigned FunctionsPerChunk = 256;
+  unsigned NumChunks =
+      (Functions.size() + FunctionsPerChunk - 1) / FunctionsPerChunk;
+  auto planChunk = [&](unsigned Chunk) {
+    unsigned Begin = Chunk * FunctionsPerChunk;
+    unsigned End =
+        std::min<unsigned>(Begin + FunctionsPerChunk, Functions.size());
+    for (unsigned i = Begin; i < End; ++i)
+      planRewrite(Solver, *Functions[i], Rewrites[i]);
+  };
+  if (Threads == 1 || NumChunks <= 1) {
+    for (unsigned i = 0; i < NumChunks; ++i)
+      planChunk(i);
+  } else {
+    std::unique_ptr<ThreadPool> Pool(Threads == 0 ? new ThreadPool()
+                                                  : new ThreadPool(Threads));
+    for (unsigned i = 0; i < NumChunks; ++i)
+      Pool->async(planChunk, i);
+    Pool->wait();
+  }
 
-      // Finally, delete the basic block.
-      F.getBasicBlockList().erase(DeadBB);
-    }
-    BlocksToErase.clear();
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    MadeChanges |= applyRewrite(Solver, *Functions[i], Rewrites[i]);
+    // Release the memory of the plan as soon as possible.
+    Rewrites[i] = FunctionRewrite();
   }
 
   // If we inferred constant or undef return values for a function, we replaced
@@ -1912,7 +2869,8 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
   const DenseMap<Function *, LatticeVal> &RV = Solver.getTrackedRetVals();
   for (const auto &I : RV) {
     Function *F = I.first;
-    if (I.second.isOverdefined() || F->getReturnType()->isVoidTy())
+    if (I.second.isOverdefined() || I.second.isConstantRange() ||
+        F->getReturnType()->isVoidTy())
       continue;
     findReturnsToZap(*F, AddressTakenFunctions, ReturnsToZap);
   }
@@ -1942,6 +2900,9 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
 
     assert(!I->second.isOverdefined() &&
            "Overdefined values should have been taken out of the map!");
+    // The loads of a global in a range have not been replaced.
+    if (I->second.isConstantRange())
+      continue;
     LLVM_DEBUG(dbgs() << "Found that GV '" << GV->getName()
                       << "' is constant!\n");
 
@@ -1999,6 +2960,18 @@ static bool runIPSCCP(Module &M, SCCPSolver &Solver) {
   }
   errs() << "IPSCCP constant folding transformation finished.\n";
 
+  if (Incremental) {
+    // Record the hash of the functions as this run leaves them. The
+    // skipped functions have not been modified.
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      analysis::recordHash(F, IPSCCPHashMD,
+                           Skipped.count(&F) ? Hashes[&F]
+                                             : analysis::hashFunction(F));
+    }
+  }
+
   return MadeChanges;
 }
 
@@ -2029,7 +3002,11 @@ private:
 public:
   static char ID; // Pass identification, replacement for typeid
 
-  IPSCCPPass() : ModulePass(ID), DL(nullptr), TLIWrapper(nullptr) {}
+  IPSCCPPass() : ModulePass(ID), DL(nullptr), TLIWrapper(nullptr) {
+    llvm::PassRegistry &Registry = *llvm::PassRegistry::getPassRegistry();
+    llvm::initializeDsaAnalysisPass(Registry);
+    llvm::initializeCompleteCallGraphPass(Registry);
+  }
 
   bool runOnModule(Module &M) override {
     if (skipModule(M)) {
@@ -2041,8 +3018,14 @@ public:
     DL = &M.getDataLayout();
     TLIWrapper = &getAnalysis<TargetLibraryInfoWrapperPass>();
 
+    seadsa::GlobalAnalysis *DSA = nullptr;
+    if (TrackFields) {
+      DSA = &getAnalysis<seadsa::DsaAnalysis>().getDsaAnalysis();
+    }
+
     SCCPSolver Solver(*DL, TLIWrapper);
-    return runIPSCCP(M, Solver);
+    CallGraph &CG = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+    return runIPSCCP(M, Solver, CG, DSA);
   }
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
@@ -2050,6 +3033,9 @@ public:
     AU.addRequired<TargetLibraryInfoWrapperPass>();
     AU.addRequired<CallGraphWrapperPass>();
     AU.addRequired<DominatorTreeWrapperPass>();
+    if (TrackFields) {
+      AU.addRequired<seadsa::DsaAnalysis>();
+    }
   }
 
   StringRef getPassName() const override {
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+usage () {
+    echo "Usage: $0 prog.c proto|mapped [opt args for -Pinterface and -Pspecialize]"
+}
+
+if [ $# -lt 2 ]
+then
+    usage 
+    exit 1
+fi
+
+
+CLANG=${LLVM_HOME}/bin/clang
+OPT=${LLVM_HOME}/bin/opt
+DIS=${LLVM_HOME}/bin/llvm-dis
+
+if [[ $(uname -s) == Linux ]]; then
+    LIB_EXT="so"
+else
+    if [[ $(uname -s) == Darwin ]]; then
+	LIB_EXT="dylib"	
+    else	 
+	echo "Unsupported OS"
+	exit 1
+    fi
+fi
+
+LIBS="-load=${OCCAM_HOME}/lib/libSeaDsa.${LIB_EXT}"
+LIBS="${LIBS} -load=${OCCAM_HOME}/lib/libprevirt.${LIB_EXT}"             
+
+dirpath=$(dirname "$1")
+filename=$(basename -- "$1")
+extension="${filename##*.}"
+filename="${filename%.*}"
+
+FORMAT=$2
+if [ "$FORMAT" == "mapped" ]; then
+    INTERFACE_ARGS="-Pinterface-output-mapped"
+    SPECIALIZE_ARGS="-Pspecialize-output-mapped"
+elif [ "$FORMAT" == "proto" ]; then
+    INTERFACE_ARGS=""
+    SPECIALIZE_ARGS=""
+else
+    usage
+    exit 1
+fi
+shift 2
+
+# The test is split in two modules: main calls the functions that lib
+# defines so the calls go through the interface files.
+PREFIX=$dirpath/$filename.$FORMAT
+$CLANG -c -emit-llvm -O0 -Xclang -disable-O0-optnone -DOCCAM_MAIN $1 -o $PREFIX.main.bc
+$CLANG -c -emit-llvm -O0 -Xclang -disable-O0-optnone -DOCCAM_LIB $1 -o $PREFIX.lib.bc
+$OPT -mem2reg $PREFIX.main.bc -o $PREFIX.main.bc
+$OPT -mem2reg $PREFIX.lib.bc -o $PREFIX.lib.bc
+
+# main.bc -> main.iface -> lib.rw -> main.bc
+$OPT $LIBS -Pinterface -Pinterface-output $PREFIX.main.iface $INTERFACE_ARGS \
+     "$@" $PREFIX.main.bc -o /dev/null
+$OPT $LIBS -Pspecialize -Pspecialize-input $PREFIX.main.iface \
+     -Pspecialize-output $PREFIX.lib.rw $SPECIALIZE_ARGS "$@" \
+     $PREFIX.lib.bc -o $PREFIX.lib.o.bc
+$OPT $LIBS -Prewrite -Prewrite-input $PREFIX.lib.rw \
+     $PREFIX.main.bc -o $PREFIX.main.o.bc
+# for lit
+$DIS $PREFIX.main.o.bc -o $1.$FORMAT.output
+$DIS $PREFIX.lib.o.bc -o - >> $1.$FORMAT.output
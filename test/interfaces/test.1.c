@@ -0,0 +1,49 @@
+// RUN: %cmd "%s" proto
+// RUN: cat "%s".proto.output 2>&1 | FileCheck "%s"
+// RUN: %cmd "%s" mapped
+// RUN: cat "%s".mapped.output 2>&1 | FileCheck "%s"
+
+// The interface of main and the rewrites of lib go through the
+// interface files so the same calls must be specialized with both
+// formats.
+
+// CHECK-LABEL: define {{.*}}@main(
+// CHECK: call {{.*}}@"__occam_spec.add(?,0x5)"(
+// CHECK: call {{.*}}@"__occam_spec.length(S:{{[0-9A-F]+}})"()
+// CHECK: call {{.*}}@"__occam_spec.get(g)"()
+// CHECK: call {{.*}}@"__occam_spec.get(null)"()
+
+// CHECK-DAG: define {{.*}}@"__occam_spec.add(?,0x5)"(i32
+// CHECK-DAG: define {{.*}}@"__occam_spec.length(S:{{[0-9A-F]+}})"()
+// CHECK-DAG: define {{.*}}@"__occam_spec.get(g)"()
+// CHECK-DAG: define {{.*}}@"__occam_spec.get(null)"()
+
+int add(int x, int y);
+int length(const char *s);
+int get(int *p);
+
+#ifdef OCCAM_LIB
+int add(int x, int y) { return x + y; }
+
+int length(const char *s) {
+  int n = 0;
+  while (s[n]) {
+    n++;
+  }
+  return n;
+}
+
+int get(int *p) { return p ? *p : -1; }
+#endif
+
+#ifdef OCCAM_MAIN
+int g = 7;
+
+int main(int argc, char *argv[]) {
+  int r = add(argc, 5);
+  r += length("occam");
+  r += get(&g);
+  r += get(0);
+  return r;
+}
+#endif
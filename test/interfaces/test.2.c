@@ -0,0 +1,56 @@
+// RUN: %cmd "%s" proto -Pinterface-int-ranges -Pspecialize-int-ranges
+// RUN: cat "%s".proto.output 2>&1 | FileCheck "%s"
+// RUN: %cmd "%s" mapped -Pinterface-int-ranges -Pspecialize-int-ranges
+// RUN: cat "%s".mapped.output 2>&1 | FileCheck "%s"
+
+// Int-set and int-range arguments must survive both interface
+// formats: main calls the dispatcher of add and the range copy of
+// scale.
+
+// CHECK-LABEL: define {{.*}}@main(
+// CHECK: call {{.*}}@"__occam_spec.add.dispatch<?,{{[{]}}0x{{.*}}}>"(
+// CHECK: call {{.*}}@"__occam_spec.scale.range<?,[0xa..0xf)>"(
+
+// CHECK-DAG: define {{.*}}@"__occam_spec.add.dispatch<?,{{[{]}}0x{{.*}}}>"(
+// CHECK-DAG: define {{.*}}@"__occam_spec.add(?,0x1)"(
+// CHECK-DAG: define {{.*}}@"__occam_spec.add(?,0x2)"(
+// CHECK-DAG: define {{.*}}@"__occam_spec.scale.range<?,[0xa..0xf)>"(
+// CHECK-DAG: call void @llvm.assume(
+
+int add(int x, int y);
+int scale(int x, int k);
+
+#ifdef OCCAM_LIB
+int add(int x, int y) { return x + y; }
+
+int scale(int x, int k) {
+  if (k < 10) {
+    return 0;
+  }
+  return x * k;
+}
+#endif
+
+#ifdef OCCAM_MAIN
+int main(int argc, char *argv[]) {
+  int y = argc > 1 ? 1 : 2;
+  int k;
+  switch (argc) {
+  case 1:
+    k = 10;
+    break;
+  case 2:
+    k = 11;
+    break;
+  case 3:
+    k = 12;
+    break;
+  case 4:
+    k = 13;
+    break;
+  default:
+    k = 14;
+  }
+  return add(argc, y) + scale(argc, k);
+}
+#endif
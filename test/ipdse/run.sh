@@ -1,10 +1,10 @@
 #!/bin/bash
 
 usage () {
-    echo "Usage: $0 prog.c"
+    echo "Usage: $0 prog.c [extra opt args]"
 }
 
-if [ $# -ne 1 ]
+if [ $# -lt 1 ]
 then
     usage 
     exit 1
@@ -35,11 +35,14 @@ extension="${filename##*.}"
 filename="${filename%.*}"
 
 
-IN=$1
+SRC=$1
+shift
+IN=$SRC
 OUT=$dirpath/$filename.bc
 $CLANG -c -emit-llvm -O0 -Xclang -disable-O0-optnone $IN -o $OUT
 IN=$OUT
 OUT=$dirpath/$filename.o.bc
-# OCCAM IPDSE + OCCAM IPSCCP + LLVM GLOBALDCE
-$OPT $LIBS -mem2reg -ipdse -Pipsccp -globaldce $IN -o $OUT
-$DIS $OUT -o $1.output # for lit
+# OCCAM IPDSE + OCCAM IPSCCP (+ extra args) + LLVM GLOBALDCE
+# The messages of the passes are kept in .log for lit
+$OPT $LIBS -mem2reg -ipdse -Pipsccp "$@" -globaldce $IN -o $OUT 2> $SRC.log
+$DIS $OUT -o $SRC.output # for lit
@@ -0,0 +1,33 @@
+// RUN: %cmd "%s" --sea-dsa=cs --sea-dsa-type-aware --horn-sea-dsa-split --ipdse-only-singleton=false
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// CHECK-LABEL: define {{.*}}@main(
+// CHECK-NOT: store i32 42
+// CHECK: store i32 1
+// CHECK-NOT: store i32 43
+
+// The y fields of a stack and a heap struct are never read. The
+// structs are only passed to an internal function and to free.
+
+#include <stdlib.h>
+extern int nd_int(void);
+
+struct point {
+  int x;
+  int y;
+};
+
+static int getx(struct point *p) {
+  return p->x;
+}
+
+int main(int argc, char* argv[]) {
+  struct point pt;
+  pt.x = nd_int();  // LIVE STORE
+  pt.y = 42;        // DEAD STORE
+  struct point *q = (struct point *)malloc(sizeof(struct point));
+  q->x = 1;         // LIVE STORE
+  q->y = 43;        // DEAD STORE
+  int r = getx(&pt) + getx(q);
+  free(q);
+  return r;
+}
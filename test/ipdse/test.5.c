@@ -0,0 +1,26 @@
+// RUN: %cmd "%s" -Pipsccp-track-ranges
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// CHECK-NOT: You should not see this message
+
+// IPSCCP with ranges: k is in [1,4) so the comparison and the switch
+// case below can be folded.
+
+#include <stdio.h>
+
+static int f(int k) {
+  if (k >= 10) {
+    printf("1. You should not see this message\n");
+  }
+  switch (k) {
+  case 20:
+    printf("2. You should not see this message\n");
+    break;
+  default:
+    break;
+  }
+  return k;
+}
+
+int main(int argc, char* argv[]) {
+  return f(1) + f(2) + f(3);
+}
@@ -0,0 +1,25 @@
+// RUN: %cmd "%s" -Pipsccp-track-ranges -Pipsccp-range-widening-steps=2
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// CHECK: You should see this message
+
+// IPSCCP with ranges: the range of i grows at every iteration of the
+// loop so it must be widened to overdefined. The comparison cannot be
+// folded.
+
+#include <stdio.h>
+extern int nd_int(void);
+
+static int count(int step) {
+  int i = 0;
+  while (nd_int()) {
+    i += step;
+  }
+  return i;
+}
+
+int main(int argc, char* argv[]) {
+  if (count(1) == 100) {
+    printf("You should see this message\n");
+  }
+  return 0;
+}
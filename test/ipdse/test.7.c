@@ -0,0 +1,37 @@
+// RUN: %cmd "%s" -Pipsccp-track-fields
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// CHECK-NOT: You should not see this message
+// CHECK: You should see this message
+
+// IPSCCP with fields: debug is never written and level is always 3.
+// mode is written with a value that is not known.
+
+#include <stdio.h>
+extern int nd_int(void);
+
+struct config {
+  int debug;
+  int level;
+  int mode;
+};
+
+static struct config cfg = {0, 3, 0};
+
+static void init(void) {
+  cfg.level = 3;
+  cfg.mode = nd_int();
+}
+
+int main(int argc, char* argv[]) {
+  init();
+  if (cfg.debug) {
+    printf("1. You should not see this message\n");
+  }
+  if (cfg.level != 3) {
+    printf("2. You should not see this message\n");
+  }
+  if (cfg.mode) {
+    printf("You should see this message\n");
+  }
+  return 0;
+}
@@ -0,0 +1,23 @@
+// RUN: %cmd "%s" -Pipsccp-incremental -Pipsccp
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// RUN: cat "%s".log 2>&1  | FileCheck --check-prefix=LOG "%s"
+// CHECK-NOT: You should not see this message
+// CHECK: define {{.*}}@main({{.*}}!occam.ipsccp.hash
+
+// Incremental IPSCCP: the first run solves all functions and records
+// their hashes. Nothing changes before the second run so it skips
+// all of them.
+// LOG: IPSCCP: 0 functions changed since the last run. Solving 0 of 2 functions.
+
+#include <stdio.h>
+
+static int get(int x) {
+  return x;
+}
+
+int main(int argc, char* argv[]) {
+  if (get(1) != 1) {
+    printf("You should not see this message\n");
+  }
+  return 0;
+}
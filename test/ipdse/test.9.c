@@ -0,0 +1,22 @@
+// RUN: %cmd "%s" --sea-dsa=cs --sea-dsa-type-aware --horn-sea-dsa-split --ipdse-only-singleton=false
+// RUN: cat "%s".output 2>&1  | FileCheck  "%s"
+// CHECK-LABEL: define {{.*}}@make(
+// CHECK: store i32 1
+// CHECK: store i32 2
+
+// make is external so its callers in other modules can read the
+// buffer it returns: the stores are live.
+
+#include <stdlib.h>
+
+int *make(void) {
+  int *p = (int *)malloc(2 * sizeof(int));
+  p[0] = 1;   // LIVE STORE
+  p[1] = 2;   // LIVE STORE
+  return p;
+}
+
+int main(int argc, char* argv[]) {
+  make();
+  return 0;
+}
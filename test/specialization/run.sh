@@ -0,0 +1,42 @@
+#!/bin/bash
+
+usage () {
+    echo "Usage: $0 prog.ll [opt args]"
+}
+
+if [ $# -lt 1 ]
+then
+    usage 
+    exit 1
+fi
+
+
+OPT=${LLVM_HOME}/bin/opt
+DIS=${LLVM_HOME}/bin/llvm-dis
+
+if [[ $(uname -s) == Linux ]]; then
+    LIB_EXT="so"
+else
+    if [[ $(uname -s) == Darwin ]]; then
+	LIB_EXT="dylib"	
+    else	 
+	echo "Unsupported OS"
+	exit 1
+    fi
+fi
+
+LIBS="-load=${OCCAM_HOME}/lib/libSeaDsa.${LIB_EXT}"
+LIBS="${LIBS} -load=${OCCAM_HOME}/lib/libprevirt.${LIB_EXT}"             
+
+dirpath=$(dirname "$1")
+filename=$(basename -- "$1")
+filename="${filename%.*}"
+
+
+SRC=$1
+shift
+OUT=$dirpath/$filename.bc
+# The OCCAM passes are given as arguments
+# The messages of the passes are kept in .log for lit
+$OPT $LIBS "$@" $SRC -o $OUT 2> $SRC.log
+$DIS $OUT -o $SRC.output # for lit
@@ -0,0 +1,64 @@
+; RUN: %cmd "%s" -Pmerge-specialized
+; RUN: cat "%s".output 2>&1 | FileCheck "%s"
+; RUN: cat "%s".log 2>&1 | FileCheck --check-prefix=LOG "%s"
+
+; The four copies of f are identical so they are merged into the
+; first one:
+;  - 0x2 is local and only called directly so its calls are
+;    redirected and it is removed,
+;  - 0x3 is not local so it becomes a thunk,
+;  - 0x4 is local but its address is stored in @fptr so it is kept
+;    as a thunk.
+
+; LOG: merged __occam_spec.f(?,0x2) into __occam_spec.f(?,0x1)
+; LOG: __occam_spec.f(?,0x3) is now a thunk to __occam_spec.f(?,0x1)
+; LOG: __occam_spec.f(?,0x4) is now a thunk to __occam_spec.f(?,0x1)
+; LOG: Merged 1 functions and created 2 thunks.
+
+; CHECK: @fptr = global i32 (i32)* @"__occam_spec.f(?,0x4)"
+; CHECK-NOT: 0x2
+; CHECK-LABEL: define internal i32 @"__occam_spec.f(?,0x1)"(i32 %x)
+; CHECK-NEXT: mul i32 %x, %x
+; CHECK-NOT: 0x2
+; CHECK-LABEL: define i32 @"__occam_spec.f(?,0x3)"(i32 %x)
+; CHECK-NEXT: entry:
+; CHECK-NEXT: tail call i32 @"__occam_spec.f(?,0x1)"(i32 %x)
+; CHECK-LABEL: define internal i32 @"__occam_spec.f(?,0x4)"(i32 %x)
+; CHECK-NEXT: entry:
+; CHECK-NEXT: tail call i32 @"__occam_spec.f(?,0x1)"(i32 %x)
+; CHECK-LABEL: define i32 @main(i32 %a, i32 %b, i32 %c)
+; CHECK-NEXT: call i32 @"__occam_spec.f(?,0x1)"(i32 %a)
+; CHECK-NEXT: call i32 @"__occam_spec.f(?,0x1)"(i32 %b)
+; CHECK-NEXT: call i32 @"__occam_spec.f(?,0x3)"(i32 %c)
+; CHECK-NOT: 0x2
+
+@fptr = global i32 (i32)* @"__occam_spec.f(?,0x4)"
+
+define internal i32 @"__occam_spec.f(?,0x1)"(i32 %x) {
+  %y = mul i32 %x, %x
+  ret i32 %y
+}
+
+define internal i32 @"__occam_spec.f(?,0x2)"(i32 %x) {
+  %y = mul i32 %x, %x
+  ret i32 %y
+}
+
+define i32 @"__occam_spec.f(?,0x3)"(i32 %x) {
+  %y = mul i32 %x, %x
+  ret i32 %y
+}
+
+define internal i32 @"__occam_spec.f(?,0x4)"(i32 %x) {
+  %y = mul i32 %x, %x
+  ret i32 %y
+}
+
+define i32 @main(i32 %a, i32 %b, i32 %c) {
+  %r1 = call i32 @"__occam_spec.f(?,0x1)"(i32 %a)
+  %r2 = call i32 @"__occam_spec.f(?,0x2)"(i32 %b)
+  %r3 = call i32 @"__occam_spec.f(?,0x3)"(i32 %c)
+  %s1 = add i32 %r1, %r2
+  %s2 = add i32 %s1, %r3
+  ret i32 %s2
+}
@@ -0,0 +1,81 @@
+; RUN: %cmd "%s" -Ppeval -Ppeval-policy=cost-benefit
+; RUN: cat "%s".output 2>&1 | FileCheck "%s"
+; RUN: cat "%s".log 2>&1 | FileCheck --check-prefix=LOG "%s"
+; RUN: %cmd "%s" -Ppeval -Ppeval-policy=cost-benefit -Ppeval-max-growth=70
+; RUN: cat "%s".output 2>&1 | FileCheck --check-prefix=KEEP "%s"
+; RUN: cat "%s".log 2>&1 | FileCheck --check-prefix=GROWTH "%s"
+
+; Cost-benefit intra-module specialization:
+;  - knowing mode folds the comparison and the branch of sel so the
+;    callsite is specialized,
+;  - knowing k only folds 1 of the 11 instructions of lin, which is
+;    below -Ppeval-min-benefit (10%), so the callsite is left alone,
+;  - the copy of old made by a previous run (10 instructions) counts
+;    against -Ppeval-max-growth: with 70% of the 21 instructions of
+;    the module there is no room left for the copy of sel.
+
+; LOG: module has 21 instructions, the budget is 21 new instructions and 10 are already used.
+; LOG: [CostBenefitSpecPolicy] lin not worth to copy: size=11 folded instructions=1 folded branches=0
+; LOG: [CostBenefitSpecPolicy] sel will be copied: size=6 folded instructions=1 folded branches=1
+; LOG: Specialized 1 functions.
+
+; CHECK-LABEL: define i32 @main(i32 %x)
+; CHECK-NEXT: call i32 @"__occam_spec.sel{{.*}}"(i32 %x)
+; CHECK-NEXT: call i32 @lin(i32 5, i32 %x)
+
+; GROWTH: module has 21 instructions, the budget is 14 new instructions and 10 are already used.
+; GROWTH: [CostBenefitSpecPolicy] sel cannot be copied: code growth budget exhausted
+; GROWTH: No specialization took place
+
+; KEEP-LABEL: define i32 @main(i32 %x)
+; KEEP-NEXT: call i32 @sel(i32 0, i32 %x)
+; KEEP-NEXT: call i32 @lin(i32 5, i32 %x)
+; KEEP-NOT: __occam_spec.sel
+
+define internal i32 @sel(i32 %mode, i32 %x) {
+entry:
+  %c = icmp eq i32 %mode, 0
+  br i1 %c, label %then, label %else
+
+then:
+  %r1 = add i32 %x, 1
+  ret i32 %r1
+
+else:
+  %r2 = mul i32 %x, 3
+  ret i32 %r2
+}
+
+define internal i32 @lin(i32 %k, i32 %x) {
+  %k2 = mul i32 %k, 2
+  %x1 = add i32 %x, 1
+  %x2 = mul i32 %x1, %x
+  %x3 = add i32 %x2, 7
+  %x4 = mul i32 %x3, %x
+  %x5 = add i32 %x4, 11
+  %x6 = mul i32 %x5, %x
+  %x7 = add i32 %x6, 13
+  %x8 = mul i32 %x7, %x
+  %x9 = xor i32 %x8, %k2
+  ret i32 %x9
+}
+
+define internal i32 @"__occam_spec.old(?,0x1)"(i32 %x) {
+  %y1 = add i32 %x, 1
+  %y2 = mul i32 %y1, %x
+  %y3 = add i32 %y2, 1
+  %y4 = mul i32 %y3, %x
+  %y5 = add i32 %y4, 1
+  %y6 = mul i32 %y5, %x
+  %y7 = add i32 %y6, 1
+  %y8 = mul i32 %y7, %x
+  %y9 = add i32 %y8, 1
+  ret i32 %y9
+}
+
+define i32 @main(i32 %x) {
+  %a = call i32 @sel(i32 0, i32 %x)
+  %b = call i32 @lin(i32 5, i32 %x)
+  %s = add i32 %a, %b
+  ret i32 %s
+}
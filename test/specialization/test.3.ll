@@ -0,0 +1,57 @@
+; RUN: %cmd "%s" -Ppeval -Ppeval-policy=profile -Ppeval-profile=%S/test.3.prof
+; RUN: cat "%s".output 2>&1 | FileCheck "%s"
+; RUN: cat "%s".log 2>&1 | FileCheck --check-prefix=LOG "%s"
+; RUN: %cmd "%s" -Ppeval -Ppeval-policy=profile -Ppeval-profile=%S/test.3.prof -Pinliner -Pinline-hinted-functions
+; RUN: cat "%s".output 2>&1 | FileCheck --check-prefix=INLINE "%s"
+
+; Profile-guided intra-module specialization. The hot threshold is
+; 1% of the hottest count (1000) so:
+;  - main -> hot (1000, <caller> <callee> <count> line) is hot,
+;  - warm (500, <callee> <count> line) is hot,
+;  - main -> cold (2) is cold and left alone.
+; The copies of hot callsites get the occam-inline hint so
+; -Pinline-hinted-functions inlines them.
+
+; LOG: Read 2 callsite counts and 3 function counts from {{.*}}test.3.prof
+; LOG: Hot threshold is 10
+; LOG: Specialized 2 functions.
+
+; CHECK-LABEL: define i32 @main(i32 %x)
+; CHECK-NEXT: call i32 @"__occam_spec.hot{{.*}}"(i32 %x)
+; CHECK-NEXT: call i32 @"__occam_spec.warm{{.*}}"(i32 %x)
+; CHECK-NEXT: call i32 @cold(i32 3, i32 %x)
+; CHECK-DAG: define internal i32 @"__occam_spec.hot{{.*}}"(i32 %x) #[[HINT:[0-9]+]]
+; CHECK-DAG: define internal i32 @"__occam_spec.warm{{.*}}"(i32 %x) #[[HINT]]
+; CHECK: attributes #[[HINT]] = { "occam-inline" }
+
+; INLINE-LABEL: define i32 @main(i32 %x)
+; INLINE-NOT: call
+; INLINE: mul i32 %x, 7
+; INLINE-NOT: call
+; INLINE: add i32 %x, 9
+; INLINE-NOT: call
+; INLINE: call i32 @cold(i32 3, i32 %x)
+
+define internal i32 @hot(i32 %k, i32 %x) {
+  %r = mul i32 %x, %k
+  ret i32 %r
+}
+
+define internal i32 @warm(i32 %k, i32 %x) {
+  %r = add i32 %x, %k
+  ret i32 %r
+}
+
+define internal i32 @cold(i32 %k, i32 %x) {
+  %r = sub i32 %x, %k
+  ret i32 %r
+}
+
+define i32 @main(i32 %x) {
+  %a = call i32 @hot(i32 7, i32 %x)
+  %b = call i32 @warm(i32 9, i32 %x)
+  %c = call i32 @cold(i32 3, i32 %x)
+  %s1 = add i32 %a, %b
+  %s2 = add i32 %s1, %c
+  ret i32 %s2
+}